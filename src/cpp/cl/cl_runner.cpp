@@ -72,6 +72,8 @@ namespace clest {
       }
 
       uContext = std::make_unique<cl::Context>(*uDevices);
+      uQueue = std::make_unique<cl::CommandQueue>(*uContext,
+                                                  uDevices->front());
     } catch (cl::Error & err) {
       throw clest::Exception::build("OpenCL error: {} ({})",
                                     err.what(),
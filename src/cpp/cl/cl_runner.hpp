@@ -28,6 +28,19 @@ namespace clest {
     void loadProgram(const std::string & name,
                      const std::string & path);
 
+    bool hasProgram(const std::string & name) const {
+      return mPrograms.find(name) != mPrograms.end();
+    }
+
+    const cl::Context & context() const { return *uContext; }
+    const std::vector<cl::Device> & devices() const { return *uDevices; }
+
+    /// In-order queue on the first chosen device
+    /// Kernels made with `makeKernel` must be enqueued with
+    /// `cl::EnqueueArgs(queue(), ...)`, since the default queue belongs
+    /// to the default context rather than to this runner
+    cl::CommandQueue & queue() { return *uQueue; }
+
     template <typename... T>
     cl::make_kernel<T...> makeKernel(const std::string & program,
                                      const std::string & kernelName) {
@@ -119,6 +132,7 @@ namespace clest {
     std::unordered_map<std::string, cl::Program> mPrograms;
     std::unique_ptr<std::vector<cl::Device>> uDevices;
     std::unique_ptr<cl::Context> uContext;
+    std::unique_ptr<cl::CommandQueue> uQueue;
   };
 }
 
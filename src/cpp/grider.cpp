@@ -1,27 +1,87 @@
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
 #include <iostream>
+#include <memory>
 
 #include <clest/util.hpp>
 #include <clest/ostream.hpp>
 
 #include "las/grid_file.hpp"
+#include "las/parallel.hpp"
+#include "las/sparse_grid_file.hpp"
 #include "lewiner/MarchingCubes.h"
+#include "lewiner/ply.h"
 #include "mesh/cube_marcher.hpp"
 #include "cl/cl_runner.hpp"
 
+/// Limits and file extension of the grid types that can be built
+template<typename Grid>
+struct GridTraits;
+
+template<>
+struct GridTraits<grid::GridFile> {
+  static uint32_t maxSize() { return 0xFFFF; }
+  static const char * extension() { return "grid"; }
+  static bool openCl() { return true; }
+};
+
+template<>
+struct GridTraits<grid::SparseGridFile> {
+  static uint32_t maxSize() { return grid::SparseGridFile::MAX_SIZE; }
+  static const char * extension() { return "sgrid"; }
+  static bool openCl() { return false; }
+};
+
+template<int N>
+void convertInto(grid::GridFile & grid,
+                 las::LASFile<N> & las,
+                 uint32_t sizeX,
+                 uint32_t sizeY,
+                 uint32_t sizeZ,
+                 clest::ClRunner * runner) {
+  // Voxelize straight into the layout of the marching
+  grid.setLayout(grid::GridFile::Layout::Bricked);
+  if (runner) {
+    grid.convert(las, sizeX, sizeY, sizeZ, *runner);
+  } else {
+    grid.convert(las, sizeX, sizeY, sizeZ);
+  }
+}
+
+template<int N>
+void convertInto(grid::SparseGridFile & grid,
+                 las::LASFile<N> & las,
+                 uint32_t sizeX,
+                 uint32_t sizeY,
+                 uint32_t sizeZ,
+                 clest::ClRunner *) {
+  grid.convert(las, sizeX, sizeY, sizeZ);
+}
+
 /// Create a grid based on a LASFile
-/// It loads the proper `LASFile<N>` at compile time to speed up the loading,
-/// since memory is not an issue given that the LASFile will be discarded
-/// as soon as the grid is created
-grid::GridFile convertGrid(const std::string & path,
-                          int type,
-                          unsigned short sizeX,
-                          unsigned short sizeY,
-                          unsigned short sizeZ) noexcept {
+/// It picks the proper `LASFile<N>` at compile time to speed up the reading.
+/// The points are streamed into the grid, so the file is never loaded
+///
+/// If `runner` is given, the voxelization of a dense grid runs on its
+/// OpenCL device
+template<typename Grid>
+Grid convertGrid(const std::string & path,
+                 int type,
+                 uint32_t sizeX,
+                 uint32_t sizeY,
+                 uint32_t sizeZ,
+                 clest::ClRunner * runner) noexcept {
 #define __DECLARE_TEMPLATES(index)\
     case index:\
     {\
       las::LASFile<index> las(path);\
-      return grid::GridFile(las, sizeX, sizeY, sizeZ);\
+      Grid grid;\
+      convertInto(grid, las, sizeX, sizeY, sizeZ, runner);\
+      return grid;\
     }
 
   try {
@@ -42,9 +102,10 @@ grid::GridFile convertGrid(const std::string & path,
 #undef __DECLARE_TEMPLATES
 }
 
-grid::GridFile loadGrid(const std::string & path) noexcept {
+template<typename Grid>
+Grid loadGrid(const std::string & path) noexcept {
   try {
-    return grid::GridFile(path);
+    return Grid(path);
   } catch (...) {
     clest::println(stderr,
                    "The application could not proceed and is quitting");
@@ -76,7 +137,7 @@ int extractType(char * typeParam, char * convertPath) {
   return type;
 }
 
-unsigned short extractSize(char * sizeParam, char axis) {
+uint32_t extractSize(char * sizeParam, char axis, uint32_t maxSize) {
   unsigned size = 256;
   if (sizeParam) {
     try {
@@ -96,12 +157,22 @@ unsigned short extractSize(char * sizeParam, char axis) {
                      sizeParam);
       size = 256;
     }
+    if (size == 0 || size > maxSize) {
+      clest::println(stderr,
+                     "Size of {} has to be from 1 to {}: {}\n"
+                     "Reverting to 256",
+                     axis,
+                     maxSize,
+                     sizeParam);
+      size = 256;
+    }
   }
   clest::println("Using {} size of: {}", axis, size);
   return size;
 }
 
-grid::GridFile getGrid(int argc, char * argv[]) {
+template<typename Grid>
+Grid getGrid(int argc, char * argv[]) {
   // Load from an existing grid
   if (clest::findOption(argv, argv + argc, "-l")) {
     clest::println("Load flag found. Ignoring all conversion flags");
@@ -112,7 +183,7 @@ grid::GridFile getGrid(int argc, char * argv[]) {
                      "{}\n",
                      loadPath);
 
-      return loadGrid(loadPath);
+      return loadGrid<Grid>(loadPath);
 
     // Load switch was used, but no file was given
     } else {
@@ -133,13 +204,39 @@ grid::GridFile getGrid(int argc, char * argv[]) {
       auto zParam = clest::extractOption(argv, argv + argc, "-z");
 
       int type = extractType(typeParam, convertPath);
-      unsigned short sizeX = extractSize(xParam, 'X');
-      unsigned short sizeY = extractSize(yParam, 'Y');
-      unsigned short sizeZ = extractSize(zParam, 'Z');
+      const uint32_t maxSize = GridTraits<Grid>::maxSize();
+      uint32_t sizeX = extractSize(xParam, 'X', maxSize);
+      uint32_t sizeY = extractSize(yParam, 'Y', maxSize);
+      uint32_t sizeZ = extractSize(zParam, 'Z', maxSize);
+
+      // OpenCL voxelization on any device, CPU runtimes included
+      std::unique_ptr<clest::ClRunner> runner;
+      if (clest::findOption(argv, argv + argc, "-o")
+          && !GridTraits<Grid>::openCl()) {
+        clest::println(stderr,
+                       "OpenCL voxelization only builds dense grids. "
+                       "Voxelizing on the host");
+      } else if (clest::findOption(argv, argv + argc, "-o")) {
+        clest::println("OpenCL flag found. Voxelizing on the device");
+        try {
+          clest::ClRunner::printFull();
+          runner = std::make_unique<clest::ClRunner>(CL_DEVICE_TYPE_ALL,
+                                                     std::vector<const char *>());
+        } catch (...) {
+          clest::println(stderr,
+                         "The application could not proceed and is quitting");
+          std::quick_exit(-1);
+        }
+      }
 
       clest::println("Creating grid..");
 
-      auto grid = convertGrid(convertPath, type, sizeX, sizeY, sizeZ);
+      auto grid = convertGrid<Grid>(convertPath,
+                              type,
+                              sizeX,
+                              sizeY,
+                              sizeZ,
+                              runner.get());
 
       // Save grid
       if (clest::findOption(argv, argv + argc, "-s")) {
@@ -155,8 +252,12 @@ grid::GridFile getGrid(int argc, char * argv[]) {
             savePath = clest::extractOption(argv, argv + argc, "-c");
           }
 
-          clest::println("Saving as the automatic name:\n{}.grid", savePath);
-          grid.save(fmt::format("{}.grid", savePath));
+          clest::println("Saving as the automatic name:\n{}.{}",
+                         savePath,
+                         GridTraits<Grid>::extension());
+          grid.save(fmt::format("{}.{}",
+                                savePath,
+                                GridTraits<Grid>::extension()));
         }
       }
 
@@ -175,48 +276,365 @@ grid::GridFile getGrid(int argc, char * argv[]) {
   }
 }
 
-void performMarchingCubes(grid::GridFile & grid,
-                          const char * const path,
-                          float threshold) {
-  MarchingCubes marchingCubes;
-  marchingCubes.set_resolution(grid.sizeX(), grid.sizeY(), grid.sizeZ());
-  marchingCubes.init_all();
-  clest::println("MC: [{} {} {}]",
-                 marchingCubes.size_x(),
-                 marchingCubes.size_y(),
-                 marchingCubes.size_z());
-
-  for (int i = 0; i < grid.sizeX(); ++i) {
-    for (int j = 0; j < grid.sizeY(); ++j) {
-      for (int k = 0; k < grid.sizeZ(); ++k) {
-        marchingCubes.set_data(grid.data(i, j, k), i, j, k);
+/// `MarchingCubes` restricted to the cubes of a tile. The data holds the
+/// tile with a halo of neighbouring voxels, so that the gradients of the
+/// vertices on the tile faces are the ones of the whole grid
+class TileMarchingCubes : public MarchingCubes {
+public:
+  /// Marches the cubes between the samples `first` and `last` inclusive
+  void runTile(real iso, const int (&first)[3], const int (&last)[3]) {
+    // The vertices on the edges between two samples of the tile
+    for (_k = first[2]; _k <= last[2]; ++_k) {
+      for (_j = first[1]; _j <= last[1]; ++_j) {
+        for (_i = first[0]; _i <= last[0]; ++_i) {
+          _cube[0] = get_data(_i, _j, _k) - iso;
+          _cube[1] = _i < last[0] ? get_data(_i + 1, _j, _k) - iso : _cube[0];
+          _cube[3] = _j < last[1] ? get_data(_i, _j + 1, _k) - iso : _cube[0];
+          _cube[4] = _k < last[2] ? get_data(_i, _j, _k + 1) - iso : _cube[0];
+          for (int p : { 0, 1, 3, 4 }) {
+            if (std::fabs(_cube[p]) < FLT_EPSILON) {
+              _cube[p] = FLT_EPSILON;
+            }
+          }
+
+          const bool inside = _cube[0] < 0;
+          if ((_cube[1] > 0) == inside) {
+            set_x_vert(add_x_vertex(), _i, _j, _k);
+          }
+          if ((_cube[3] > 0) == inside) {
+            set_y_vert(add_y_vertex(), _i, _j, _k);
+          }
+          if ((_cube[4] > 0) == inside) {
+            set_z_vert(add_z_vertex(), _i, _j, _k);
+          }
+        }
+      }
+    }
+
+    for (_k = first[2]; _k < last[2]; ++_k) {
+      for (_j = first[1]; _j < last[1]; ++_j) {
+        for (_i = first[0]; _i < last[0]; ++_i) {
+          _lut_entry = 0;
+          for (int p = 0; p < 8; ++p) {
+            _cube[p] = get_data(_i + ((p ^ (p >> 1)) & 1),
+                                _j + ((p >> 1) & 1),
+                                _k + ((p >> 2) & 1)) - iso;
+            if (std::fabs(_cube[p]) < FLT_EPSILON) {
+              _cube[p] = FLT_EPSILON;
+            }
+            if (_cube[p] > 0) {
+              _lut_entry += 1 << p;
+            }
+          }
+          process_cube();
+        }
       }
     }
   }
-  marchingCubes.run(grid.maxValue() * threshold);
+};
+
+/// Cubes along every axis of the tiles that are marched at a time
+constexpr uint32_t MARCHING_TILE = 64;
+
+/// Marches a grid in tiles of `MARCHING_TILE`^3 cubes given by their
+/// keys. The samples of a tile are gathered from the bricks of `grid`, so
+/// that the whole grid is never copied. Each tile runs its own
+/// `MarchingCubes` in parallel, and the vertices that the tiles share on
+/// their borders are welded by position
+///
+/// The mesh is written as an ASCII PLY, or as a binary one if `binary`
+template<typename Grid>
+void marchTiles(const Grid & grid,
+                const std::vector<uint64_t> & tiles,
+                const char * const path,
+                float threshold,
+                bool binary) {
+  constexpr uint32_t TILE = MARCHING_TILE;
+  const uint32_t size[3] = { grid.sizeX(), grid.sizeY(), grid.sizeZ() };
+
+  clest::println("MC: [{} {} {}] in {} tiles",
+                 size[0],
+                 size[1],
+                 size[2],
+                 tiles.size());
+
+  std::vector<std::vector<Vertex>> tileVertices(tiles.size());
+  std::vector<std::vector<Triangle>> tileTriangles(tiles.size());
+  const float iso = grid.maxValue() * threshold;
+
+  las::parallelFor(tiles.size(), [&](uint64_t index) {
+    const uint32_t origin[3] = {
+      static_cast<uint32_t>(tiles[index] >> 42) * TILE,
+      static_cast<uint32_t>((tiles[index] >> 21) & ((1 << 21) - 1)) * TILE,
+      static_cast<uint32_t>(tiles[index] & ((1 << 21) - 1)) * TILE
+    };
+
+    // The samples of the cubes of the tile, including the far border
+    uint32_t samples[3];
+    for (int axis = 0; axis < 3; ++axis) {
+      samples[axis] = std::min(TILE, size[axis] - 1 - origin[axis]) + 1;
+      if (samples[axis] < 2) {
+        return;
+      }
+    }
 
-  marchingCubes.clean_temps();
-  marchingCubes.writePLY(path);
+    // The samples of the tile with a halo of one voxel inside the grid, so
+    // that the gradients on the tile faces are the ones of the whole grid
+    uint32_t first[3];
+    uint32_t padded[3];
+    for (int axis = 0; axis < 3; ++axis) {
+      first[axis] = origin[axis] - std::min(origin[axis], 1u);
+      padded[axis] = std::min(origin[axis] + samples[axis] + 1, size[axis])
+        - first[axis];
+    }
 
-  marchingCubes.clean_all();
-}
+    std::vector<real> halo(padded[0] * padded[1] * padded[2], 0);
+    for (uint32_t bx = first[0] / Grid::BRICK_SIZE;
+         bx <= (first[0] + padded[0] - 1) / Grid::BRICK_SIZE;
+         ++bx) {
+      for (uint32_t by = first[1] / Grid::BRICK_SIZE;
+           by <= (first[1] + padded[1] - 1) / Grid::BRICK_SIZE;
+           ++by) {
+        for (uint32_t bz = first[2] / Grid::BRICK_SIZE;
+             bz <= (first[2] + padded[2] - 1) / Grid::BRICK_SIZE;
+             ++bz) {
+          const uint16_t * brick = grid.brick(bx, by, bz);
+          if (!brick) {
+            continue;
+          }
 
-int main(int argc, char * argv[]) {
+          const uint32_t brickFirst[3] = {
+            std::max(bx * Grid::BRICK_SIZE, first[0]),
+            std::max(by * Grid::BRICK_SIZE, first[1]),
+            std::max(bz * Grid::BRICK_SIZE, first[2])
+          };
+          const uint32_t brickLast[3] = {
+            std::min((bx + 1) * Grid::BRICK_SIZE, first[0] + padded[0]),
+            std::min((by + 1) * Grid::BRICK_SIZE, first[1] + padded[1]),
+            std::min((bz + 1) * Grid::BRICK_SIZE, first[2] + padded[2])
+          };
+          for (uint32_t i = brickFirst[0]; i < brickLast[0]; ++i) {
+            for (uint32_t j = brickFirst[1]; j < brickLast[1]; ++j) {
+              for (uint32_t k = brickFirst[2]; k < brickLast[2]; ++k) {
+                halo[(i - first[0]) + padded[0] * ((j - first[1])
+                                                   + padded[1] * (k - first[2]))] =
+                  brick[Grid::voxelInBrick(i, j, k)];
+              }
+            }
+          }
+        }
+      }
+    }
 
-  clest::println("== Parameters ===============");
-  for (int i = 1; i < argc; ++i) {
-    clest::println(argv[i]);
+    // No surface crosses a tile of zeros
+    if (std::all_of(halo.begin(), halo.end(), [](real value) {
+      return value == 0;
+    })) {
+      return;
+    }
+
+    const int firstSample[3] = {
+      static_cast<int>(origin[0] - first[0]),
+      static_cast<int>(origin[1] - first[1]),
+      static_cast<int>(origin[2] - first[2])
+    };
+    const int lastSample[3] = {
+      firstSample[0] + static_cast<int>(samples[0]) - 1,
+      firstSample[1] + static_cast<int>(samples[1]) - 1,
+      firstSample[2] + static_cast<int>(samples[2]) - 1
+    };
+
+    TileMarchingCubes marchingCubes;
+    marchingCubes.set_resolution(padded[0], padded[1], padded[2]);
+    marchingCubes.set_ext_data(halo.data());
+    marchingCubes.init_all();
+    marchingCubes.runTile(iso, firstSample, lastSample);
+
+    auto & vertices = tileVertices[index];
+    vertices.assign(marchingCubes.vertices(),
+                    marchingCubes.vertices() + marchingCubes.nverts());
+    for (Vertex & vertex : vertices) {
+      vertex.x += first[0];
+      vertex.y += first[1];
+      vertex.z += first[2];
+    }
+    tileTriangles[index].assign(
+      marchingCubes.triangles(),
+      marchingCubes.triangles() + marchingCubes.ntrigs());
+
+    marchingCubes.clean_all();
+  });
+
+  // Concatenate the tiles
+  std::vector<Vertex> vertices;
+  std::vector<Triangle> triangles;
+  for (uint64_t index = 0; index < tiles.size(); ++index) {
+    const int start = static_cast<int>(vertices.size());
+    vertices.insert(vertices.end(),
+                    tileVertices[index].begin(),
+                    tileVertices[index].end());
+    for (Triangle triangle : tileTriangles[index]) {
+      triangle.v1 += start;
+      triangle.v2 += start;
+      triangle.v3 += start;
+      triangles.push_back(triangle);
+    }
+    tileVertices[index] = std::vector<Vertex>();
+    tileTriangles[index] = std::vector<Triangle>();
   }
-  clest::println("=============================");
-  
-  clest::ClRunner::printFull();
-  clest::ClRunner ocl(CL_DEVICE_TYPE_GPU, { "fp64" });
-  ocl.loadProgram("marching", "opencl/marching.cl");
-  ocl.makeKernel<cl::Buffer>("marching", "createGrid");
 
-  auto grid = getGrid(argc, argv);
+  // Neighbouring tiles compute the same positions on their shared borders,
+  // so the duplicates are found by sorting the border vertices
+  auto onBorder = [&](real value) {
+    return std::fmod(value, static_cast<real>(TILE)) == 0;
+  };
+  std::vector<std::pair<std::array<real, 3>, int>> border;
+  for (int i = 0; i < static_cast<int>(vertices.size()); ++i) {
+    const Vertex & vertex = vertices[i];
+    if (onBorder(vertex.x) || onBorder(vertex.y) || onBorder(vertex.z)) {
+      border.push_back({ { { vertex.x, vertex.y, vertex.z } }, i });
+    }
+  }
+  std::sort(border.begin(), border.end());
 
-  // March grid
+  std::vector<int> remap(vertices.size());
+  for (int i = 0; i < static_cast<int>(vertices.size()); ++i) {
+    remap[i] = i;
+  }
+  for (size_t i = 1; i < border.size(); ++i) {
+    if (border[i].first == border[i - 1].first) {
+      remap[border[i].second] = remap[border[i - 1].second];
+    }
+  }
+
+  int kept = 0;
+  for (int i = 0; i < static_cast<int>(vertices.size()); ++i) {
+    if (remap[i] == i) {
+      vertices[kept] = vertices[i];
+      remap[i] = kept++;
+    } else {
+      remap[i] = remap[remap[i]];
+    }
+  }
+  vertices.resize(kept);
+
+  FILE * file = std::fopen(path, binary ? "wb" : "w");
+  if (!file) {
+    clest::println(stderr, "Could not open file {}", path);
+    return;
+  }
+
+  // The same elements as `MarchingCubes::writePLY`
+  struct PlyFace {
+    unsigned char count;
+    int * indices;
+  };
+  char x[] = "x", y[] = "y", z[] = "z", nx[] = "nx", ny[] = "ny", nz[] = "nz";
+  char vertexIndices[] = "vertex_indices";
+  char vertexName[] = "vertex", faceName[] = "face";
+  PlyProperty vertexProperties[] = {
+    { x, Float32, Float32, offsetof(Vertex, x), 0, 0, 0, 0 },
+    { y, Float32, Float32, offsetof(Vertex, y), 0, 0, 0, 0 },
+    { z, Float32, Float32, offsetof(Vertex, z), 0, 0, 0, 0 },
+    { nx, Float32, Float32, offsetof(Vertex, nx), 0, 0, 0, 0 },
+    { ny, Float32, Float32, offsetof(Vertex, ny), 0, 0, 0, 0 },
+    { nz, Float32, Float32, offsetof(Vertex, nz), 0, 0, 0, 0 }
+  };
+  PlyProperty faceProperty = {
+    vertexIndices, Int32, Int32, offsetof(PlyFace, indices),
+    1, Uint8, Uint8, offsetof(PlyFace, count)
+  };
+  char * elements[] = { vertexName, faceName };
+
+  PlyFile * ply = write_ply(file, 2, elements,
+                            binary ? PLY_BINARY_LE : PLY_ASCII);
+  describe_element_ply(ply, vertexName, static_cast<int>(vertices.size()));
+  for (PlyProperty & property : vertexProperties) {
+    describe_property_ply(ply, &property);
+  }
+  describe_element_ply(ply, faceName, static_cast<int>(triangles.size()));
+  describe_property_ply(ply, &faceProperty);
+  header_complete_ply(ply);
+
+  put_element_setup_ply(ply, vertexName);
+  for (Vertex & vertex : vertices) {
+    put_element_ply(ply, &vertex);
+  }
+
+  put_element_setup_ply(ply, faceName);
+  for (const Triangle & triangle : triangles) {
+    int indices[3] = {
+      remap[triangle.v1], remap[triangle.v2], remap[triangle.v3]
+    };
+    PlyFace face = { 3, indices };
+    put_element_ply(ply, &face);
+  }
+
+  // Closes `file` as well
+  close_ply(ply);
+  free_ply(ply);
+
+  clest::println("{} vertices and {} triangles written",
+                 vertices.size(),
+                 triangles.size());
+}
+
+/// Marches a dense grid in tiles, switching it to the bricked layout first
+void performMarchingCubes(grid::GridFile & grid,
+                          const char * const path,
+                          float threshold,
+                          bool binary) {
+  grid.setLayout(grid::GridFile::Layout::Bricked);
+
+  std::vector<uint64_t> tiles;
+  for (uint32_t x = 0; x < grid.sizeX(); x += MARCHING_TILE) {
+    for (uint32_t y = 0; y < grid.sizeY(); y += MARCHING_TILE) {
+      for (uint32_t z = 0; z < grid.sizeZ(); z += MARCHING_TILE) {
+        tiles.push_back(grid::SparseGridFile::brickKey(x / MARCHING_TILE,
+                                                       y / MARCHING_TILE,
+                                                       z / MARCHING_TILE));
+      }
+    }
+  }
+
+  marchTiles(grid, tiles, path, threshold, binary);
+}
+
+/// Marches a sparse grid, only in the tiles next to allocated bricks
+void performMarchingCubes(const grid::SparseGridFile & grid,
+                          const char * const path,
+                          float threshold,
+                          bool binary) {
+  // A voxel is a corner of the cubes before it as well, which can lie in
+  // the previous tile along every axis
+  std::vector<uint64_t> tiles;
+  grid.forEachBrick([&](uint32_t brickX,
+                        uint32_t brickY,
+                        uint32_t brickZ,
+                        const grid::SparseGridFile::Brick &) {
+    const uint32_t first[3] = {
+      brickX * grid::SparseGridFile::BRICK_SIZE,
+      brickY * grid::SparseGridFile::BRICK_SIZE,
+      brickZ * grid::SparseGridFile::BRICK_SIZE
+    };
+    for (int corner = 0; corner < 8; ++corner) {
+      uint32_t tile[3];
+      for (int axis = 0; axis < 3; ++axis) {
+        const uint32_t shift = (corner >> axis) & 1;
+        tile[axis] = (first[axis] - std::min(first[axis], shift)) / MARCHING_TILE;
+      }
+      tiles.push_back(grid::SparseGridFile::brickKey(tile[0], tile[1], tile[2]));
+    }
+  });
+  std::sort(tiles.begin(), tiles.end());
+  tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+
+  marchTiles(grid, tiles, path, threshold, binary);
+}
+
+/// Marches the grid if it was requested
+template<typename Grid>
+void marchGrid(Grid & grid, int argc, char * argv[]) {
   if (clest::findOption(argv, argv + argc, "-m")) {
     clest::println("Marching the grid..");
 
@@ -241,10 +659,16 @@ int main(int argc, char * argv[]) {
       }
     }
 
+    // Large meshes are smaller and faster to write as binary PLY
+    const bool binary = clest::findOption(argv, argv + argc, "-p");
+    if (binary) {
+      clest::println("Binary flag found. Writing a binary PLY");
+    }
+
     auto savePath = clest::extractOption(argv, argv + argc, "-m");
     if (savePath && savePath[0] != '-') {
       clest::println("Saving the mesh as the given name:\n{}", savePath);
-      performMarchingCubes(grid, savePath, divider);
+      performMarchingCubes(grid, savePath, divider, binary);
     } else {
       savePath = clest::extractOption(argv, argv + argc, "-l");
       if (!savePath) {
@@ -255,9 +679,29 @@ int main(int argc, char * argv[]) {
                      savePath);
       performMarchingCubes(grid,
                            fmt::format("{}.ply", savePath).c_str(),
-                           divider);
+                           divider,
+                           binary);
     }
   }
+}
+
+int main(int argc, char * argv[]) {
+
+  clest::println("== Parameters ===============");
+  for (int i = 1; i < argc; ++i) {
+    clest::println(argv[i]);
+  }
+  clest::println("=============================");
+
+  // The sparse grid only allocates the bricks that hold points
+  if (clest::findOption(argv, argv + argc, "-b")) {
+    clest::println("Sparse flag found. Using a brick grid");
+    auto sparseGrid = getGrid<grid::SparseGridFile>(argc, argv);
+    marchGrid(sparseGrid, argc, argv);
+  } else {
+    auto denseGrid = getGrid<grid::GridFile>(argc, argv);
+    marchGrid(denseGrid, argc, argv);
+  }
 
   clest::println("Done!");
   std::cin.get();
@@ -0,0 +1,66 @@
+#include <cstring>
+#include <fstream>
+
+#include <clest/util.hpp>
+#include <clest/ostream.hpp>
+
+#include "feature_file.hpp"
+
+namespace las {
+
+  /// Saves the header followed by every column in full
+  /// If the file already exists, it will append a ".new" before the extension
+  void FeatureFile::save(std::string path) const {
+    clest::guaranteeNewFile(path, "features");
+
+    std::ofstream fileStream(path, std::ofstream::binary);
+
+    if (!fileStream.is_open()) {
+      throw clest::Exception::build("Could not open file {}", path);
+    }
+
+    FeatureHeader header;
+    header.pointCount = pointCount();
+    fileStream.write(reinterpret_cast<const char*>(&header),
+                     sizeof(FeatureHeader));
+
+    for (auto column : { &normalX, &normalY, &normalZ, &curvature }) {
+      fileStream.write(reinterpret_cast<const char*>(column->data()),
+                       column->size() * sizeof(float));
+    }
+
+    fileStream.close();
+  }
+
+  /// Load the features from file
+  /// Integrity will be checked with regards to the values of the header
+  void FeatureFile::load(const std::string & path) {
+    std::ifstream fileStream(path, std::ifstream::binary);
+
+    if (!fileStream.is_open()) {
+      throw clest::Exception::build("Could not open file {}\n", path);
+    }
+
+    FeatureHeader expected;
+    FeatureHeader header;
+    fileStream.read(reinterpret_cast<char*>(&header), sizeof(FeatureHeader));
+
+    if (!fileStream.good()
+        || std::memcmp(header.signature, expected.signature, 4) != 0
+        || header.columnCount != expected.columnCount) {
+      throw clest::Exception::build("The file {} seems to be corrupted", path);
+    }
+
+    resize(header.pointCount);
+    for (auto column : { &normalX, &normalY, &normalZ, &curvature }) {
+      fileStream.read(reinterpret_cast<char*>(column->data()),
+                      column->size() * sizeof(float));
+    }
+
+    if (!fileStream.good()) {
+      throw clest::Exception::build("The file {} seems to be truncated", path);
+    }
+
+    fileStream.close();
+  }
+}
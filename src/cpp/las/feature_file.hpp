@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace las {
+
+  /// Sidecar file of per point features, aligned with the point order
+  /// of the LAS file it was computed from
+  ///
+  /// Each feature is stored as its own column of `float`, so a consumer
+  /// that only needs the normals does not touch the curvature
+  class FeatureFile {
+  public:
+    FeatureFile() = default;
+    FeatureFile(const std::string & path) {
+      load(path);
+    }
+    explicit FeatureFile(uint64_t pointCount) {
+      resize(pointCount);
+    }
+
+    void save(std::string path) const;
+    void load(const std::string & path);
+
+    void resize(uint64_t pointCount) {
+      normalX.resize(pointCount);
+      normalY.resize(pointCount);
+      normalZ.resize(pointCount);
+      curvature.resize(pointCount);
+    }
+
+    uint64_t pointCount() const { return normalX.size(); }
+
+    /// Unit normals
+    std::vector<float> normalX;
+    std::vector<float> normalY;
+    std::vector<float> normalZ;
+
+    /// Surface variation: the smallest covariance eigenvalue over the
+    /// sum of the eigenvalues. Zero on a plane, 1/3 when isotropic
+    std::vector<float> curvature;
+
+  private:
+#pragma pack(push, 1)
+    struct FeatureHeader {
+      char signature[4] = { 'C', 'L', 'F', 'T' };
+      uint64_t pointCount = 0;
+      uint16_t columnCount = 4;
+    };
+#pragma pack(pop)
+  };
+}
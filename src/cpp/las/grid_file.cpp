@@ -1,9 +1,27 @@
+#include <algorithm>
 #include <fstream>
 
 #include <clest/util.hpp>
 #include <clest/ostream.hpp>
 
 #include "grid_file.hpp"
+#include "parallel.hpp"
+
+namespace {
+
+  /// Partial grids of the small grid conversion, used while all of them
+  /// fit within `PARTIAL_BUDGET` bytes
+  constexpr uint64_t PARTIAL_GRIDS = 16;
+  constexpr uint64_t PARTIAL_BUDGET = 1 << 28;
+
+  /// Contiguous ranges of voxels the points are binned into by the large
+  /// grid conversion, each accumulated by a single task
+  constexpr uint64_t BUCKETS = 256;
+
+  /// Points read and binned at a time, split into `SLICE_CHUNKS` chunks
+  constexpr uint64_t SLICE_SIZE = 1 << 20;
+  constexpr uint64_t SLICE_CHUNKS = 64;
+}
 
 namespace grid {
 
@@ -24,9 +42,16 @@ namespace grid {
       sizeof(GridHeader));
 
     // No buffering being done. The vector is written directly
-    fileStream.write(
-      reinterpret_cast<const char*>(&mData[0]),
-      mData.size() * sizeof(uint16_t));
+    if (mLayout == Layout::Linear) {
+      fileStream.write(
+        reinterpret_cast<const char*>(&mData[0]),
+        mData.size() * sizeof(uint16_t));
+    } else {
+      std::vector<uint16_t> linear = copyAs(Layout::Linear);
+      fileStream.write(
+        reinterpret_cast<const char*>(&linear[0]),
+        linear.size() * sizeof(uint16_t));
+    }
 
     fileStream.close();
 
@@ -54,17 +79,31 @@ namespace grid {
     }
 
     // Prepare the memory to receive the grid from the file
-    mData.resize(mHeader.sizeX * mHeader.sizeY * mHeader.sizeZ);
+    const Layout layout = mLayout;
+    mLayout = Layout::Linear;
+    allocate();
 
     // Load directly
     fileStream.read(reinterpret_cast<char*>(&mData[0]),
                     mData.size() * sizeof(uint16_t));
 
     fileStream.close();
+
+    setLayout(layout);
   }
 
   /// Converts the give LAS file into a grid
   /// The size of the grid will be `sizeX` * `sizeY` * `sizeZ`
+  ///
+  /// Unless the points are already loaded, they are streamed from the
+  /// file `SLICE_SIZE` at a time, so files larger than memory can be
+  /// converted
+  ///
+  /// Small grids, with many points per voxel, are accumulated into
+  /// `PARTIAL_GRIDS` partial grids, one per partition of the points, that
+  /// are then summed. Larger grids have the voxels of the points binned
+  /// into `BUCKETS` contiguous ranges first, so that each range is
+  /// accumulated by a single task. The voxel values saturate at 0xFFFF
   template<int N>
   void GridFile::convert(las::LASFile<N> & lasFile,
                          uint16_t sizeX,
@@ -72,19 +111,116 @@ namespace grid {
                          uint16_t sizeZ
   ) {
 
-    // Ensure all the data is laoded
-    if (!lasFile.isValidAndFullyLoaded()) {
-      if (!lasFile.isValid()) {
-        lasFile.loadHeaders();
-      }
-      lasFile.loadData();
+    // Only the headers are needed, the points are streamed
+    if (!lasFile.isValid()) {
+      lasFile.loadHeaders();
 
-      if (!lasFile.isValidAndFullyLoaded()) {
+      if (!lasFile.isValid()) {
         throw clest::Exception::build("Could not load LAS file:\n{}",
                                       lasFile.filePath);
       }
     }
 
+    prepare(lasFile.publicHeader, sizeX, sizeY, sizeZ);
+
+    const uint64_t cells = mData.size();
+
+    // Summing the partial grids only pays off with more points than cells
+    if (cells * sizeof(uint32_t) * PARTIAL_GRIDS <= PARTIAL_BUDGET
+        && cells * PARTIAL_GRIDS <= lasFile.pointDataCount()) {
+      // Small grid: each partition of the points has its own grid, and
+      // the grids are summed cell by cell
+      std::vector<std::vector<uint32_t>> partials(PARTIAL_GRIDS);
+      las::forEachBlock(lasFile, [&](const las::PointData<N> * points,
+                                     uint64_t count,
+                                     uint64_t) {
+        las::parallelFor(PARTIAL_GRIDS, [&](uint64_t partition) {
+          std::vector<uint32_t> & partial = partials[partition];
+          partial.resize(cells);
+
+          const uint64_t end = count * (partition + 1) / PARTIAL_GRIDS;
+          for (uint64_t i = count * partition / PARTIAL_GRIDS; i < end; ++i) {
+            partial[voxelOf(points[i].x, points[i].y, points[i].z)]++;
+          }
+        });
+      }, SLICE_SIZE);
+
+      las::parallelFor(cells, [&](uint64_t cell) {
+        uint64_t sum = 0;
+        for (const auto & partial : partials) {
+          sum += partial.empty() ? 0 : partial[cell];
+        }
+        mData[cell] = static_cast<uint16_t>(std::min<uint64_t>(sum, 0xFFFF));
+      });
+    } else {
+      // Large grid: the voxels of each slice are binned into contiguous
+      // ranges of the grid, which are then accumulated without contention
+      const uint64_t bucketCells = (cells + BUCKETS - 1) / BUCKETS;
+      constexpr uint64_t CHUNK_SIZE = SLICE_SIZE / SLICE_CHUNKS;
+      const uint64_t sliceSize =
+        std::min<uint64_t>(SLICE_SIZE, lasFile.pointDataCount());
+      std::vector<uint64_t> voxels(sliceSize);
+      std::vector<uint64_t> sorted(sliceSize);
+      std::vector<uint64_t> offsets(SLICE_CHUNKS * BUCKETS);
+      std::vector<uint64_t> bucketStarts(BUCKETS + 1);
+
+      las::forEachBlock(lasFile, [&](const las::PointData<N> * block,
+                                     uint64_t blockSize,
+                                     uint64_t) {
+        for (uint64_t slice = 0; slice < blockSize; slice += SLICE_SIZE) {
+          const las::PointData<N> * points = block + slice;
+          const uint64_t size = std::min(SLICE_SIZE, blockSize - slice);
+          const uint64_t chunks = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+          std::fill(offsets.begin(), offsets.begin() + chunks * BUCKETS, 0);
+          las::parallelFor(chunks, [&](uint64_t chunk) {
+            const uint64_t end = std::min(size, (chunk + 1) * CHUNK_SIZE);
+            for (uint64_t i = chunk * CHUNK_SIZE; i < end; ++i) {
+              voxels[i] = voxelOf(points[i].x, points[i].y, points[i].z);
+              offsets[chunk * BUCKETS + voxels[i] / bucketCells]++;
+            }
+          });
+
+          uint64_t total = 0;
+          for (uint64_t bucket = 0; bucket < BUCKETS; ++bucket) {
+            bucketStarts[bucket] = total;
+            for (uint64_t chunk = 0; chunk < chunks; ++chunk) {
+              uint64_t bucketCount = offsets[chunk * BUCKETS + bucket];
+              offsets[chunk * BUCKETS + bucket] = total;
+              total += bucketCount;
+            }
+          }
+          bucketStarts[BUCKETS] = total;
+
+          las::parallelFor(chunks, [&](uint64_t chunk) {
+            const uint64_t end = std::min(size, (chunk + 1) * CHUNK_SIZE);
+            for (uint64_t i = chunk * CHUNK_SIZE; i < end; ++i) {
+              sorted[offsets[chunk * BUCKETS + voxels[i] / bucketCells]++] =
+                voxels[i];
+            }
+          });
+
+          las::parallelFor(BUCKETS, [&](uint64_t bucket) {
+            for (uint64_t i = bucketStarts[bucket];
+                 i < bucketStarts[bucket + 1];
+                 ++i) {
+              uint16_t & value = mData[sorted[i]];
+              if (value < 0xFFFF) {
+                value++;
+              }
+            }
+          });
+        }
+      }, SLICE_SIZE);
+    }
+
+    reduceMaxValue();
+  }
+
+  void GridFile::prepare(const las::PublicHeader & header,
+                         uint16_t sizeX,
+                         uint16_t sizeY,
+                         uint16_t sizeZ) {
     // Check validity of the parameters
     if (sizeX == 0 || sizeY == 0 || sizeZ == 0) {
       throw clest::Exception::build(
@@ -99,58 +235,102 @@ namespace grid {
     mHeader.sizeY = sizeY;
     mHeader.sizeZ = sizeZ;
 
-    auto deltaAxis =
-      std::max(lasFile.publicHeader.maxX - lasFile.publicHeader.minX,
-               std::max(lasFile.publicHeader.maxY - lasFile.publicHeader.minY,
-                        lasFile.publicHeader.maxZ - lasFile.publicHeader.minZ));
-
-    // Prepare the step sizes for creating the voxels
-    double xStep = (lasFile.publicHeader.maxX - lasFile.publicHeader.minX)
-      / (sizeX * lasFile.publicHeader.xScaleFactor);
-    double xOffset = (lasFile.publicHeader.minX - lasFile.publicHeader.xOffset)
-      / (lasFile.publicHeader.xScaleFactor);
-
-    double yStep = (lasFile.publicHeader.maxY - lasFile.publicHeader.minY)
-      / (sizeY * lasFile.publicHeader.yScaleFactor);
-    double yOffset = (lasFile.publicHeader.minY - lasFile.publicHeader.yOffset)
-      / (lasFile.publicHeader.yScaleFactor);
-
-    double zStep = (lasFile.publicHeader.maxZ - lasFile.publicHeader.minZ)
-      / (sizeZ * lasFile.publicHeader.zScaleFactor);
-    double zOffset = (lasFile.publicHeader.minZ - lasFile.publicHeader.zOffset)
-      / (lasFile.publicHeader.zScaleFactor);
-
-    mHeader.xFactor = (lasFile.publicHeader.maxX - lasFile.publicHeader.minX)
-      * lasFile.publicHeader.xScaleFactor / deltaAxis;
-    mHeader.yFactor = (lasFile.publicHeader.maxY - lasFile.publicHeader.minY)
-      * lasFile.publicHeader.yScaleFactor / deltaAxis;
-    mHeader.zFactor = (lasFile.publicHeader.maxZ - lasFile.publicHeader.minZ)
-      * lasFile.publicHeader.zScaleFactor / deltaAxis;
+    auto deltaAxis = std::max(header.maxX - header.minX,
+                              std::max(header.maxY - header.minY,
+                                       header.maxZ - header.minZ));
+
+    mAxes = voxelAxes(header, sizeX, sizeY, sizeZ);
+
+    mHeader.xFactor =
+      (header.maxX - header.minX) * header.xScaleFactor / deltaAxis;
+    mHeader.yFactor =
+      (header.maxY - header.minY) * header.yScaleFactor / deltaAxis;
+    mHeader.zFactor =
+      (header.maxZ - header.minZ) * header.zScaleFactor / deltaAxis;
 
     // Clear the data vector and preallocate the proper size
-    mData = std::vector<uint16_t>(sizeX * sizeY * sizeZ);
-
-    // Iterate and increment the voxel values accordingly
-    uint16_t localX;
-    uint16_t localY;
-    uint16_t localZ;
-    uint32_t max = 0;
-    
-    for (auto point : lasFile.pointData) {
-      localX = static_cast<uint16_t>((point.x - xOffset) / xStep);
-      localY = static_cast<uint16_t>((point.y - yOffset) / yStep);
-      localZ = static_cast<uint16_t>((point.z - zOffset) / zStep);
-
-      if (localX == sizeX) localX--;
-      if (localY == sizeY) localY--;
-      if (localZ == sizeZ) localZ--;
-
-      if ((data(localX, localY, localZ)++) > max) {
-        max++;
-      }
+    allocate();
+    mHeader.maxValue = 0;
+  }
+
+  void GridFile::add(uint32_t x, uint32_t y, uint32_t z) {
+    uint16_t & value = mData[voxelOf(x, y, z)];
+    if (value < 0xFFFF) {
+      value++;
+    }
+    if (value > mHeader.maxValue) {
+      mHeader.maxValue = value;
+    }
+  }
+
+  uint16_t GridFile::voxelAlong(int axis, uint32_t value) const {
+    return static_cast<uint16_t>(mAxes[axis].voxelOf(value));
+  }
+
+  uint64_t GridFile::voxelOf(uint32_t x, uint32_t y, uint32_t z) const {
+    return index(voxelAlong(0, x), voxelAlong(1, y), voxelAlong(2, z));
+  }
+
+  void GridFile::setLayout(Layout layout) {
+    if (layout == mLayout) {
+      return;
+    }
+
+    std::vector<uint16_t> data = copyAs(layout);
+    mLayout = layout;
+    mData.swap(data);
+  }
+
+  void GridFile::allocate() {
+    mBricks[0] = (mHeader.sizeX + BRICK_SIZE - 1) >> BRICK_BITS;
+    mBricks[1] = (mHeader.sizeY + BRICK_SIZE - 1) >> BRICK_BITS;
+    mBricks[2] = (mHeader.sizeZ + BRICK_SIZE - 1) >> BRICK_BITS;
+
+    const uint64_t cells = mLayout == Layout::Linear ?
+      static_cast<uint64_t>(mHeader.sizeX) * mHeader.sizeY * mHeader.sizeZ :
+      static_cast<uint64_t>(mBricks[0]) * mBricks[1] * mBricks[2]
+        * BRICK_VOXELS;
+    mData = std::vector<uint16_t>(cells);
+  }
+
+  /// Every X slab is copied by its own task. Bricks are read and written
+  /// a Z row of `BRICK_SIZE` voxels at a time
+  std::vector<uint16_t> GridFile::copyAs(Layout layout) const {
+    if (mData.empty()) {
+      return std::vector<uint16_t>(0);
     }
 
-    mHeader.maxValue = max > 0xFFFF ? 0xFFFF : static_cast<uint16_t>(max);
+    const uint64_t cells = layout == Layout::Linear ?
+      static_cast<uint64_t>(mHeader.sizeX) * mHeader.sizeY * mHeader.sizeZ :
+      static_cast<uint64_t>(mBricks[0]) * mBricks[1] * mBricks[2]
+        * BRICK_VOXELS;
+    std::vector<uint16_t> data(cells);
+
+    las::parallelFor(mHeader.sizeX, [&](uint64_t x) {
+      for (uint32_t y = 0; y < mHeader.sizeY; ++y) {
+        for (uint32_t z = 0; z < mHeader.sizeZ; z += BRICK_SIZE) {
+          const uint32_t row = std::min<uint32_t>(BRICK_SIZE,
+                                                  mHeader.sizeZ - z);
+          std::copy(mData.begin() + indexIn(mLayout, x, y, z),
+                    mData.begin() + indexIn(mLayout, x, y, z) + row,
+                    data.begin() + indexIn(layout, x, y, z));
+        }
+      }
+    });
+
+    return data;
+  }
+
+  void GridFile::reduceMaxValue() {
+    mHeader.maxValue = las::parallelReduce(
+      mData.size(),
+      uint16_t(0),
+      [&](uint16_t & max, uint64_t cell) {
+        max = std::max(max, mData[cell]);
+      },
+      [](uint16_t & max, const uint16_t & other) {
+        max = std::max(max, other);
+      });
   }
 
 #define __DECLARE_TEMPLATES(index)\
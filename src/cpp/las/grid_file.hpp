@@ -1,9 +1,15 @@
 #pragma once
 
+#include <array>
 #include <string>
 #include <vector>
 
 #include "las_file.hpp"
+#include "voxel_axis.hpp"
+
+namespace clest {
+  class ClRunner;
+}
 
 namespace grid {
 
@@ -17,6 +23,24 @@ namespace grid {
 
   class GridFile {
   public:
+    static constexpr uint32_t BRICK_BITS = 3;
+    static constexpr uint32_t BRICK_SIZE = 1 << BRICK_BITS;
+    static constexpr uint32_t BRICK_VOXELS =
+      BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+
+    /// Order of the voxels in memory
+    ///
+    /// `Linear` runs Z first, then Y, then X, like the file. `Bricked`
+    /// stores bricks of `BRICK_SIZE`^3 voxels contiguously, in the same
+    /// order, with the voxels of a brick in that order as well. The
+    /// neighbours of a voxel then mostly share its cache lines, and a
+    /// brick is a single 1 KB read. Bricks on the far borders are padded
+    /// with zeros
+    enum class Layout : uint8_t {
+      Linear,
+      Bricked
+    };
+
     GridFile() = default;
     GridFile(const std::string & path) {
       load(path);
@@ -29,6 +53,8 @@ namespace grid {
       convert(lasFile, sizeX, sizeY, sizeZ);
     }
 
+    /// The file always holds the linear layout, which is converted
+    /// to and from the layout of the grid
     void save(std::string path) const;
     void load(const std::string & path);
 
@@ -38,13 +64,92 @@ namespace grid {
                  uint16_t sizeY,
                  uint16_t sizeZ);
 
+    /// Same as above, but voxelizes on the device of `runner` with the
+    /// "createGrid" kernel of "opencl/marching.cl", which is loaded as the
+    /// "marching" program if it is not loaded yet. The points are streamed
+    /// and uploaded in chunks, and the grid matches the one of the host
+    template<int N>
+    void convert(las::LASFile<N> & lasFile,
+                 uint16_t sizeX,
+                 uint16_t sizeY,
+                 uint16_t sizeZ,
+                 clest::ClRunner & runner);
+
+    /// Clears the grid and maps it over the bounds of `header`, so that
+    /// points can be added one at a time with `add`
+    void prepare(const las::PublicHeader & header,
+                 uint16_t sizeX,
+                 uint16_t sizeY,
+                 uint16_t sizeZ);
+
+    /// Increments the voxel of a point given in the quantized coordinates
+    /// of the header passed to `prepare`. Points outside of the header
+    /// bounds are clamped to the border voxels
+    void add(uint32_t x, uint32_t y, uint32_t z);
+
     const uint16_t sizeX() const { return mHeader.sizeX; }
     const uint16_t sizeY() const { return mHeader.sizeY; }
     const uint16_t sizeZ() const { return mHeader.sizeZ; }
     const uint16_t maxValue() const { return mHeader.maxValue; }
 
+    Layout layout() const { return mLayout; }
+
+    /// Changes the layout, moving the voxels if there are any. Set it
+    /// before `convert` to voxelize straight into the new layout
+    void setLayout(Layout layout);
+
+    /// Index into the data of the voxel at `x`, `y`, `z`
+    uint64_t index(uint32_t x, uint32_t y, uint32_t z) const {
+      return indexIn(mLayout, x, y, z);
+    }
+
+    /// Same as above, for the given layout
+    uint64_t indexIn(Layout layout, uint32_t x, uint32_t y, uint32_t z) const {
+      if (layout == Layout::Linear) {
+        return z + y * static_cast<uint64_t>(mHeader.sizeZ)
+          + x * static_cast<uint64_t>(mHeader.sizeY) * mHeader.sizeZ;
+      }
+
+      return (brickIndex(x >> BRICK_BITS, y >> BRICK_BITS, z >> BRICK_BITS)
+              << (3 * BRICK_BITS))
+        | voxelInBrick(x, y, z);
+    }
+
     uint16_t & data(unsigned int x, unsigned int y, unsigned int z) {
-      return mData[z + y * mHeader.sizeZ + x * mHeader.sizeY * mHeader.sizeZ];
+      return mData[index(x, y, z)];
+    }
+
+    /// Voxels of the brick at the given brick coordinates, indexed by
+    /// `voxelInBrick`, or null if it is outside of the grid. Only valid
+    /// with the bricked layout
+    const uint16_t * brick(uint32_t brickX,
+                           uint32_t brickY,
+                           uint32_t brickZ) const {
+      if (brickX >= mBricks[0] || brickY >= mBricks[1] || brickZ >= mBricks[2]) {
+        return nullptr;
+      }
+      return mData.data() + (brickIndex(brickX, brickY, brickZ)
+                             << (3 * BRICK_BITS));
+    }
+
+    /// Calls `func(brickX, brickY, brickZ, voxels)` for every brick, in
+    /// memory order. Only valid with the bricked layout
+    template <typename F>
+    void forEachBrick(const F & func) const {
+      for (uint32_t brickX = 0; brickX < mBricks[0]; ++brickX) {
+        for (uint32_t brickY = 0; brickY < mBricks[1]; ++brickY) {
+          for (uint32_t brickZ = 0; brickZ < mBricks[2]; ++brickZ) {
+            func(brickX, brickY, brickZ, brick(brickX, brickY, brickZ));
+          }
+        }
+      }
+    }
+
+    static uint32_t voxelInBrick(uint32_t x, uint32_t y, uint32_t z) {
+      constexpr uint32_t mask = BRICK_SIZE - 1;
+      return ((x & mask) << (2 * BRICK_BITS))
+        | ((y & mask) << BRICK_BITS)
+        | (z & mask);
     }
 
   private:
@@ -60,6 +165,35 @@ namespace grid {
     };
 #pragma pack(pop)
 
+    /// Voxel along `axis` of a quantized coordinate, clamped to the
+    /// border voxels
+    uint16_t voxelAlong(int axis, uint32_t value) const;
+
+    /// Index into `mData` of the voxel of a point given in quantized
+    /// coordinates, clamped to the border voxels
+    uint64_t voxelOf(uint32_t x, uint32_t y, uint32_t z) const;
+
+    /// Sets the max value of the header from the data
+    void reduceMaxValue();
+
+    uint64_t brickIndex(uint32_t brickX, uint32_t brickY, uint32_t brickZ) const {
+      return (brickX * static_cast<uint64_t>(mBricks[1]) + brickY) * mBricks[2]
+        + brickZ;
+    }
+
+    /// Sets the brick counts from the header and clears the data to the
+    /// size of the layout
+    void allocate();
+
+    /// Copy of the data in `layout`
+    std::vector<uint16_t> copyAs(Layout layout) const;
+
+    /// Maps quantized coordinates to voxels; set by `prepare`
+    std::array<VoxelAxis, 3> mAxes;
+
+    Layout mLayout = Layout::Linear;
+    uint32_t mBricks[3] = { 0, 0, 0 };
+
     std::vector<uint16_t> mData = std::vector<uint16_t>(0);
     std::vector<Color> mColors = std::vector<Color>(0);
     GridHeader mHeader;
@@ -0,0 +1,152 @@
+#include "grid_file.hpp"
+
+#include <algorithm>
+
+#include <clest/ostream.hpp>
+
+#include "parallel.hpp"
+#include "../cl/cl_runner.hpp"
+
+namespace {
+
+  /// Points uploaded to the device at a time
+  constexpr uint64_t UPLOAD_SIZE = 1 << 20;
+}
+
+namespace grid {
+
+  /// The mapping of every axis is monotonic, so the voxel of a coordinate
+  /// is the number of thresholds not above it, where threshold `k - 1` is
+  /// the lowest coordinate that the host maps to voxel `k` or higher. The
+  /// kernel then only compares integers, and a threshold no coordinate
+  /// reaches is 2^32
+  ///
+  /// While the kernel voxelizes a chunk, the host gathers the next one
+  template<int N>
+  void GridFile::convert(las::LASFile<N> & lasFile,
+                         uint16_t sizeX,
+                         uint16_t sizeY,
+                         uint16_t sizeZ,
+                         clest::ClRunner & runner) {
+    if (!lasFile.isValid()) {
+      lasFile.loadHeaders();
+
+      if (!lasFile.isValid()) {
+        throw clest::Exception::build("Could not load LAS file:\n{}",
+                                      lasFile.filePath);
+      }
+    }
+
+    prepare(lasFile.publicHeader, sizeX, sizeY, sizeZ);
+
+    std::vector<cl_ulong> thresholds;
+    for (const VoxelAxis & axis : mAxes) {
+      for (uint32_t voxel = 1; voxel < axis.size; ++voxel) {
+        thresholds.push_back(axis.threshold(voxel));
+      }
+    }
+
+    if (!runner.hasProgram("marching")) {
+      runner.loadProgram("marching", "opencl/marching.cl");
+    }
+
+    const uint64_t cells = mData.size();
+    std::vector<cl_uint> counts(cells, 0);
+
+    try {
+      auto createGrid = runner.makeKernel<cl::Buffer, cl::Buffer, cl::Buffer,
+                                          cl_uint, cl_uint, cl_uint, cl_uint,
+                                          cl_uint>(
+        "marching", "createGrid");
+
+      const cl::Context & context = runner.context();
+      cl::CommandQueue & queue = runner.queue();
+
+      cl::Buffer thresholdBuffer(context,
+                                 CL_MEM_READ_WRITE,
+                                 std::max<size_t>(1, thresholds.size())
+                                 * sizeof(cl_ulong));
+      if (!thresholds.empty()) {
+        cl::copy(queue, thresholds.begin(), thresholds.end(), thresholdBuffer);
+      }
+
+      cl::Buffer output(context, CL_MEM_READ_WRITE, cells * sizeof(cl_uint));
+      cl::copy(queue, counts.begin(), counts.end(), output);
+
+      // Packed `uint3` per point
+      const uint64_t uploadSize = std::max<uint64_t>(
+        1, std::min<uint64_t>(UPLOAD_SIZE, lasFile.pointDataCount()));
+      std::vector<cl_uint> staging(3 * uploadSize);
+      cl::Buffer points(context,
+                        CL_MEM_READ_WRITE,
+                        staging.size() * sizeof(cl_uint));
+      uint64_t staged = 0;
+
+      auto flush = [&]() {
+        if (staged == 0) {
+          return;
+        }
+
+        // Blocks until the previous chunk is voxelized
+        cl::copy(queue, staging.begin(), staging.begin() + 3 * staged, points);
+        createGrid(cl::EnqueueArgs(queue, cl::NDRange(staged)),
+                   points, thresholdBuffer, output,
+                   sizeX, sizeY, sizeZ,
+                   static_cast<cl_uint>(staged),
+                   static_cast<cl_uint>(mLayout == Layout::Bricked));
+        staged = 0;
+      };
+
+      las::forEachBlock(lasFile, [&](const las::PointData<N> * block,
+                                     uint64_t count,
+                                     uint64_t) {
+        uint64_t done = 0;
+        while (done < count) {
+          const uint64_t taken = std::min(count - done, uploadSize - staged);
+          cl_uint * target = staging.data() + 3 * staged;
+          const las::PointData<N> * source = block + done;
+          las::parallelFor(taken, [&](uint64_t i) {
+            target[3 * i] = source[i].x;
+            target[3 * i + 1] = source[i].y;
+            target[3 * i + 2] = source[i].z;
+          });
+
+          staged += taken;
+          done += taken;
+          if (staged == uploadSize) {
+            flush();
+          }
+        }
+      });
+      flush();
+
+      cl::copy(queue, output, counts.begin(), counts.end());
+    } catch (cl::Error & err) {
+      throw clest::Exception::build("OpenCL error: {} ({})",
+                                    err.what(),
+                                    err.err());
+    }
+
+    las::parallelFor(cells, [&](uint64_t cell) {
+      mData[cell] = static_cast<uint16_t>(
+        std::min<cl_uint>(counts[cell], 0xFFFF));
+    });
+    reduceMaxValue();
+  }
+
+#define __DECLARE_TEMPLATES(index)\
+  template void GridFile::convert(las::LASFile<index> & lasFile,\
+                                  uint16_t sizeX,\
+                                  uint16_t sizeY,\
+                                  uint16_t sizeZ,\
+                                  clest::ClRunner & runner);
+
+  __DECLARE_TEMPLATES(-1)
+  __DECLARE_TEMPLATES(0)
+  __DECLARE_TEMPLATES(1)
+  __DECLARE_TEMPLATES(2)
+  __DECLARE_TEMPLATES(3)
+
+#undef __DECLARE_TEMPLATES
+
+}
@@ -1,15 +1,33 @@
 #include "las_operations.hpp"
 
+#include "feature_file.hpp"
 #include "las_file.hpp"
+#include "las_stream.hpp"
+#include "octree.hpp"
+#include "parallel.hpp"
 #include "point_data.hpp"
+#include "spatial_index.hpp"
+#include "wlop.hpp"
+#include "wlop_cl.hpp"
 
 #include <clest/ostream.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <random>
 #include <vector>
 
 #ifdef _CMAKE_TBB_FOUND
 #include <tbb/blocked_range.h>
 #include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
 #endif
 
 #ifdef _CMAKE_CGAL_FOUND
@@ -153,6 +171,239 @@ namespace {
     }
   }
 
+  /// Copies the quantized coordinates of `lasFile` into separate arrays
+  template <int N>
+  void _gatherCoordinates(const las::LASFile<N> & lasFile,
+                          std::vector<uint32_t> & x,
+                          std::vector<uint32_t> & y,
+                          std::vector<uint32_t> & z) {
+    x.resize(lasFile.pointDataCount());
+    y.resize(lasFile.pointDataCount());
+    z.resize(lasFile.pointDataCount());
+    _mainIterator(lasFile, [&](las::PointData<N> point, auto index) {
+      x[index] = point.x;
+      y[index] = point.y;
+      z[index] = point.z;
+    });
+  }
+
+  /// Gathers the real coordinates of `lasFile`, relative to `origin`,
+  /// into the SoA `x`, `y` and `z`, dequantizing each block in parallel
+  template <int N, typename T>
+  void _gatherReal(const las::LASFile<N> & lasFile,
+                   const double (&origin)[3],
+                   std::vector<T> & x,
+                   std::vector<T> & y,
+                   std::vector<T> & z) {
+    const las::PublicHeader & header = lasFile.publicHeader;
+
+    x.resize(lasFile.pointDataCount());
+    y.resize(lasFile.pointDataCount());
+    z.resize(lasFile.pointDataCount());
+    las::forEachBlock(lasFile, [&](const las::PointData<N> * points,
+                                   uint64_t size,
+                                   uint64_t first) {
+      las::parallelFor(size, [&](uint64_t i) {
+        x[first + i] = static_cast<T>(
+          points[i].x * header.xScaleFactor + header.xOffset - origin[0]);
+        y[first + i] = static_cast<T>(
+          points[i].y * header.yScaleFactor + header.yOffset - origin[1]);
+        z[first + i] = static_cast<T>(
+          points[i].z * header.zScaleFactor + header.zOffset - origin[2]);
+      });
+    });
+  }
+
+  /// Solves the symmetric 3x3 eigenproblems of a batch of covariance
+  /// matrices, given as columns of their upper triangle
+  ///
+  /// Writes the unit eigenvector of the smallest eigenvalue, oriented
+  /// towards +Z since aerial scans look down on the surface, and the
+  /// surface variation: the smallest eigenvalue over their sum
+  ///
+  /// Closed form: each matrix is normalized by its trace, the eigenvalue
+  /// comes from the trigonometric solution of the characteristic cubic,
+  /// and the eigenvector is the largest cross product of two rows of
+  /// A - λI. The batch runs over SoA columns with selects instead of
+  /// branches, but `std::acos`, `std::cos` and the guarded divisions keep
+  /// it scalar without a vector math library and relaxed FP flags.
+  /// Degenerate neighborhoods (a single position, or collinear points)
+  /// get a +Z normal
+  void _normalsFromCovariances(const float * xx,
+                               const float * xy,
+                               const float * xz,
+                               const float * yy,
+                               const float * yz,
+                               const float * zz,
+                               uint64_t count,
+                               float * normalX,
+                               float * normalY,
+                               float * normalZ,
+                               float * curvature) {
+    constexpr float THIRD_TURN = 2.09439510f;
+
+    for (uint64_t i = 0; i < count; ++i) {
+      const float trace = xx[i] + yy[i] + zz[i];
+      const float inverseTrace = trace > 0 ? 1.0f / trace : 0.0f;
+      const float a00 = xx[i] * inverseTrace;
+      const float a01 = xy[i] * inverseTrace;
+      const float a02 = xz[i] * inverseTrace;
+      const float a11 = yy[i] * inverseTrace;
+      const float a12 = yz[i] * inverseTrace;
+      const float a22 = zz[i] * inverseTrace;
+
+      // Eigenvalues of B = (A - qI) / p are 2cos(phi + 2kπ/3)
+      const float q = (a00 + a11 + a22) / 3.0f;
+      const float b00 = a00 - q;
+      const float b11 = a11 - q;
+      const float b22 = a22 - q;
+      const float offDiagonal = a01 * a01 + a02 * a02 + a12 * a12;
+      const float p = std::sqrt(
+        (b00 * b00 + b11 * b11 + b22 * b22 + 2.0f * offDiagonal) / 6.0f);
+      const float inverseP = p > 1e-12f ? 1.0f / p : 0.0f;
+      const float determinant =
+        b00 * (b11 * b22 - a12 * a12)
+        - a01 * (a01 * b22 - a12 * a02)
+        + a02 * (a01 * a12 - b11 * a02);
+      float r = determinant * inverseP * inverseP * inverseP * 0.5f;
+      r = r < -1.0f ? -1.0f : (r > 1.0f ? 1.0f : r);
+      const float phi = std::acos(r) / 3.0f;
+      float smallest = q + 2.0f * p * std::cos(phi + THIRD_TURN);
+      smallest = smallest > 0 ? smallest : 0.0f;
+
+      // Rows of A - λI; the eigenvector is orthogonal to all of them
+      const float r0x = a00 - smallest, r0y = a01, r0z = a02;
+      const float r1x = a01, r1y = a11 - smallest, r1z = a12;
+      const float r2x = a02, r2y = a12, r2z = a22 - smallest;
+
+      const float c01x = r0y * r1z - r0z * r1y;
+      const float c01y = r0z * r1x - r0x * r1z;
+      const float c01z = r0x * r1y - r0y * r1x;
+      const float c02x = r0y * r2z - r0z * r2y;
+      const float c02y = r0z * r2x - r0x * r2z;
+      const float c02z = r0x * r2y - r0y * r2x;
+      const float c12x = r1y * r2z - r1z * r2y;
+      const float c12y = r1z * r2x - r1x * r2z;
+      const float c12z = r1x * r2y - r1y * r2x;
+
+      const float d01 = c01x * c01x + c01y * c01y + c01z * c01z;
+      const float d02 = c02x * c02x + c02y * c02y + c02z * c02z;
+      const float d12 = c12x * c12x + c12y * c12y + c12z * c12z;
+
+      const bool use02 = d02 > d01;
+      float nx = use02 ? c02x : c01x;
+      float ny = use02 ? c02y : c01y;
+      float nz = use02 ? c02z : c01z;
+      float d = use02 ? d02 : d01;
+      const bool use12 = d12 > d;
+      nx = use12 ? c12x : nx;
+      ny = use12 ? c12y : ny;
+      nz = use12 ? c12z : nz;
+      d = use12 ? d12 : d;
+
+      const bool valid = d > 1e-20f;
+      const float inverseLength = valid ? 1.0f / std::sqrt(d) : 0.0f;
+      const float sign = nz < 0 ? -inverseLength : inverseLength;
+
+      normalX[i] = nx * sign;
+      normalY[i] = ny * sign;
+      normalZ[i] = valid ? nz * sign : 1.0f;
+      curvature[i] = smallest;
+    }
+  }
+
+  /// Estimates the normal and the curvature of every point of `index`,
+  /// given by `x`, `y` and `z`, from the covariance of its `k` nearest
+  /// neighbors. See `estimateNormals`
+  void _pointNormals(const las::SpatialIndex & index,
+                     const std::vector<uint32_t> & x,
+                     const std::vector<uint32_t> & y,
+                     const std::vector<uint32_t> & z,
+                     const double scale[3],
+                     const unsigned int k,
+                     float * normalX,
+                     float * normalY,
+                     float * normalZ,
+                     float * curvature) {
+    const uint64_t count = x.size();
+
+    // Upper triangle of the covariance matrices, one column each
+    std::vector<float> xx(count);
+    std::vector<float> xy(count);
+    std::vector<float> xz(count);
+    std::vector<float> yy(count);
+    std::vector<float> yz(count);
+    std::vector<float> zz(count);
+    index.knnAll(k, [&](uint64_t i, const auto & neighbors) {
+      auto delta = [&](const std::vector<uint32_t> & values,
+                       uint32_t neighbor,
+                       int axis) {
+        return (static_cast<double>(values[neighbor])
+                - static_cast<double>(values[i])) * scale[axis];
+      };
+
+      double meanX = 0;
+      double meanY = 0;
+      double meanZ = 0;
+      for (auto & neighbor : neighbors) {
+        meanX += delta(x, neighbor.index, 0);
+        meanY += delta(y, neighbor.index, 1);
+        meanZ += delta(z, neighbor.index, 2);
+      }
+      meanX /= neighbors.size();
+      meanY /= neighbors.size();
+      meanZ /= neighbors.size();
+
+      double sums[6] = {};
+      for (auto & neighbor : neighbors) {
+        double dx = delta(x, neighbor.index, 0) - meanX;
+        double dy = delta(y, neighbor.index, 1) - meanY;
+        double dz = delta(z, neighbor.index, 2) - meanZ;
+        sums[0] += dx * dx;
+        sums[1] += dx * dy;
+        sums[2] += dx * dz;
+        sums[3] += dy * dy;
+        sums[4] += dy * dz;
+        sums[5] += dz * dz;
+      }
+
+      xx[i] = static_cast<float>(sums[0] / neighbors.size());
+      xy[i] = static_cast<float>(sums[1] / neighbors.size());
+      xz[i] = static_cast<float>(sums[2] / neighbors.size());
+      yy[i] = static_cast<float>(sums[3] / neighbors.size());
+      yz[i] = static_cast<float>(sums[4] / neighbors.size());
+      zz[i] = static_cast<float>(sums[5] / neighbors.size());
+    });
+
+    constexpr uint64_t BATCH_SIZE = 1024;
+    las::parallelFor((count + BATCH_SIZE - 1) / BATCH_SIZE, [&](uint64_t batch) {
+      uint64_t begin = batch * BATCH_SIZE;
+      uint64_t size = std::min(BATCH_SIZE, count - begin);
+      _normalsFromCovariances(xx.data() + begin,
+                              xy.data() + begin,
+                              xz.data() + begin,
+                              yy.data() + begin,
+                              yz.data() + begin,
+                              zz.data() + begin,
+                              size,
+                              normalX + begin,
+                              normalY + begin,
+                              normalZ + begin,
+                              curvature + begin);
+    });
+  }
+
+  /// Sums `func(index)` for every index in [0, `size`), in parallel
+  /// if TBB is available
+  template <typename F>
+  double _parallelSum(uint64_t size, const F & func) {
+    return las::parallelReduce(
+      size,
+      0.0,
+      [&](double & sum, uint64_t i) { sum += func(i); },
+      [](double & sum, const double & other) { sum += other; });
+  }
+
   /// Sequentially iterate over the point data and capture the min
   /// and max values for x, y, and z.
   /// Could be parallelized, but performance gain is not significant
@@ -169,290 +420,3030 @@ namespace {
     return limits;
   }
 
-#ifdef _CMAKE_CGAL_FOUND
-  /// Template full specialization for `Point3`
-  /// since it uses a function to access the coordinates
-  template<>
-  las::Limits<double> _getLimits(const std::vector<Point3> & container) {
-    las::Limits<double> limits;
-
-    for (auto & point : container) {
-      limits.update(point.x(), point.y(), point.z());
-    }
+  /// Creates a `LASFile<0>` carrying the headers of `lasFile` adjusted
+  /// for `count` points within `limits`
+  ///
+  /// Used by the operations that generate new points, such as WLOP,
+  /// which only keep the coordinates
+  template <int N>
+  las::LASFile<0> _createCoordinateFile(const las::LASFile<N> & lasFile,
+                                        const std::string & tag,
+                                        uint64_t count,
+                                        const las::Limits<double> & limits) {
+    las::LASFile<0> newFile(_generateName(lasFile.filePath, tag));
+    newFile.publicHeader = lasFile.publicHeader;
+    newFile.publicHeader.pointDataRecordFormat = 0;
+    newFile.publicHeader.pointDataRecordLength = sizeof(las::PointData<0>);
+    newFile.publicHeader.legacyNumberOfPointRecords =
+      count > 0xFFFFFFFF ?
+      0 : static_cast<uint32_t>(count);
+    newFile.publicHeader.numberOfPointRecords = count;
+    newFile.publicHeader.minX = limits.minX;
+    newFile.publicHeader.maxX = limits.maxX;
+    newFile.publicHeader.minY = limits.minY;
+    newFile.publicHeader.maxY = limits.maxY;
+    newFile.publicHeader.minZ = limits.minZ;
+    newFile.publicHeader.maxZ = limits.maxZ;
 
-    return limits;
+    newFile.recordHeaders = lasFile.recordHeaders;
+    return newFile;
   }
 
-  /// Functor to convert point data into CGAL `Point3` in a parallel fashion
-  ///
-  /// The `Point3` will save the coordinates in double value, i.e., it will
-  /// convert the unsigned int value from LAS to double by applying the
-  /// header modifiers for scale and offset
-  struct _PointConverter {
-
-    // Helper variables
-    const std::vector<Point3> * const _in;
-    las::LASFile<0> * const _out;
+  /// Largest quantized coordinate
+  constexpr double _QUANTIZED_MAX = 4294967295.0;
 
-    const double xScale;
-    const double yScale;
-    const double zScale;
+  /// Quantizes a real coordinate with `scale` and `offset`, rounding to
+  /// the nearest step and clamping to the range of `uint32_t`
+  inline uint32_t _quantize(double value, double scale, double offset) {
+    double quantized = std::floor((value - offset) / scale + 0.5);
+    return static_cast<uint32_t>(
+      std::min(std::max(quantized, 0.0), _QUANTIZED_MAX));
+  }
 
-    const double xOffset;
-    const double yOffset;
-    const double zOffset;
+  /// Converts the point at `index` of the relative `FloatCloud` back to
+  /// the quantized coordinates of `header`
+  las::PointData<0> _quantizeFloat(const las::wlop::FloatCloud & cloud,
+                                   size_t index,
+                                   const las::PublicHeader & header) {
+    las::PointData<0> point{};
+    point.x = _quantize(cloud.x[index] + cloud.originX,
+                        header.xScaleFactor, header.xOffset);
+    point.y = _quantize(cloud.y[index] + cloud.originY,
+                        header.yScaleFactor, header.yOffset);
+    point.z = _quantize(cloud.z[index] + cloud.originZ,
+                        header.zScaleFactor, header.zOffset);
+    return point;
+  }
 
-    // Constructor to set `const` values
-    _PointConverter(const std::vector<Point3> & in,
-                    las::LASFile<0> & out) :
-      _in(&in), _out(&out),
-      xScale(out.publicHeader.xScaleFactor),
-      yScale(out.publicHeader.yScaleFactor),
-      zScale(out.publicHeader.zScaleFactor),
-      xOffset(out.publicHeader.xOffset),
-      yOffset(out.publicHeader.yOffset),
-      zOffset(out.publicHeader.zOffset) {}
+  /// Affine transform folded into quantized space: the quantized input
+  /// maps to the quantized output as `matrix * q + translation`
+  struct _QuantizedAffine {
+    double matrix[3][3];
+    double translation[3];
+  };
 
-    // Function call to convert
-    void operator() (const tbb::blocked_range<uint64_t> & range) const {
-      las::PointData<0> dummy;
-      Point3 point;
-      for (uint64_t i = range.begin(); i != range.end(); ++i) {
-        point = (*_in)[i];
-        dummy.x = static_cast<uint32_t>((point.x() - xOffset) / xScale);
-        dummy.y = static_cast<uint32_t>((point.y() - yOffset) / yScale);
-        dummy.z = static_cast<uint32_t>((point.z() - zOffset) / zScale);
-        _out->pointData[i] = dummy;
+  /// Folds the dequantization of `source`, the row major affine `matrix`
+  /// and the quantization of `target` into a single transform
+  _QuantizedAffine _foldAffine(const las::PublicHeader & source,
+                               const std::array<double, 16> & matrix,
+                               const las::PublicHeader & target) {
+    const double inScale[3] = { source.xScaleFactor,
+                                source.yScaleFactor,
+                                source.zScaleFactor };
+    const double inOffset[3] = { source.xOffset,
+                                 source.yOffset,
+                                 source.zOffset };
+    const double outScale[3] = { target.xScaleFactor,
+                                 target.yScaleFactor,
+                                 target.zScaleFactor };
+    const double outOffset[3] = { target.xOffset,
+                                  target.yOffset,
+                                  target.zOffset };
+
+    _QuantizedAffine affine;
+    for (int row = 0; row < 3; ++row) {
+      double translation = matrix[row * 4 + 3] - outOffset[row];
+      for (int column = 0; column < 3; ++column) {
+        affine.matrix[row][column] =
+          matrix[row * 4 + column] * inScale[column] / outScale[row];
+        translation += matrix[row * 4 + column] * inOffset[column];
       }
+      affine.translation[row] = translation / outScale[row];
     }
-  };
-#endif
-}
+    return affine;
+  }
 
-namespace las {
-  /// Iterates the points from the file and changes the color according
-  /// to it's position in storage
-  ///
-  /// The color will go from RED to BLUE from first to last data point
+  /// Transforms a batch of quantized coordinates in place, rounding to the
+  /// nearest step, ties to even. Values outside of the range of
+  /// `uint32_t` are clamped, and their number is returned
   ///
-  /// The resulting LAS file will carry a `PointData<2>` format, the
-  /// minimum necessary for a RGB point cloud
-  template <int N>
-  void colorize(const LASFile<N> & lasFile) {
-    _validateLAS(lasFile, "colorize LAS file");
-
-    LASFile<2> newFile(_generateName(lasFile.filePath, "color"));
+  /// The loop is kept free of branches, of floating point comparisons
+  /// and of unsigned conversions, so it vectorizes under the default
+  /// floating point model: the inputs are converted through `int32_t` by
+  /// flipping the sign bit, and the outputs are rounded by adding 1.5 * 2^52,
+  /// which leaves the nearest integer in the low bits of the mantissa, to
+  /// be clamped as integers. This holds for results below 2^51 in
+  /// magnitude, far beyond the bounds checked by `transform`
+  uint64_t _transformBatch(uint32_t * x,
+                           uint32_t * y,
+                           uint32_t * z,
+                           uint64_t count,
+                           const _QuantizedAffine & affine) {
+    constexpr double BIAS = 2147483648.0;
+    constexpr uint32_t SIGN = 0x80000000u;
+    constexpr double ROUND = 6755399441055744.0;
+    constexpr int64_t MAX = 0xFFFFFFFFll;
+
+    int64_t roundBits;
+    std::memcpy(&roundBits, &ROUND, sizeof(roundBits));
+
+    const auto & m = affine.matrix;
+    const auto & t = affine.translation;
+    uint32_t clamped = 0;
+
+    for (uint64_t i = 0; i < count; ++i) {
+      const double qx = static_cast<int32_t>(x[i] ^ SIGN) + BIAS;
+      const double qy = static_cast<int32_t>(y[i] ^ SIGN) + BIAS;
+      const double qz = static_cast<int32_t>(z[i] ^ SIGN) + BIAS;
+
+      const double rx =
+        m[0][0] * qx + m[0][1] * qy + m[0][2] * qz + t[0] + ROUND;
+      const double ry =
+        m[1][0] * qx + m[1][1] * qy + m[1][2] * qz + t[1] + ROUND;
+      const double rz =
+        m[2][0] * qx + m[2][1] * qy + m[2][2] * qz + t[2] + ROUND;
+
+      int64_t ix;
+      int64_t iy;
+      int64_t iz;
+      std::memcpy(&ix, &rx, sizeof(ix));
+      std::memcpy(&iy, &ry, sizeof(iy));
+      std::memcpy(&iz, &rz, sizeof(iz));
+      ix -= roundBits;
+      iy -= roundBits;
+      iz -= roundBits;
+
+      clamped += (ix < 0) | (ix > MAX)
+        | (iy < 0) | (iy > MAX)
+        | (iz < 0) | (iz > MAX);
+
+      x[i] = static_cast<uint32_t>(std::min(std::max(ix, int64_t(0)), MAX));
+      y[i] = static_cast<uint32_t>(std::min(std::max(iy, int64_t(0)), MAX));
+      z[i] = static_cast<uint32_t>(std::min(std::max(iz, int64_t(0)), MAX));
+    }
 
-    // Copy the headers and change the pertinent values
-    newFile.publicHeader = lasFile.publicHeader;
-    newFile.publicHeader.pointDataRecordFormat = 2;
-    newFile.publicHeader.pointDataRecordLength = sizeof(PointData<2>);
-    newFile.recordHeaders = lasFile.recordHeaders;
+    return clamped;
+  }
 
-    // Prepare the color variables
-    constexpr uint16_t MAX_COLOR = 0xFFFF;
-    auto dataPointCount = lasFile.pointDataCount();
-    newFile.pointData.resize(dataPointCount);
+  /// Converts the points of `lasFile` to `float` relative to the minimum
+  /// corner of the header bounds
+  template <int N>
+  las::wlop::FloatCloud _toFloatCloud(const las::LASFile<N> & lasFile) {
+    const las::PublicHeader & header = lasFile.publicHeader;
 
-    _mainIterator(lasFile, [&](las::PointData<N> point, auto index) {
+    las::wlop::FloatCloud points;
+    points.originX = header.minX;
+    points.originY = header.minY;
+    points.originZ = header.minZ;
+    const double origin[3] = { header.minX, header.minY, header.minZ };
+    _gatherReal(lasFile, origin, points.x, points.y, points.z);
 
-      // This is safe because `PointData<2>` first address that is not
-      // part of the base `PointData` is the RED `uint16_t`
-      // Also, `LASFile<N>` is restricted to `PointData<N>`
-      PointData<2> newPoint = *reinterpret_cast<PointData<2>*>(&point);
+    return points;
+  }
 
-      //// The coordinates will be the same; do an explicit memory copy
-      //std::memcpy(&newPoint, &point, sizeof(uint32_t) * 3);
+  /// Resolves the WLOP radius: a positive `radius` is kept, otherwise it
+  /// is estimated the way CGAL does for `wlopParallel`, from the same
+  /// points, with `wlop::averageSpacing`
+  template <int N>
+  double _wlopRadius(const las::LASFile<N> & lasFile, const double radius) {
+    if (radius > 0) {
+      return radius;
+    }
 
-      // Set the colors
-      newPoint.red = static_cast<uint16_t>(
-        index * (MAX_COLOR + 1) / dataPointCount);
-      newPoint.blue = static_cast<uint16_t>(
-        MAX_COLOR - (index * (MAX_COLOR + 1) / dataPointCount));
-      newPoint.green = 0;
+    std::vector<uint32_t> x;
+    std::vector<uint32_t> y;
+    std::vector<uint32_t> z;
+    _gatherCoordinates(lasFile, x, y, z);
 
-      // Push the new value
-      newFile.pointData[index] = std::move(newPoint);
-    });
+    las::SpatialIndex index(x.data(), y.data(), z.data(), x.size(),
+                            lasFile.publicHeader.xScaleFactor,
+                            lasFile.publicHeader.yScaleFactor,
+                            lasFile.publicHeader.zScaleFactor);
 
-    newFile.save();
+    double estimate =
+      las::wlop::RADIUS_SPACINGS * las::wlop::averageSpacing(index);
+    clest::println("Estimated WLOP radius: {}", estimate);
+    return estimate;
   }
 
-  /// Downsamples a point cloud to `factor` percent of points
-  /// without copying the whole point cloud to memory by
-  /// working with reference indices instead of values
-  ///
-  /// The downsample picks random points from the point cloud
-  /// until the desired amount of points is reached
-  ///
-  /// It accomplishes this by shuffling the indices of the point
-  /// data and picking the first K values, where
-  /// K = |pointCloud| * factor / 100
+  /// Estimates the radius of the tiled WLOP like `_wlopRadius`, without
+  /// loading the whole file
   ///
-  /// `factor` should be (0 100]%
-  template<int N>
-  void simplify(const LASFile<N>& lasFile, const double factor) {
+  /// A counting pass finds the points of every tile of the footprint.
+  /// Every k-th tile is then gathered with a margin of a quarter of a
+  /// tile, with k chosen so that they fit in `memoryBudget`. The spacings
+  /// of the points of the gathered tiles are averaged, and since the tiles
+  /// keep their full density and find their neighbors in the margin, they
+  /// are the spacings of the whole cloud
+  template <int N>
+  double _tiledWlopRadius(const las::LASFile<N> & lasFile,
+                          const double tileSize,
+                          const int64_t tilesX,
+                          const int64_t tilesY,
+                          const uint64_t memoryBudget) {
+    // The coordinates, the index and the spacings of a point, over the
+    // area of a tile with its margin
+    constexpr uint64_t BYTES_PER_POINT = 48 * 9 / 4;
+
+    const las::PublicHeader & header = lasFile.publicHeader;
+    const double margin = tileSize / 4;
+    auto tileOf = [&](double value, double min, int64_t count) {
+      int64_t tile = static_cast<int64_t>(std::floor((value - min) / tileSize));
+      return std::max<int64_t>(0, std::min<int64_t>(tile, count - 1));
+    };
+    auto realX = [&](const las::PointData<N> & point) {
+      return point.x * header.xScaleFactor + header.xOffset;
+    };
+    auto realY = [&](const las::PointData<N> & point) {
+      return point.y * header.yScaleFactor + header.yOffset;
+    };
+
+    std::vector<uint64_t> counts(tilesX * tilesY, 0);
+    las::forEachBlock(lasFile, [&](const las::PointData<N> * points,
+                                   uint64_t size,
+                                   uint64_t) {
+      for (uint64_t i = 0; i < size; ++i) {
+        counts[tileOf(realX(points[i]), header.minX, tilesX) * tilesY
+               + tileOf(realY(points[i]), header.minY, tilesY)]++;
+      }
+    });
 
-    // Factor should be greater than 0 and less or equal to 100
-    // factor = (0 100]
-    if (!(factor > 0.0 && factor <= 100.0)) {
-      throw clest::Exception("Factor has to be from 0% to 100%");
+    const uint64_t total = lasFile.pointDataCount();
+    const uint64_t stride = std::max<uint64_t>(
+      1, (total * BYTES_PER_POINT + memoryBudget - 1)
+           / std::max<uint64_t>(memoryBudget, 1));
+    std::vector<char> sampled(counts.size(), 0);
+    uint64_t sampledCount = 0;
+    for (uint64_t t = 0; t < counts.size(); t += stride) {
+      sampled[t] = 1;
+      sampledCount += counts[t];
     }
-    _validateLAS(lasFile, "simplify LAS");
-
-    // Create a new file
-    LASFile<N> newFile(_generateName(lasFile.filePath, "simple"));
-
-    // Calculate the new size
-    uint64_t newSize = static_cast<uint64_t>(
-      lasFile.pointDataCount() * factor / 100.0);
-
-    // Gather the indices and shuffle them
-    std::vector<uint64_t> indices;
-    indices.reserve(lasFile.pointDataCount());
-    for (uint64_t i = 0; i < lasFile.pointDataCount(); i++) {
-      indices.push_back(i);
+    if (sampledCount == 0) {
+      auto largest = std::max_element(counts.begin(), counts.end());
+      sampled[largest - counts.begin()] = 1;
     }
-    std::random_shuffle(indices.begin(), indices.end());
 
-    // Pick the first K indices
-    indices.resize(newSize);
-    newFile.pointData.reserve(newSize);
+    // The points of the sampled tiles, then the ones of their margins
+    std::vector<uint32_t> x;
+    std::vector<uint32_t> y;
+    std::vector<uint32_t> z;
+    std::vector<char> inTile;
+    las::forEachBlock(lasFile, [&](const las::PointData<N> * points,
+                                   uint64_t size,
+                                   uint64_t) {
+      for (uint64_t i = 0; i < size; ++i) {
+        const double px = realX(points[i]);
+        const double py = realY(points[i]);
+        bool own = sampled[tileOf(px, header.minX, tilesX) * tilesY
+                           + tileOf(py, header.minY, tilesY)];
+        bool near = own;
+        for (int64_t tx = tileOf(px - margin, header.minX, tilesX);
+             tx <= tileOf(px + margin, header.minX, tilesX) && !near;
+             ++tx) {
+          for (int64_t ty = tileOf(py - margin, header.minY, tilesY);
+               ty <= tileOf(py + margin, header.minY, tilesY);
+               ++ty) {
+            near = near || sampled[tx * tilesY + ty];
+          }
+        }
 
-    // If the point data is already in memory, a specific implementation
-    // will be much faster than mainIterator()
-    if (lasFile.pointDataCount() == lasFile.pointData.size()) {
-      for (auto & index : indices) {
-        newFile.pointData.push_back(lasFile.pointData[index]);
+        if (near) {
+          x.push_back(points[i].x);
+          y.push_back(points[i].y);
+          z.push_back(points[i].z);
+          inTile.push_back(own);
+        }
       }
+    });
 
-      // Since it's not in memory, force it to load from file to be safe
-    } else {
-
-      // Sort them so that a stream reader can perform the capture
-      // of the actual data
-      std::sort(indices.begin(), indices.end());
-      size_t currentIndex = 0;
+    las::SpatialIndex index(x.data(), y.data(), z.data(), x.size(),
+                            header.xScaleFactor,
+                            header.yScaleFactor,
+                            header.zScaleFactor);
+    std::vector<double> spacings = las::wlop::pointSpacings(index);
+
+    double sum = 0;
+    uint64_t used = 0;
+    for (uint64_t i = 0; i < spacings.size(); ++i) {
+      if (inTile[i]) {
+        sum += spacings[i];
+        ++used;
+      }
+    }
 
-      // Since the index vector is sorted, use an incrementing pointer
-      // to decide whether to add
-      _mainIterator(lasFile, [&](las::PointData<N> point, auto index) {
-        if (currentIndex != newSize && index == indices[currentIndex]) {
-          newFile.pointData.push_back(point);
-          currentIndex++;
-        }
-      }, true);
+    const double estimate =
+      used > 0 ? las::wlop::RADIUS_SPACINGS * sum / used : 0;
+    if (!(estimate > 0)) {
+      throw clest::Exception::build(
+        "Could not estimate the WLOP radius of {}, since its points share "
+        "their positions. Give a radius instead",
+        lasFile.filePath);
     }
 
+    clest::println("Estimated WLOP radius: {} from {} of {} points",
+                   estimate, used, total);
+    return estimate;
+  }
+
+  /// Saves `cloud` as a new file tagged `tag`, requantized with the
+  /// header modifiers of `lasFile`
+  template <int N>
+  void _saveFloatCloud(const las::LASFile<N> & lasFile,
+                       const las::wlop::FloatCloud & cloud,
+                       const std::string & tag) {
     // Get the new limits
-    Limits<double> limits = _getLimits(newFile.pointData);
+    las::Limits<double> limits;
+    for (size_t i = 0; i < cloud.size(); ++i) {
+      limits.update(cloud.x[i] + cloud.originX,
+                    cloud.y[i] + cloud.originY,
+                    cloud.z[i] + cloud.originZ);
+    }
 
-    // Copy the headers and change the pertinent values
-    newFile.publicHeader = lasFile.publicHeader;
-    newFile.publicHeader.minX = limits.minX;
-    newFile.publicHeader.maxX = limits.maxX;
-    newFile.publicHeader.minY = limits.minY;
-    newFile.publicHeader.maxY = limits.maxY;
-    newFile.publicHeader.minZ = limits.minZ;
-    newFile.publicHeader.maxZ = limits.maxZ;
+    las::LASFile<0> newFile =
+      _createCoordinateFile(lasFile, tag, cloud.size(), limits);
 
-    newFile.recordHeaders = lasFile.recordHeaders;
+    newFile.pointData.resize(cloud.size());
+    las::parallelFor(cloud.size(), [&](uint64_t index) {
+      newFile.pointData[index] =
+        _quantizeFloat(cloud, index, lasFile.publicHeader);
+    });
 
     newFile.save();
   }
 
-#ifdef CGAL_LINKED_WITH_TBB
-  /// Performs a weighted locally optimal projection of the
-  /// point cloud by using CGAL's wlop
-  template <int N>
-  void wlopParallel(const LASFile<N> & lasFile,
-                    const double percentage,
-                    const double radius,
-                    const unsigned int iterations,
-                    const bool uniform) {
-    _validateLAS(lasFile, "execute WLOP");
+  /// A spatial tile of the tiled WLOP
+  /// Points are spilled to `path` as interleaved `float` triples relative
+  /// to the tile origin
+  struct _WLOPTile {
+    std::string path;
+    double originX;
+    double originY;
+    double originZ;
+    uint64_t count = 0;
+    std::vector<float> buffer;
+  };
 
-    // Prepare the variables for `Point3` conversion
-    auto xScale = lasFile.publicHeader.xScaleFactor;
-    auto yScale = lasFile.publicHeader.yScaleFactor;
-    auto zScale = lasFile.publicHeader.zScaleFactor;
+  /// Appends the buffered points of `tile` to its spill file
+  void _spillTile(_WLOPTile & tile) {
+    if (tile.buffer.empty()) {
+      return;
+    }
 
-    auto xOffset = lasFile.publicHeader.xOffset;
-    auto yOffset = lasFile.publicHeader.yOffset;
-    auto zOffset = lasFile.publicHeader.zOffset;
+    std::ofstream fileStream(tile.path,
+                             std::ofstream::binary | std::ofstream::app);
+    if (!fileStream.is_open()) {
+      throw clest::Exception::build("Could not open file {}", tile.path);
+    }
 
-    // Convert the points from `PointData<N>` to `Point3`
-    std::vector<Point3> points;
-    points.reserve(lasFile.pointDataCount());
-    _mainIterator(lasFile, [&](las::PointData<N> point, auto currentPoint) {
-      points.emplace_back(point.x * xScale + xOffset,
-                          point.y * yScale + yOffset,
-                          point.z * zScale + zOffset);
-    });
-    std::vector<Point3> output;
+    fileStream.write(reinterpret_cast<const char*>(tile.buffer.data()),
+                     tile.buffer.size() * sizeof(float));
+    fileStream.close();
 
-    // Call the main wlop function
-    CGAL::wlop_simplify_and_regularize_point_set<CGAL::Parallel_tag>(
-      points.begin(),
-      points.end(),
-      std::back_inserter(output),
-      percentage,
-      radius,
-      iterations,
-      uniform
-      );
+    // Release the memory, so that it is available to the other tiles
+    tile.buffer = std::vector<float>();
+  }
 
-    // Free the memory
-    points = std::vector<Point3>();
+  /// Loads the spilled points of `tile` and removes the spill file
+  las::wlop::FloatCloud _loadTile(const _WLOPTile & tile) {
+    las::wlop::FloatCloud cloud;
+    cloud.originX = tile.originX;
+    cloud.originY = tile.originY;
+    cloud.originZ = tile.originZ;
+
+    std::vector<float> interleaved(tile.count * 3);
+    std::ifstream fileStream(tile.path, std::ifstream::binary);
+    if (!fileStream.is_open()) {
+      throw clest::Exception::build("Could not open file {}", tile.path);
+    }
+    fileStream.read(reinterpret_cast<char*>(interleaved.data()),
+                    interleaved.size() * sizeof(float));
+    fileStream.close();
+    std::remove(tile.path.c_str());
+
+    cloud.resize(tile.count);
+    for (uint64_t i = 0; i < tile.count; ++i) {
+      cloud.x[i] = interleaved[i * 3];
+      cloud.y[i] = interleaved[i * 3 + 1];
+      cloud.z[i] = interleaved[i * 3 + 2];
+    }
 
-    // Get the new limits
-    Limits<double> limits = _getLimits(output);
+    return cloud;
+  }
 
-    // Copy the headers and change the pertinent values
-    LASFile<0> newFile(_generateName(lasFile.filePath, "wlop"));
-    newFile.publicHeader = lasFile.publicHeader;
-    newFile.publicHeader.pointDataRecordFormat = 0;
-    newFile.publicHeader.pointDataRecordLength = sizeof(PointData<0>);
-    newFile.publicHeader.legacyNumberOfPointRecords =
-      output.size() > 0xFFFFFFFF ?
-      0 : static_cast<uint32_t>(output.size());
-    newFile.publicHeader.numberOfPointRecords = output.size();
-    newFile.publicHeader.minX = limits.minX;
-    newFile.publicHeader.maxX = limits.maxX;
-    newFile.publicHeader.minY = limits.minY;
-    newFile.publicHeader.maxY = limits.maxY;
-    newFile.publicHeader.minZ = limits.minZ;
-    newFile.publicHeader.maxZ = limits.maxZ;
+  /// Sort key of the duplicate removal: the quantized coordinates and
+  /// optionally the bits of the GPS time. Equal keys are duplicates, and
+  /// the index breaks the ties so that the first occurrence sorts first
+  struct _DedupeKey {
+    uint64_t xy;
+    uint64_t time;
+    uint32_t z;
+    uint64_t index;
+
+    bool sameAs(const _DedupeKey & other) const {
+      return xy == other.xy && z == other.z && time == other.time;
+    }
 
-    newFile.recordHeaders = lasFile.recordHeaders;
+    bool operator<(const _DedupeKey & other) const {
+      if (xy != other.xy) { return xy < other.xy; }
+      if (z != other.z) { return z < other.z; }
+      if (time != other.time) { return time < other.time; }
+      return index < other.index;
+    }
 
-    // Convert from `Point3` back to `PointData<0>` in
-    // a parallel fashion
-    newFile.pointData.resize(output.size());
-    tbb::blocked_range<uint64_t> block(0, output.size());
-    tbb::parallel_for(block, _PointConverter(output, newFile));
+    /// Spreads the keys over the buckets of the streamed variant
+    uint64_t hash() const {
+      uint64_t h = xy * 0x9E3779B97F4A7C15ull;
+      h ^= (static_cast<uint64_t>(z) + time * 0xC2B2AE3D27D4EB4Full);
+      h ^= h >> 29;
+      h *= 0xBF58476D1CE4E5B9ull;
+      return h ^ (h >> 32);
+    }
+  };
 
-    // Free the memory
+  /// Bits of the GPS time of the formats that carry it, zero otherwise
+  template <int N>
+  uint64_t _timeBits(const las::PointData<N> &) {
+    return 0;
+  }
+
+  template <>
+  uint64_t _timeBits(const las::PointData<1> & point) {
+    uint64_t bits;
+    std::memcpy(&bits, &point.GPStime, sizeof(bits));
+    return bits;
+  }
+
+  template <>
+  uint64_t _timeBits(const las::PointData<3> & point) {
+    uint64_t bits;
+    std::memcpy(&bits, &point.GPStime, sizeof(bits));
+    return bits;
+  }
+
+  template <int N>
+  _DedupeKey _dedupeKey(const las::PointData<N> & point,
+                        uint64_t index,
+                        bool useTime) {
+    return { (static_cast<uint64_t>(point.x) << 32) | point.y,
+             useTime ? _timeBits(point) : 0,
+             point.z,
+             index };
+  }
+
+  /// Checks that `useTime` is only requested for formats with GPS time
+  template <int N>
+  void _validateTime(const las::LASFile<N> & lasFile, bool useTime) {
+    if (useTime && N != 1 && N != 3) {
+      throw clest::Exception::build(
+        "Point format {} of {} has no GPS time", N, lasFile.filePath);
+    }
+  }
+
+  void _sortKeys(std::vector<_DedupeKey> & keys) {
+#ifdef _CMAKE_TBB_FOUND
+    tbb::parallel_sort(keys.begin(), keys.end());
+#else
+    std::sort(keys.begin(), keys.end());
+#endif
+  }
+
+  /// Streams the points of `lasFile` whose `keep` flag is set to a file
+  /// tagged "dedupe", in their original order
+  template <int N, typename K>
+  void _writeUnique(const las::LASFile<N> & lasFile, const K & keep) {
+    las::LASWriter<N> writer(_generateName(lasFile.filePath, "dedupe"),
+                             lasFile.publicHeader,
+                             lasFile.recordHeaders);
+
+    las::parallelFilter(lasFile,
+                        [&](const las::PointData<N> &, uint64_t index) {
+                          return keep(index);
+                        },
+                        [&](const std::vector<las::PointData<N>> & kept) {
+                          writer.write(kept);
+                        });
+    writer.close();
+
+    clest::println("Removed {} duplicates out of {} points into {}",
+                   lasFile.pointDataCount() - writer.count(),
+                   lasFile.pointDataCount(),
+                   writer.filePath);
+  }
+
+  /// Lock-free union-find over `size` elements
+  ///
+  /// Roots are linked from the larger to the smaller index with a
+  /// compare-and-swap, so concurrent unions never lose a link and every
+  /// root ends up being the smallest element of its set. `find` halves
+  /// the paths it walks
+  class _UnionFind {
+  public:
+    _UnionFind(uint64_t size) : mParent(size) {
+      las::parallelFor(size, [&](uint64_t i) {
+        mParent[i].store(static_cast<uint32_t>(i), std::memory_order_relaxed);
+      });
+    }
+
+    uint32_t find(uint32_t element) {
+      while (true) {
+        uint32_t parent = mParent[element].load(std::memory_order_relaxed);
+        if (parent == element) {
+          return element;
+        }
+        uint32_t grandparent = mParent[parent].load(std::memory_order_relaxed);
+        if (parent != grandparent) {
+          mParent[element].compare_exchange_weak(parent, grandparent,
+                                                 std::memory_order_relaxed);
+        }
+        element = grandparent;
+      }
+    }
+
+    void unite(uint32_t a, uint32_t b) {
+      while (true) {
+        a = find(a);
+        b = find(b);
+        if (a == b) {
+          return;
+        }
+        if (a < b) {
+          std::swap(a, b);
+        }
+        uint32_t expected = a;
+        if (mParent[a].compare_exchange_strong(expected, b,
+                                               std::memory_order_relaxed)) {
+          return;
+        }
+      }
+    }
+
+  private:
+    std::vector<std::atomic<uint32_t>> mParent;
+  };
+
+  /// Bits per axis of a packed grid cell
+  constexpr int CELL_BITS = 21;
+  constexpr uint64_t CELL_MASK = (1ull << CELL_BITS) - 1;
+
+  /// Sorts the point indices by the packed cell given by `keyOf(index)`
+  ///
+  /// `cells` lists the distinct cells in order, and the points of cell
+  /// `c` are `indices[starts[c]]` up to `indices[starts[c + 1]]`
+  template <typename K>
+  void _sortIntoCells(uint64_t count,
+                      const K & keyOf,
+                      std::vector<uint32_t> & indices,
+                      std::vector<uint64_t> & cells,
+                      std::vector<uint32_t> & starts) {
+    std::vector<std::pair<uint64_t, uint32_t>> order(count);
+    las::parallelFor(count, [&](uint64_t i) {
+      order[i] = { keyOf(i), static_cast<uint32_t>(i) };
+    });
+#ifdef _CMAKE_TBB_FOUND
+    tbb::parallel_sort(order.begin(), order.end());
+#else
+    std::sort(order.begin(), order.end());
+#endif
+
+    indices.resize(count);
+    cells.clear();
+    starts.clear();
+    for (uint64_t i = 0; i < count; ++i) {
+      indices[i] = order[i].second;
+      if (i == 0 || order[i].first != order[i - 1].first) {
+        cells.push_back(order[i].first);
+        starts.push_back(static_cast<uint32_t>(i));
+      }
+    }
+    starts.push_back(static_cast<uint32_t>(count));
+  }
+
+  /// Stores the ID of the segment of a point in its point source ID
+  template <int N>
+  void _setSegmentID(las::PointData<N> & point, uint32_t id) {
+    point.pointSourceID = static_cast<uint16_t>(id);
+  }
+
+  template <>
+  void _setSegmentID(las::PointData<-1> &, uint32_t) {}
+
+  /// Open addressing hash set of voxel keys with lock-free insertion
+  ///
+  /// Keys are inserted concurrently with a compare-and-swap on the first
+  /// empty slot of their linear probe. The table only grows in `reserve`,
+  /// called between batches of insertions, and stays at most half full
+  class _VoxelSet {
+  public:
+    /// Never a key, since packed voxels take 63 bits
+    static constexpr uint64_t EMPTY = ~0ull;
+
+    /// Makes room for `count` more keys, rehashing in parallel if needed
+    /// Must not run concurrently with `insert`
+    void reserve(uint64_t count) {
+      const uint64_t needed = 2 * (size() + count);
+      if (needed <= mCapacity) {
+        return;
+      }
+
+      uint64_t capacity = std::max<uint64_t>(mCapacity, 1024);
+      while (capacity < needed) {
+        capacity *= 2;
+      }
+
+      std::unique_ptr<std::atomic<uint64_t>[]> old = std::move(mSlots);
+      const uint64_t oldCapacity = mCapacity;
+
+      mSlots.reset(new std::atomic<uint64_t>[capacity]);
+      mCapacity = capacity;
+      mSize.store(0);
+      las::parallelFor(capacity, [&](uint64_t i) {
+        mSlots[i].store(EMPTY, std::memory_order_relaxed);
+      });
+      las::parallelFor(oldCapacity, [&](uint64_t i) {
+        uint64_t key = old[i].load(std::memory_order_relaxed);
+        if (key != EMPTY) {
+          insert(key);
+        }
+      });
+    }
+
+    /// Returns whether `key` was new
+    bool insert(uint64_t key) {
+      const uint64_t mask = mCapacity - 1;
+      for (uint64_t slot = _hash(key) & mask;; slot = (slot + 1) & mask) {
+        uint64_t current = mSlots[slot].load(std::memory_order_relaxed);
+        if (current == EMPTY
+            && mSlots[slot].compare_exchange_strong(current, key,
+                                                    std::memory_order_relaxed)) {
+          mSize.fetch_add(1, std::memory_order_relaxed);
+          return true;
+        }
+        if (current == key) {
+          return false;
+        }
+      }
+    }
+
+    bool contains(uint64_t key) const {
+      if (mCapacity == 0) {
+        return false;
+      }
+      const uint64_t mask = mCapacity - 1;
+      for (uint64_t slot = _hash(key) & mask;; slot = (slot + 1) & mask) {
+        uint64_t current = mSlots[slot].load(std::memory_order_relaxed);
+        if (current == key) {
+          return true;
+        }
+        if (current == EMPTY) {
+          return false;
+        }
+      }
+    }
+
+    uint64_t size() const { return mSize.load(std::memory_order_relaxed); }
+
+  private:
+    static uint64_t _hash(uint64_t key) {
+      key ^= key >> 33;
+      key *= 0xFF51AFD7ED558CCDull;
+      return key ^ (key >> 33);
+    }
+
+    std::unique_ptr<std::atomic<uint64_t>[]> mSlots;
+    uint64_t mCapacity = 0;
+    std::atomic<uint64_t> mSize{ 0 };
+  };
+
+  /// Packed voxel of `point` on a grid of side `voxelSize` starting at
+  /// `origin`, in real units. Points past the grid fall in its border
+  template <int N>
+  uint64_t _voxelKey(const las::PointData<N> & point,
+                     const las::PublicHeader & header,
+                     const double origin[3],
+                     double voxelSize) {
+    const double real[3] = { point.x * header.xScaleFactor + header.xOffset,
+                             point.y * header.yScaleFactor + header.yOffset,
+                             point.z * header.zScaleFactor + header.zOffset };
+    uint64_t key = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+      double cell = std::floor((real[axis] - origin[axis]) / voxelSize);
+      uint64_t clamped = cell > 0 ? static_cast<uint64_t>(cell) : 0;
+      key = (key << CELL_BITS) | std::min(clamped, CELL_MASK);
+    }
+    return key;
+  }
+
+  /// Normal equations of point to plane ICP, accumulated per parallel
+  /// range along with the scratch list of the neighbor queries
+  struct _ICPSums {
+    /// Upper triangle of the sum of J J^T, row by row
+    double A[21] = {};
+    double b[6] = {};
+    double error = 0;
+    uint64_t count = 0;
+    std::vector<las::SpatialIndex::Neighbor> neighbors;
+
+    void add(const double J[6], double residual) {
+      int k = 0;
+      for (int i = 0; i < 6; ++i) {
+        for (int j = i; j < 6; ++j) {
+          A[k++] += J[i] * J[j];
+        }
+        b[i] -= J[i] * residual;
+      }
+      error += residual * residual;
+      count++;
+    }
+
+    void join(const _ICPSums & other) {
+      for (int i = 0; i < 21; ++i) {
+        A[i] += other.A[i];
+      }
+      for (int i = 0; i < 6; ++i) {
+        b[i] += other.b[i];
+      }
+      error += other.error;
+      count += other.count;
+    }
+  };
+
+  /// Solves the system of `_ICPSums` by Gaussian elimination with partial
+  /// pivoting. Returns false if it is singular
+  bool _solveICP(const _ICPSums & sums, double x[6]) {
+    double A[6][6];
+    double b[6];
+    int k = 0;
+    double largest = 0;
+    for (int i = 0; i < 6; ++i) {
+      for (int j = i; j < 6; ++j) {
+        A[i][j] = A[j][i] = sums.A[k++];
+      }
+      b[i] = sums.b[i];
+      largest = std::max(largest, std::fabs(A[i][i]));
+    }
+
+    for (int column = 0; column < 6; ++column) {
+      int pivot = column;
+      for (int row = column + 1; row < 6; ++row) {
+        if (std::fabs(A[row][column]) > std::fabs(A[pivot][column])) {
+          pivot = row;
+        }
+      }
+      if (!(std::fabs(A[pivot][column]) > 1e-12 * largest)) {
+        return false;
+      }
+      std::swap(A[pivot], A[column]);
+      std::swap(b[pivot], b[column]);
+
+      for (int row = column + 1; row < 6; ++row) {
+        double factor = A[row][column] / A[column][column];
+        for (int j = column; j < 6; ++j) {
+          A[row][j] -= factor * A[column][j];
+        }
+        b[row] -= factor * b[column];
+      }
+    }
+
+    for (int row = 5; row >= 0; --row) {
+      double value = b[row];
+      for (int j = row + 1; j < 6; ++j) {
+        value -= A[row][j] * x[j];
+      }
+      x[row] = value / A[row][row];
+    }
+    return true;
+  }
+
+  /// Row major rotation by `ax` around X, then `ay` around Y, then `az`
+  /// around Z
+  void _eulerRotation(double ax, double ay, double az, double rotation[9]) {
+    const double cx = std::cos(ax);
+    const double sx = std::sin(ax);
+    const double cy = std::cos(ay);
+    const double sy = std::sin(ay);
+    const double cz = std::cos(az);
+    const double sz = std::sin(az);
+
+    rotation[0] = cz * cy;
+    rotation[1] = cz * sy * sx - sz * cx;
+    rotation[2] = cz * sy * cx + sz * sx;
+    rotation[3] = sz * cy;
+    rotation[4] = sz * sy * sx + cz * cx;
+    rotation[5] = sz * sy * cx - cz * sx;
+    rotation[6] = -sy;
+    rotation[7] = cy * sx;
+    rotation[8] = cy * cx;
+  }
+
+  /// Candidate planes scored together, as a struct of arrays
+  constexpr int PLANE_BATCH = 8;
+
+  struct _PlaneBatch {
+    float a[PLANE_BATCH];
+    float b[PLANE_BATCH];
+    float c[PLANE_BATCH];
+    float d[PLANE_BATCH];
+  };
+
+  /// Adds to `counts` the number of points within `threshold` of each
+  /// plane `ax + by + cz + d = 0` of the batch
+  ///
+  /// The `count` points are walked once per plane, so a chunk of them
+  /// stays in cache for the whole batch. The inner loop is a branchless
+  /// multiply-add and compare over the coordinate arrays, which vectorizes
+  void _scorePlanes(const float * x,
+                    const float * y,
+                    const float * z,
+                    uint32_t count,
+                    const _PlaneBatch & planes,
+                    float threshold,
+                    uint64_t * counts) {
+    for (int p = 0; p < PLANE_BATCH; ++p) {
+      const float a = planes.a[p];
+      const float b = planes.b[p];
+      const float c = planes.c[p];
+      const float d = planes.d[p];
+
+      uint32_t inliers = 0;
+      for (uint32_t i = 0; i < count; ++i) {
+        float distance = a * x[i] + b * y[i] + c * z[i] + d;
+        inliers += std::fabs(distance) <= threshold ? 1 : 0;
+      }
+      counts[p] += inliers;
+    }
+  }
+
+  /// Corridor of points within a horizontal distance of a polyline
+  ///
+  /// The segments are kept as arrays relative to the first vertex, along
+  /// with their bounds grown by the distance, so that a chunk of points
+  /// is only tested against the segments whose bounds overlap its own
+  class _Corridor {
+  public:
+    _Corridor(const std::vector<std::array<double, 2>> & polyline,
+              double distance) :
+      originX(polyline.front()[0]),
+      originY(polyline.front()[1]),
+      radius2(distance * distance) {
+      // A single vertex is a segment of zero length, i.e., a disc
+      const std::size_t segments = std::max<std::size_t>(1, polyline.size() - 1);
+      for (std::size_t s = 0; s < segments; ++s) {
+        const auto & a = polyline[s];
+        const auto & b = polyline[std::min(s + 1, polyline.size() - 1)];
+        const double dx = b[0] - a[0];
+        const double dy = b[1] - a[1];
+        const double length2 = dx * dx + dy * dy;
+
+        ax.push_back(a[0] - originX);
+        ay.push_back(a[1] - originY);
+        directionX.push_back(dx);
+        directionY.push_back(dy);
+        inverseLength2.push_back(length2 > 0 ? 1 / length2 : 0);
+        minX.push_back(std::min(a[0], b[0]) - distance - originX);
+        minY.push_back(std::min(a[1], b[1]) - distance - originY);
+        maxX.push_back(std::max(a[0], b[0]) + distance - originX);
+        maxY.push_back(std::max(a[1], b[1]) + distance - originY);
+      }
+    }
+
+    /// Whether any segment could reach the box, in real units
+    bool overlaps(double boxMinX, double boxMinY,
+                  double boxMaxX, double boxMaxY) const {
+      return _firstOverlap(boxMinX - originX, boxMinY - originY,
+                           boxMaxX - originX, boxMaxY - originY, 0)
+        < ax.size();
+    }
+
+    /// Sets `keep[i]` for the `count` points within the corridor
+    template <int N>
+    void mark(const las::PointData<N> * points,
+              uint64_t count,
+              const las::PublicHeader & header,
+              uint8_t * keep) const {
+      std::vector<double> x(count);
+      std::vector<double> y(count);
+      double boxMinX = std::numeric_limits<double>::max();
+      double boxMinY = std::numeric_limits<double>::max();
+      double boxMaxX = std::numeric_limits<double>::lowest();
+      double boxMaxY = std::numeric_limits<double>::lowest();
+      for (uint64_t i = 0; i < count; ++i) {
+        x[i] = points[i].x * header.xScaleFactor + header.xOffset - originX;
+        y[i] = points[i].y * header.yScaleFactor + header.yOffset - originY;
+        boxMinX = std::min(boxMinX, x[i]);
+        boxMinY = std::min(boxMinY, y[i]);
+        boxMaxX = std::max(boxMaxX, x[i]);
+        boxMaxY = std::max(boxMaxY, y[i]);
+      }
+
+      std::vector<double> nearest(count, std::numeric_limits<double>::max());
+      for (std::size_t s = _firstOverlap(boxMinX, boxMinY, boxMaxX, boxMaxY, 0);
+           s < ax.size();
+           s = _firstOverlap(boxMinX, boxMinY, boxMaxX, boxMaxY, s + 1)) {
+        _nearestToSegment(x.data(), y.data(), count, s, nearest.data());
+      }
+
+      for (uint64_t i = 0; i < count; ++i) {
+        keep[i] = nearest[i] <= radius2 ? 1 : 0;
+      }
+    }
+
+  private:
+    std::size_t _firstOverlap(double boxMinX, double boxMinY,
+                              double boxMaxX, double boxMaxY,
+                              std::size_t s) const {
+      while (s < ax.size()
+             && (boxMaxX < minX[s] || maxX[s] < boxMinX
+                 || boxMaxY < minY[s] || maxY[s] < boxMinY)) {
+        ++s;
+      }
+      return s;
+    }
+
+    /// Lowers `nearest` to the squared distance of every point to segment
+    /// `s`. The parameter of the projection is clamped to the segment
+    /// with `(|t| - |t - 1| + 1) / 2`, so the loop is branchless over the
+    /// coordinate arrays and vectorizes
+    void _nearestToSegment(const double * x,
+                           const double * y,
+                           uint64_t count,
+                           std::size_t s,
+                           double * nearest) const {
+      const double startX = ax[s];
+      const double startY = ay[s];
+      const double dx = directionX[s];
+      const double dy = directionY[s];
+      const double scale = inverseLength2[s];
+
+      for (uint64_t i = 0; i < count; ++i) {
+        const double px = x[i] - startX;
+        const double py = y[i] - startY;
+        const double t = (px * dx + py * dy) * scale;
+        const double clamped = 0.5 * (std::fabs(t) - std::fabs(t - 1) + 1);
+        const double ex = px - clamped * dx;
+        const double ey = py - clamped * dy;
+        nearest[i] = std::min(nearest[i], ex * ex + ey * ey);
+      }
+    }
+
+    const double originX;
+    const double originY;
+    const double radius2;
+
+    std::vector<double> ax;
+    std::vector<double> ay;
+    std::vector<double> directionX;
+    std::vector<double> directionY;
+    std::vector<double> inverseLength2;
+    std::vector<double> minX;
+    std::vector<double> minY;
+    std::vector<double> maxX;
+    std::vector<double> maxY;
+  };
+
+  _Corridor _makeCorridor(const std::vector<std::array<double, 2>> & polyline,
+                          double distance) {
+    if (polyline.empty()) {
+      throw clest::Exception("The polyline of the corridor has no vertices");
+    }
+
+    if (!(distance > 0)) {
+      throw clest::Exception::build(
+        "The corridor distance {} is invalid and must be larger than zero",
+        distance);
+    }
+
+    return _Corridor(polyline, distance);
+  }
+
+#ifdef _CMAKE_CGAL_FOUND
+  /// Template full specialization for `Point3`
+  /// since it uses a function to access the coordinates
+  template<>
+  las::Limits<double> _getLimits(const std::vector<Point3> & container) {
+    las::Limits<double> limits;
+
+    for (auto & point : container) {
+      limits.update(point.x(), point.y(), point.z());
+    }
+
+    return limits;
+  }
+
+  /// Functor to convert point data into CGAL `Point3` in a parallel fashion
+  ///
+  /// The `Point3` will save the coordinates in double value, i.e., it will
+  /// convert the unsigned int value from LAS to double by applying the
+  /// header modifiers for scale and offset
+  struct _PointConverter {
+
+    // Helper variables
+    const std::vector<Point3> * const _in;
+    las::LASFile<0> * const _out;
+
+    const double xScale;
+    const double yScale;
+    const double zScale;
+
+    const double xOffset;
+    const double yOffset;
+    const double zOffset;
+
+    // Constructor to set `const` values
+    _PointConverter(const std::vector<Point3> & in,
+                    las::LASFile<0> & out) :
+      _in(&in), _out(&out),
+      xScale(out.publicHeader.xScaleFactor),
+      yScale(out.publicHeader.yScaleFactor),
+      zScale(out.publicHeader.zScaleFactor),
+      xOffset(out.publicHeader.xOffset),
+      yOffset(out.publicHeader.yOffset),
+      zOffset(out.publicHeader.zOffset) {}
+
+    // Function call to convert
+    void operator() (const tbb::blocked_range<uint64_t> & range) const {
+      las::PointData<0> dummy;
+      Point3 point;
+      for (uint64_t i = range.begin(); i != range.end(); ++i) {
+        point = (*_in)[i];
+        dummy.x = _quantize(point.x(), xScale, xOffset);
+        dummy.y = _quantize(point.y(), yScale, yOffset);
+        dummy.z = _quantize(point.z(), zScale, zOffset);
+        _out->pointData[i] = dummy;
+      }
+    }
+  };
+#endif
+}
+
+namespace las {
+  /// Iterates the points from the file and changes the color according
+  /// to it's position in storage
+  ///
+  /// The color will go from RED to BLUE from first to last data point
+  ///
+  /// The resulting LAS file will carry a `PointData<2>` format, the
+  /// minimum necessary for a RGB point cloud
+  template <int N>
+  void colorize(const LASFile<N> & lasFile) {
+    _validateLAS(lasFile, "colorize LAS file");
+
+    LASFile<2> newFile(_generateName(lasFile.filePath, "color"));
+
+    // Copy the headers and change the pertinent values
+    newFile.publicHeader = lasFile.publicHeader;
+    newFile.publicHeader.pointDataRecordFormat = 2;
+    newFile.publicHeader.pointDataRecordLength = sizeof(PointData<2>);
+    newFile.recordHeaders = lasFile.recordHeaders;
+
+    // Prepare the color variables
+    constexpr uint16_t MAX_COLOR = 0xFFFF;
+    auto dataPointCount = lasFile.pointDataCount();
+
+    newFile.pointData = parallelMap(lasFile, [&](PointData<N> point,
+                                                 uint64_t index) {
+
+      // This is safe because `PointData<2>` first address that is not
+      // part of the base `PointData` is the RED `uint16_t`
+      // Also, `LASFile<N>` is restricted to `PointData<N>`
+      PointData<2> newPoint = *reinterpret_cast<PointData<2>*>(&point);
+
+      //// The coordinates will be the same; do an explicit memory copy
+      //std::memcpy(&newPoint, &point, sizeof(uint32_t) * 3);
+
+      // Set the colors
+      newPoint.red = static_cast<uint16_t>(
+        index * (MAX_COLOR + 1) / dataPointCount);
+      newPoint.blue = static_cast<uint16_t>(
+        MAX_COLOR - (index * (MAX_COLOR + 1) / dataPointCount));
+      newPoint.green = 0;
+
+      return newPoint;
+    });
+
+    newFile.save();
+  }
+
+  /// Downsamples a point cloud to `factor` percent of points
+  /// without copying the whole point cloud to memory by
+  /// working with reference indices instead of values
+  ///
+  /// The downsample picks random points from the point cloud
+  /// until the desired amount of points is reached
+  ///
+  /// It accomplishes this by shuffling the indices of the point
+  /// data and picking the first K values, where
+  /// K = |pointCloud| * factor / 100
+  ///
+  /// `factor` should be (0 100]%
+  template<int N>
+  void simplify(const LASFile<N>& lasFile, const double factor) {
+
+    // Factor should be greater than 0 and less or equal to 100
+    // factor = (0 100]
+    if (!(factor > 0.0 && factor <= 100.0)) {
+      throw clest::Exception("Factor has to be from 0% to 100%");
+    }
+    _validateLAS(lasFile, "simplify LAS");
+
+    // Create a new file
+    LASFile<N> newFile(_generateName(lasFile.filePath, "simple"));
+
+    // Calculate the new size
+    uint64_t newSize = static_cast<uint64_t>(
+      lasFile.pointDataCount() * factor / 100.0);
+
+    // Gather the indices and shuffle them
+    std::vector<uint64_t> indices;
+    indices.reserve(lasFile.pointDataCount());
+    for (uint64_t i = 0; i < lasFile.pointDataCount(); i++) {
+      indices.push_back(i);
+    }
+    std::random_shuffle(indices.begin(), indices.end());
+
+    // Mark the first K indices and keep the marked points in file
+    // order, in parallel, whether they are in memory or streamed
+    std::vector<uint8_t> selected(lasFile.pointDataCount(), 0);
+    for (uint64_t i = 0; i < newSize; ++i) {
+      selected[indices[i]] = 1;
+    }
+    newFile.pointData = parallelFilter(lasFile, [&](const PointData<N> &,
+                                                    uint64_t index) {
+      return selected[index] != 0;
+    });
+
+    // Get the new limits
+    Limits<double> limits = _getLimits(newFile.pointData);
+
+    // Copy the headers and change the pertinent values
+    newFile.publicHeader = lasFile.publicHeader;
+    newFile.publicHeader.minX = limits.minX;
+    newFile.publicHeader.maxX = limits.maxX;
+    newFile.publicHeader.minY = limits.minY;
+    newFile.publicHeader.maxY = limits.maxY;
+    newFile.publicHeader.minZ = limits.minZ;
+    newFile.publicHeader.maxZ = limits.maxZ;
+
+    newFile.recordHeaders = lasFile.recordHeaders;
+
+    newFile.save();
+  }
+
+#ifdef CGAL_LINKED_WITH_TBB
+  /// Performs a weighted locally optimal projection of the
+  /// point cloud by using CGAL's wlop
+  template <int N>
+  void wlopParallel(const LASFile<N> & lasFile,
+                    const double percentage,
+                    const double radius,
+                    const unsigned int iterations,
+                    const bool uniform) {
+    _validateLAS(lasFile, "execute WLOP");
+
+    // Prepare the variables for `Point3` conversion
+    auto xScale = lasFile.publicHeader.xScaleFactor;
+    auto yScale = lasFile.publicHeader.yScaleFactor;
+    auto zScale = lasFile.publicHeader.zScaleFactor;
+
+    auto xOffset = lasFile.publicHeader.xOffset;
+    auto yOffset = lasFile.publicHeader.yOffset;
+    auto zOffset = lasFile.publicHeader.zOffset;
+
+    // Convert the points from `PointData<N>` to `Point3`
+    std::vector<Point3> points;
+    points.reserve(lasFile.pointDataCount());
+    _mainIterator(lasFile, [&](las::PointData<N> point, auto currentPoint) {
+      points.emplace_back(point.x * xScale + xOffset,
+                          point.y * yScale + yOffset,
+                          point.z * zScale + zOffset);
+    });
+    std::vector<Point3> output;
+
+    // Call the main wlop function
+    CGAL::wlop_simplify_and_regularize_point_set<CGAL::Parallel_tag>(
+      points.begin(),
+      points.end(),
+      std::back_inserter(output),
+      percentage,
+      radius,
+      iterations,
+      uniform
+      );
+
+    // Free the memory
+    points = std::vector<Point3>();
+
+    // Get the new limits
+    Limits<double> limits = _getLimits(output);
+
+    // Copy the headers and change the pertinent values
+    LASFile<0> newFile =
+      _createCoordinateFile(lasFile, "wlop", output.size(), limits);
+
+    // Convert from `Point3` back to `PointData<0>` in
+    // a parallel fashion
+    newFile.pointData.resize(output.size());
+    tbb::blocked_range<uint64_t> block(0, output.size());
+    tbb::parallel_for(block, _PointConverter(output, newFile));
+
+    // Free the memory
     output = std::vector<Point3>();
 
-    newFile.save();
+    newFile.save();
+  }
+#endif
+
+  /// Performs a weighted locally optimal projection of the point cloud
+  /// in single precision, without depending on CGAL
+  ///
+  /// The coordinates are converted to `float` relative to the minimum
+  /// corner of the header bounds, which keeps millimetre precision for
+  /// quantized data. The result is written to a file tagged "wlopf", so
+  /// it can be compared side by side with the "wlop" output of
+  /// `wlopParallel` for the same parameters
+  ///
+  /// A positive `epsilon` enables the convergence aware iterations:
+  /// samples moving less than `epsilon` are frozen and the run stops
+  /// early once all of them are
+  template <int N>
+  void wlopFloat(const LASFile<N> & lasFile,
+                 const double percentage,
+                 const double radius,
+                 const unsigned int iterations,
+                 const bool uniform,
+                 const double epsilon) {
+    _validateLAS(lasFile, "execute float WLOP");
+
+    // Convert the points from `PointData<N>` to relative `float`
+    wlop::FloatCloud points = _toFloatCloud(lasFile);
+
+    wlop::FloatCloud output = wlop::simplifyAndRegularize(
+      points,
+      percentage,
+      static_cast<float>(_wlopRadius(lasFile, radius)),
+      iterations,
+      uniform,
+      static_cast<float>(epsilon));
+
+    // Free the memory
+    points = wlop::FloatCloud();
+
+    _saveFloatCloud(lasFile, output, "wlopf");
+  }
+
+  /// Performs WLOP on the devices of `runner`
+  ///
+  /// Same conversion and output as `wlopFloat`, but the iterations run
+  /// with the kernels of "opencl/lop.cl". The result is written to a file
+  /// tagged "wlopcl"
+  ///
+  /// A radius that is not positive is estimated from the points of
+  /// `lasFile` with CGAL's estimator, so the output can be compared with
+  /// the one of `wlopParallel`
+  template <int N>
+  void wlopOpenCL(const LASFile<N> & lasFile,
+                  clest::ClRunner & runner,
+                  const double percentage,
+                  const double radius,
+                  const unsigned int iterations,
+                  const bool uniform) {
+    _validateLAS(lasFile, "execute OpenCL WLOP");
+
+    // Convert the points from `PointData<N>` to relative `float`
+    wlop::FloatCloud points = _toFloatCloud(lasFile);
+
+    wlop::FloatCloud output = wlop::simplifyAndRegularize(
+      runner,
+      points,
+      percentage,
+      static_cast<float>(_wlopRadius(lasFile, radius)),
+      iterations,
+      uniform);
+
+    // Free the memory
+    points = wlop::FloatCloud();
+
+    _saveFloatCloud(lasFile, output, "wlopcl");
+  }
+
+  /// Performs the single precision WLOP out of core
+  ///
+  /// The XY footprint is split into square tiles of `tileSize`, each
+  /// extended by a halo of twice the WLOP radius. A first streaming pass
+  /// spills every point to the tiles whose extended area contains it.
+  /// The spill buffers of all the tiles share a quarter of
+  /// `memoryBudget`, which leaves room for the growth of the vectors, and
+  /// the largest buffers are flushed first when it is reached. The tiles
+  /// are then processed in parallel, in waves whose estimated memory fits
+  /// within `memoryBudget` bytes
+  ///
+  /// Each tile runs WLOP over its interior and halo points, but only the
+  /// samples that end within the tile interior are kept. Since every
+  /// interior sample sees its full neighborhood through the halo, the
+  /// stitched output has no seams. The samples are streamed to a file
+  /// tagged "wlopt" as they are produced
+  ///
+  /// If `radius` is not positive, it is estimated like CGAL does, from
+  /// the points of tiles spread over the footprint that fit within
+  /// `memoryBudget`. A positive `epsilon` lets each tile stop iterating
+  /// as soon as its samples have converged
+  template <int N>
+  void wlopTiled(const LASFile<N> & lasFile,
+                 const double percentage,
+                 const double radius,
+                 const unsigned int iterations,
+                 const bool uniform,
+                 const double tileSize,
+                 const uint64_t memoryBudget,
+                 const double epsilon) {
+    _validateLAS(lasFile, "execute tiled WLOP");
+
+    if (!(tileSize > 0)) {
+      throw clest::Exception("The tile size has to be greater than zero");
+    }
+
+    // Estimated peak memory per original point of a tile: the cloud,
+    // its sorted copy, the grid buckets and offsets, the densities and
+    // the spill buffer
+    constexpr uint64_t BYTES_PER_POINT = 48;
+    constexpr uint64_t CHUNK_SIZE = 1 << 16;
+    constexpr size_t SPILL_SIZE = 1 << 18;
+
+    const PublicHeader & header = lasFile.publicHeader;
+
+    const int64_t tilesX = std::max<int64_t>(
+      1, static_cast<int64_t>(std::ceil((header.maxX - header.minX) / tileSize)));
+    const int64_t tilesY = std::max<int64_t>(
+      1, static_cast<int64_t>(std::ceil((header.maxY - header.minY) / tileSize)));
+
+    // A single radius for the halo and every tile, so that the tiles agree
+    // on their shared borders
+    const double wlopRadius = radius > 0
+      ? radius
+      : _tiledWlopRadius(lasFile, tileSize, tilesX, tilesY, memoryBudget);
+    const double halo = 2.0 * wlopRadius;
+
+    std::vector<_WLOPTile> tiles(tilesX * tilesY);
+    for (int64_t i = 0; i < tilesX; ++i) {
+      for (int64_t j = 0; j < tilesY; ++j) {
+        _WLOPTile & tile = tiles[i * tilesY + j];
+        tile.path = fmt::format("{}.tile{}_{}.tmp", lasFile.filePath, i, j);
+        tile.originX = header.minX + i * tileSize;
+        tile.originY = header.minY + j * tileSize;
+        tile.originZ = header.minZ;
+        std::remove(tile.path.c_str());
+      }
+    }
+
+    clest::println("Spilling {} points into {}x{} tiles",
+                   lasFile.pointDataCount(), tilesX, tilesY);
+
+    // Floats buffered over all the tiles, flushed down to half of the
+    // limit once it is reached
+    const uint64_t spillLimit = std::max<uint64_t>(
+      memoryBudget / (4 * sizeof(float)), 3 * CHUNK_SIZE);
+    uint64_t buffered = 0;
+
+    auto spillLargest = [&]() {
+      std::vector<_WLOPTile*> pending;
+      for (auto & tile : tiles) {
+        if (!tile.buffer.empty()) {
+          pending.push_back(&tile);
+        }
+      }
+      std::sort(pending.begin(), pending.end(),
+                [](const _WLOPTile * a, const _WLOPTile * b) {
+                  return a->buffer.size() > b->buffer.size();
+                });
+
+      for (auto tile : pending) {
+        if (buffered <= spillLimit / 2) {
+          break;
+        }
+        buffered -= tile->buffer.size();
+        _spillTile(*tile);
+      }
+    };
+
+    // Spill every point into all the tiles whose halo contains it
+    LASReader<N> reader(lasFile);
+    std::vector<PointData<N>> chunk;
+    while (reader.read(chunk, CHUNK_SIZE) > 0) {
+      for (auto & point : chunk) {
+        double x = point.x * header.xScaleFactor + header.xOffset;
+        double y = point.y * header.yScaleFactor + header.yOffset;
+        double z = point.z * header.zScaleFactor + header.zOffset;
+
+        auto tileRange = [&](double value, double min, int64_t count,
+                             int64_t & first, int64_t & last) {
+          first = static_cast<int64_t>(std::floor((value - halo - min) / tileSize));
+          last = static_cast<int64_t>(std::floor((value + halo - min) / tileSize));
+          first = std::max<int64_t>(0, std::min<int64_t>(first, count - 1));
+          last = std::max<int64_t>(0, std::min<int64_t>(last, count - 1));
+        };
+
+        int64_t firstX, lastX, firstY, lastY;
+        tileRange(x, header.minX, tilesX, firstX, lastX);
+        tileRange(y, header.minY, tilesY, firstY, lastY);
+
+        for (int64_t i = firstX; i <= lastX; ++i) {
+          for (int64_t j = firstY; j <= lastY; ++j) {
+            _WLOPTile & tile = tiles[i * tilesY + j];
+            tile.buffer.push_back(static_cast<float>(x - tile.originX));
+            tile.buffer.push_back(static_cast<float>(y - tile.originY));
+            tile.buffer.push_back(static_cast<float>(z - tile.originZ));
+            tile.count++;
+            buffered += 3;
+
+            if (tile.buffer.size() >= SPILL_SIZE) {
+              buffered -= tile.buffer.size();
+              _spillTile(tile);
+            }
+          }
+        }
+
+        if (buffered >= spillLimit) {
+          spillLargest();
+        }
+      }
+    }
+
+    for (auto & tile : tiles) {
+      _spillTile(tile);
+    }
+
+    // Group the tiles, largest first, into waves that fit the budget
+    std::vector<uint64_t> order;
+    for (uint64_t i = 0; i < tiles.size(); ++i) {
+      if (tiles[i].count > 0) {
+        order.push_back(i);
+      }
+    }
+    std::sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b) {
+      return tiles[a].count > tiles[b].count;
+    });
+
+    std::vector<std::vector<uint64_t>> waves;
+    uint64_t waveMemory = 0;
+    for (auto index : order) {
+      uint64_t memory = tiles[index].count * BYTES_PER_POINT;
+      if (memory > memoryBudget) {
+        clest::println(stderr,
+                       "Tile {} needs about {} bytes, above the budget of {}",
+                       tiles[index].path, memory, memoryBudget);
+      }
+      if (waves.empty() || waveMemory + memory > memoryBudget) {
+        waves.emplace_back();
+        waveMemory = 0;
+      }
+      waves.back().push_back(index);
+      waveMemory += memory;
+    }
+
+    LASWriter<0> writer(_generateName(lasFile.filePath, "wlopt"),
+                        header,
+                        lasFile.recordHeaders);
+
+    for (size_t w = 0; w < waves.size(); ++w) {
+      clest::println("Tiled WLOP wave {}/{} with {} tiles",
+                     w + 1, waves.size(), waves[w].size());
+
+      las::parallelFor(waves[w].size(), [&](uint64_t i) {
+        const uint64_t index = waves[w][i];
+        const int64_t tileX = index / tilesY;
+        const int64_t tileY = index % tilesY;
+
+        wlop::FloatCloud output = wlop::simplifyAndRegularize(
+          _loadTile(tiles[index]),
+          percentage,
+          static_cast<float>(wlopRadius),
+          iterations,
+          uniform,
+          static_cast<float>(epsilon));
+
+        // Keep the interior samples; the outer tiles also keep whatever
+        // drifted beyond the footprint
+        const float size = static_cast<float>(tileSize);
+        std::vector<PointData<0>> points;
+        points.reserve(output.size());
+        for (size_t p = 0; p < output.size(); ++p) {
+          if ((tileX > 0 && output.x[p] < 0)
+              || (tileX < tilesX - 1 && output.x[p] >= size)
+              || (tileY > 0 && output.y[p] < 0)
+              || (tileY < tilesY - 1 && output.y[p] >= size)) {
+            continue;
+          }
+          points.push_back(_quantizeFloat(output, p, header));
+        }
+
+        writer.write(points);
+      });
+    }
+
+    writer.close();
+    clest::println("Tiled WLOP wrote {} points to {}",
+                   writer.count(), writer.filePath);
+  }
+
+  /// Removes the statistical outliers of `lasFile`
+  ///
+  /// The mean distance from every point to its `k` nearest neighbors is
+  /// computed in parallel over a `SpatialIndex` of the coordinates. The
+  /// points whose mean distance exceeds the global mean by more than
+  /// `stddevMultiplier` standard deviations are dropped
+  ///
+  /// The inliers keep all their attributes and are streamed, in their
+  /// original order, to a file tagged "inliers". Its header bounds only
+  /// cover the inliers
+  template <int N>
+  void removeOutliers(const LASFile<N> & lasFile,
+                      const unsigned int k,
+                      const double stddevMultiplier) {
+    _validateLAS(lasFile, "remove outliers");
+
+    if (k == 0) {
+      throw clest::Exception("The number of neighbors has to be greater "
+                             "than zero");
+    }
+
+    const uint64_t count = lasFile.pointDataCount();
+    std::vector<float> meanDistances(count);
+    {
+      std::vector<uint32_t> x;
+      std::vector<uint32_t> y;
+      std::vector<uint32_t> z;
+      _gatherCoordinates(lasFile, x, y, z);
+
+      SpatialIndex index(x.data(), y.data(), z.data(), count,
+                         lasFile.publicHeader.xScaleFactor,
+                         lasFile.publicHeader.yScaleFactor,
+                         lasFile.publicHeader.zScaleFactor);
+
+      // Query one extra neighbor, since each point finds itself
+      index.knnAll(k + 1, [&](uint64_t i, const auto & neighbors) {
+        double sum = 0;
+        unsigned int used = 0;
+        for (auto & neighbor : neighbors) {
+          if (used == k) { break; }
+          if (neighbor.index == i) { continue; }
+          sum += std::sqrt(neighbor.distance2);
+          used++;
+        }
+        meanDistances[i] = used > 0 ? static_cast<float>(sum / used) : 0;
+      });
+    }
+
+    const double mean = _parallelSum(count, [&](uint64_t i) {
+      return static_cast<double>(meanDistances[i]);
+    }) / count;
+    const double variance = _parallelSum(count, [&](uint64_t i) {
+      double difference = meanDistances[i] - mean;
+      return difference * difference;
+    }) / count;
+    const double threshold = mean + stddevMultiplier * std::sqrt(variance);
+
+    clest::println("Mean neighbor distance: {}\n"
+                   "Standard deviation: {}\n"
+                   "Threshold: {}",
+                   mean, std::sqrt(variance), threshold);
+
+    LASWriter<N> writer(_generateName(lasFile.filePath, "inliers"),
+                        lasFile.publicHeader,
+                        lasFile.recordHeaders);
+
+    parallelFilter(lasFile,
+                   [&](const PointData<N> &, uint64_t index) {
+                     return meanDistances[index] <= threshold;
+                   },
+                   [&](const std::vector<PointData<N>> & inliers) {
+                     writer.write(inliers);
+                   });
+    writer.close();
+
+    clest::println("Removed {} outliers out of {} points into {}",
+                   count - writer.count(), count, writer.filePath);
+  }
+
+  /// Estimates the normal and the curvature of every point by principal
+  /// component analysis of its `k` nearest neighbors
+  ///
+  /// The covariances are accumulated in parallel over a `SpatialIndex`,
+  /// in scaled units and relative to each query point to keep precision.
+  /// They are then solved in batches by `_normalsFromCovariances`
+  ///
+  /// The results are saved next to the LAS file as "<file>.features",
+  /// a `FeatureFile` aligned with the point order
+  template <int N>
+  void estimateNormals(const LASFile<N> & lasFile, const unsigned int k) {
+    _validateLAS(lasFile, "estimate normals");
+
+    if (k < 3) {
+      throw clest::Exception("At least 3 neighbors are needed to "
+                             "estimate normals");
+    }
+
+    const uint64_t count = lasFile.pointDataCount();
+    const double scale[3] = { lasFile.publicHeader.xScaleFactor,
+                              lasFile.publicHeader.yScaleFactor,
+                              lasFile.publicHeader.zScaleFactor };
+
+    std::vector<uint32_t> x;
+    std::vector<uint32_t> y;
+    std::vector<uint32_t> z;
+    _gatherCoordinates(lasFile, x, y, z);
+
+    FeatureFile features(count);
+    {
+      SpatialIndex index(x.data(), y.data(), z.data(), count,
+                         scale[0], scale[1], scale[2]);
+      _pointNormals(index, x, y, z, scale, k,
+                    features.normalX.data(),
+                    features.normalY.data(),
+                    features.normalZ.data(),
+                    features.curvature.data());
+    }
+
+    features.save(lasFile.filePath + ".features");
+  }
+
+  /// Removes the duplicate points of `lasFile`, keeping the first one
+  ///
+  /// With a zero `epsilon`, the duplicates are the points with the same
+  /// quantized coordinates, and also the same GPS time if `useTime` is
+  /// set. Their keys are sorted in parallel and every key equal to its
+  /// predecessor is dropped
+  ///
+  /// With a positive `epsilon`, the points are taken in order and a point
+  /// is dropped if a kept point lies within `epsilon`, in real units,
+  /// found with a `SpatialIndex`. With `useTime`, that point must also
+  /// have the same GPS time
+  ///
+  /// The kept points are streamed, in their original order, to a file
+  /// tagged "dedupe"
+  template <int N>
+  void dedupe(const LASFile<N> & lasFile,
+              const double epsilon,
+              const bool useTime) {
+    _validateLAS(lasFile, "remove duplicates");
+    _validateTime(lasFile, useTime);
+
+    if (epsilon < 0) {
+      throw clest::Exception("The epsilon cannot be negative");
+    }
+
+    const uint64_t count = lasFile.pointDataCount();
+    std::vector<uint8_t> keep(count, 0);
+
+    if (epsilon == 0) {
+      std::vector<_DedupeKey> keys = parallelMap(
+        lasFile, [&](const PointData<N> & point, uint64_t index) {
+          return _dedupeKey(point, index, useTime);
+        });
+      _sortKeys(keys);
+
+      parallelFor(count, [&](uint64_t i) {
+        if (i == 0 || !keys[i].sameAs(keys[i - 1])) {
+          keep[keys[i].index] = 1;
+        }
+      });
+    } else {
+      std::vector<uint64_t> times;
+      if (useTime) {
+        times = parallelMap(lasFile, [](const PointData<N> & point,
+                                        uint64_t) {
+          return _timeBits(point);
+        });
+      }
+
+      std::vector<uint32_t> x;
+      std::vector<uint32_t> y;
+      std::vector<uint32_t> z;
+      _gatherCoordinates(lasFile, x, y, z);
+
+      SpatialIndex index(x.data(), y.data(), z.data(), count,
+                         lasFile.publicHeader.xScaleFactor,
+                         lasFile.publicHeader.yScaleFactor,
+                         lasFile.publicHeader.zScaleFactor);
+
+      auto matches = [&](uint64_t i, uint64_t other) {
+        return other < i && (!useTime || times[other] == times[i]);
+      };
+
+      // The points without an earlier neighbor are kept right away
+      std::vector<uint8_t> contested(count, 0);
+      index.radiusAll(epsilon, [&](uint64_t i, const auto & neighbors) {
+        for (auto & neighbor : neighbors) {
+          if (matches(i, neighbor.index)) {
+            contested[i] = 1;
+            return;
+          }
+        }
+        keep[i] = 1;
+      });
+
+      // The others are decided in index order, against the kept points
+      // only, so that a chain of close points keeps every point farther
+      // than `epsilon` from the kept ones
+      std::vector<SpatialIndex::Neighbor> neighbors;
+      for (uint64_t i = 0; i < count; ++i) {
+        if (!contested[i]) {
+          continue;
+        }
+
+        index.radius(x[i], y[i], z[i], epsilon, neighbors);
+        keep[i] = 1;
+        for (auto & neighbor : neighbors) {
+          if (matches(i, neighbor.index) && keep[neighbor.index]) {
+            keep[i] = 0;
+            break;
+          }
+        }
+      }
+    }
+
+    _writeUnique(lasFile, [&](uint64_t index) { return keep[index] != 0; });
+  }
+
+  /// Removes the exact duplicates of `lasFile` out of core
+  ///
+  /// The keys of `dedupe` are computed in parallel for each streamed
+  /// block and spilled into hashed buckets. The bitmap of the dropped
+  /// points, one bit per point, is taken from `memoryBudget` first, and
+  /// the buckets are sized so that each one can be sorted within the
+  /// rest. The spill buffers of all the buckets share that rest too, and
+  /// the largest are flushed first when it is reached. Duplicates always
+  /// share a bucket, so the buckets are sorted one at a time. A second
+  /// streaming pass writes the kept points to a file tagged "dedupe", in
+  /// their original order
+  template <int N>
+  void dedupeStreamed(const LASFile<N> & lasFile,
+                      const uint64_t memoryBudget,
+                      const bool useTime) {
+    _validateLAS(lasFile, "remove duplicates");
+    _validateTime(lasFile, useTime);
+
+    constexpr size_t SPILL_SIZE = 1 << 14;
+
+    const uint64_t count = lasFile.pointDataCount();
+
+    // The bitmap and the keys of a block are resident during the whole run
+    const uint64_t reserved = (count + 7) / 8
+      + PARALLEL_BLOCK_SIZE * (sizeof(_DedupeKey) + sizeof(uint64_t));
+    if (memoryBudget <= reserved + SPILL_SIZE * sizeof(_DedupeKey)) {
+      throw clest::Exception::build(
+        "The memory budget of {} bytes is too small for {} points, which "
+        "need more than {} bytes",
+        memoryBudget, count, reserved + SPILL_SIZE * sizeof(_DedupeKey));
+    }
+    const uint64_t available = memoryBudget - reserved;
+
+    const uint64_t bucketCount = std::max<uint64_t>(
+      1, (count * sizeof(_DedupeKey) + available - 1) / available);
+
+    std::vector<std::string> paths(bucketCount);
+    std::vector<uint64_t> sizes(bucketCount, 0);
+    std::vector<std::vector<_DedupeKey>> buffers(bucketCount);
+
+    auto spill = [&](uint64_t bucket) {
+      std::ofstream fileStream(paths[bucket],
+                               std::ofstream::binary | std::ofstream::app);
+      if (!fileStream.is_open()) {
+        throw clest::Exception::build("Could not open file {}", paths[bucket]);
+      }
+      fileStream.write(reinterpret_cast<const char*>(buffers[bucket].data()),
+                       buffers[bucket].size() * sizeof(_DedupeKey));
+      sizes[bucket] += buffers[bucket].size();
+
+      // Release the memory, so that it is available to the other buckets
+      buffers[bucket] = std::vector<_DedupeKey>();
+    };
+
+    // Keys buffered over all the buckets, flushed down to half of the
+    // limit once it is reached. A quarter of the budget leaves room for
+    // the growth of the vectors
+    const uint64_t spillLimit = std::max<uint64_t>(
+      available / (4 * sizeof(_DedupeKey)), SPILL_SIZE);
+    uint64_t buffered = 0;
+
+    auto spillLargest = [&]() {
+      std::vector<uint64_t> pending;
+      for (uint64_t b = 0; b < bucketCount; ++b) {
+        if (!buffers[b].empty()) {
+          pending.push_back(b);
+        }
+      }
+      std::sort(pending.begin(), pending.end(), [&](uint64_t a, uint64_t b) {
+        return buffers[a].size() > buffers[b].size();
+      });
+
+      for (auto bucket : pending) {
+        if (buffered <= spillLimit / 2) {
+          break;
+        }
+        buffered -= buffers[bucket].size();
+        spill(bucket);
+      }
+    };
+
+    for (uint64_t b = 0; b < bucketCount; ++b) {
+      paths[b] = fmt::format("{}.dedupe{}.tmp", lasFile.filePath, b);
+      std::remove(paths[b].c_str());
+    }
+
+    clest::println("Spilling {} keys into {} buckets", count, bucketCount);
+
+    // A loaded file is a single block, so the keys are computed in parts
+    // of at most `PARALLEL_BLOCK_SIZE` points
+    std::vector<_DedupeKey> blockKeys;
+    std::vector<uint64_t> blockBuckets;
+    forEachBlock(lasFile, [&](const PointData<N> * points,
+                              uint64_t size,
+                              uint64_t first) {
+      for (uint64_t start = 0; start < size; start += PARALLEL_BLOCK_SIZE) {
+        const uint64_t part = std::min(size - start, PARALLEL_BLOCK_SIZE);
+        blockKeys.resize(part);
+        blockBuckets.resize(part);
+        parallelFor(part, [&](uint64_t i) {
+          blockKeys[i] =
+            _dedupeKey(points[start + i], first + start + i, useTime);
+          blockBuckets[i] = blockKeys[i].hash() % bucketCount;
+        });
+
+        for (uint64_t i = 0; i < part; ++i) {
+          const uint64_t bucket = blockBuckets[i];
+          buffers[bucket].push_back(blockKeys[i]);
+          ++buffered;
+
+          if (buffers[bucket].size() >= SPILL_SIZE) {
+            buffered -= buffers[bucket].size();
+            spill(bucket);
+          }
+          if (buffered >= spillLimit) {
+            spillLargest();
+          }
+        }
+      }
+    });
+    blockKeys = std::vector<_DedupeKey>();
+    blockBuckets = std::vector<uint64_t>();
+
+    for (uint64_t b = 0; b < bucketCount; ++b) {
+      if (!buffers[b].empty()) {
+        spill(b);
+      }
+    }
+
+    std::vector<bool> dropped(count, false);
+    std::vector<_DedupeKey> keys;
+    for (uint64_t b = 0; b < bucketCount; ++b) {
+      if (sizes[b] == 0) {
+        std::remove(paths[b].c_str());
+        continue;
+      }
+
+      keys.resize(sizes[b]);
+      std::ifstream fileStream(paths[b], std::ifstream::binary);
+      if (!fileStream.is_open()) {
+        throw clest::Exception::build("Could not open file {}", paths[b]);
+      }
+      fileStream.read(reinterpret_cast<char*>(keys.data()),
+                      keys.size() * sizeof(_DedupeKey));
+      fileStream.close();
+      std::remove(paths[b].c_str());
+
+      _sortKeys(keys);
+      for (uint64_t i = 1; i < keys.size(); ++i) {
+        if (keys[i].sameAs(keys[i - 1])) {
+          dropped[keys[i].index] = true;
+        }
+      }
+    }
+
+    _writeUnique(lasFile, [&](uint64_t index) { return !dropped[index]; });
+  }
+
+  /// Applies the row major 4x4 affine `matrix` to the real coordinates
+  /// of `lasFile` and requantizes them with `newScale` and `newOffset`
+  ///
+  /// The dequantization, the transform and the requantization are folded
+  /// into one affine map over the quantized coordinates, applied in
+  /// parallel over vectorized batches with rounding to the nearest step.
+  /// The image of the header bounds must fit the new quantization, else
+  /// nothing is written; stray points beyond the header bounds are
+  /// clamped and reported
+  ///
+  /// The points keep their other attributes and are streamed to a file
+  /// tagged "transform", whose header carries the new scale, offset and
+  /// bounds. The last row of `matrix` is ignored
+  template <int N>
+  void transform(const LASFile<N> & lasFile,
+                 const std::array<double, 16> & matrix,
+                 const std::array<double, 3> & newScale,
+                 const std::array<double, 3> & newOffset) {
+    _validateLAS(lasFile, "transform LAS");
+
+    if (!(newScale[0] > 0 && newScale[1] > 0 && newScale[2] > 0)) {
+      throw clest::Exception::build(
+        "The scale [{}, {}, {}] is invalid and must be larger than zero",
+        newScale[0], newScale[1], newScale[2]);
+    }
+
+    constexpr uint64_t BATCH_SIZE = 1024;
+
+    PublicHeader header = lasFile.publicHeader;
+    header.xScaleFactor = newScale[0];
+    header.yScaleFactor = newScale[1];
+    header.zScaleFactor = newScale[2];
+    header.xOffset = newOffset[0];
+    header.yOffset = newOffset[1];
+    header.zOffset = newOffset[2];
+
+    const _QuantizedAffine affine =
+      _foldAffine(lasFile.publicHeader, matrix, header);
+
+    // The header box maps to a parallelepiped whose corners bound the
+    // transformed points
+    const PublicHeader & source = lasFile.publicHeader;
+    for (int corner = 0; corner < 8; ++corner) {
+      double real[3] = { corner & 1 ? source.maxX : source.minX,
+                         corner & 2 ? source.maxY : source.minY,
+                         corner & 4 ? source.maxZ : source.minZ };
+      for (int row = 0; row < 3; ++row) {
+        double value = matrix[row * 4 + 3];
+        for (int column = 0; column < 3; ++column) {
+          value += matrix[row * 4 + column] * real[column];
+        }
+        double quantized = (value - newOffset[row]) / newScale[row];
+        if (quantized < -0.5 || quantized > _QUANTIZED_MAX + 0.5) {
+          throw clest::Exception::build(
+            "The transformed bounds of {} overflow the quantization: "
+            "{} is out of range on axis {}",
+            lasFile.filePath, value, row);
+        }
+      }
+    }
+
+    LASWriter<N> writer(_generateName(lasFile.filePath, "transform"),
+                        header,
+                        lasFile.recordHeaders);
+
+    std::vector<PointData<N>> output;
+    uint64_t clamped = 0;
+    forEachBlock(lasFile, [&](const PointData<N> * points,
+                              uint64_t count,
+                              uint64_t) {
+      output.assign(points, points + count);
+
+      const uint64_t batches = (count + BATCH_SIZE - 1) / BATCH_SIZE;
+      clamped += parallelReduce(batches, uint64_t(0), [&](uint64_t & sum,
+                                                          uint64_t batch) {
+        const uint64_t begin = batch * BATCH_SIZE;
+        const uint64_t size = std::min(BATCH_SIZE, count - begin);
+        uint32_t x[BATCH_SIZE];
+        uint32_t y[BATCH_SIZE];
+        uint32_t z[BATCH_SIZE];
+        for (uint64_t i = 0; i < size; ++i) {
+          x[i] = output[begin + i].x;
+          y[i] = output[begin + i].y;
+          z[i] = output[begin + i].z;
+        }
+        sum += _transformBatch(x, y, z, size, affine);
+        for (uint64_t i = 0; i < size; ++i) {
+          output[begin + i].x = x[i];
+          output[begin + i].y = y[i];
+          output[begin + i].z = z[i];
+        }
+      }, [](uint64_t & sum, const uint64_t & other) { sum += other; });
+
+      writer.write(output);
+    });
+    writer.close();
+
+    if (clamped > 0) {
+      clest::println(stderr,
+                     "{} points beyond the header bounds were clamped",
+                     clamped);
+    }
+    clest::println("Transformed {} points into {}",
+                   writer.count(), writer.filePath);
+  }
+
+  /// Labels the Euclidean clusters of `lasFile`: the connected components
+  /// of the graph linking the points within `radius`, in real units
+  ///
+  /// The points are sorted into a grid of cells of side radius / sqrt(3),
+  /// so the points sharing a cell are all linked. Each cell is then
+  /// joined to the neighboring cells that can hold a point within
+  /// `radius`, stopping at the first linked pair of points and skipping
+  /// the cells already in the same set. The cells are processed in
+  /// parallel over a lock-free union-find
+  ///
+  /// Clusters of at least `minSize` points are numbered from 1 in grid
+  /// order, and the points of smaller ones get 0. The ID is stored in the
+  /// point source ID of the points, streamed to a file tagged "cluster".
+  /// Throws if there are more than 65535 clusters
+  template <int N>
+  void cluster(const LASFile<N> & lasFile,
+               const double radius,
+               const uint64_t minSize) {
+    _validateLAS(lasFile, "cluster points");
+
+    if (N == -1) {
+      throw clest::Exception::build(
+        "Point format -1 of {} has no field for the cluster IDs",
+        lasFile.filePath);
+    }
+
+    if (!(radius > 0)) {
+      throw clest::Exception::build(
+        "The radius {} is invalid and must be larger than zero", radius);
+    }
+
+    const uint64_t count = lasFile.pointDataCount();
+    if (count >= 0xFFFFFFFF) {
+      throw clest::Exception::build("{} has too many points to cluster",
+                                    lasFile.filePath);
+    }
+
+    const double scale[3] = { lasFile.publicHeader.xScaleFactor,
+                              lasFile.publicHeader.yScaleFactor,
+                              lasFile.publicHeader.zScaleFactor };
+    const double cellSize = radius / std::sqrt(3.0);
+    const double radius2 = radius * radius;
+
+    std::vector<uint32_t> x;
+    std::vector<uint32_t> y;
+    std::vector<uint32_t> z;
+    _gatherCoordinates(lasFile, x, y, z);
+    const uint32_t * const coordinates[3] = { x.data(), y.data(), z.data() };
+
+    // The grid starts at the lowest point, since the header bounds may be
+    // off and clamping would merge the cells of distant points
+    using Bounds = std::array<uint32_t, 6>;
+    const Bounds bounds = parallelReduce(
+      count,
+      Bounds{ { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0, 0, 0 } },
+      [&](Bounds & value, uint64_t i) {
+        for (int axis = 0; axis < 3; ++axis) {
+          value[axis] = std::min(value[axis], coordinates[axis][i]);
+          value[axis + 3] = std::max(value[axis + 3], coordinates[axis][i]);
+        }
+      },
+      [](Bounds & value, const Bounds & other) {
+        for (int axis = 0; axis < 3; ++axis) {
+          value[axis] = std::min(value[axis], other[axis]);
+          value[axis + 3] = std::max(value[axis + 3], other[axis + 3]);
+        }
+      });
+
+    for (int axis = 0; axis < 3; ++axis) {
+      double extent = (bounds[axis + 3] - bounds[axis]) * scale[axis];
+      if (extent / cellSize >= CELL_MASK) {
+        throw clest::Exception::build(
+          "The radius {} is too small for an extent of {}", radius, extent);
+      }
+    }
+
+    auto cellOf = [&](uint64_t i, int axis) {
+      return static_cast<uint64_t>(
+        (coordinates[axis][i] - bounds[axis]) * scale[axis] / cellSize);
+    };
+
+    std::vector<uint32_t> indices;
+    std::vector<uint64_t> cells;
+    std::vector<uint32_t> starts;
+    _sortIntoCells(count, [&](uint64_t i) {
+      return (cellOf(i, 0) << (2 * CELL_BITS))
+        | (cellOf(i, 1) << CELL_BITS)
+        | cellOf(i, 2);
+    }, indices, cells, starts);
+
+    // Cell ordered copies of the coordinates
+    std::vector<uint32_t> sortedX(count);
+    std::vector<uint32_t> sortedY(count);
+    std::vector<uint32_t> sortedZ(count);
+    parallelFor(count, [&](uint64_t i) {
+      sortedX[i] = x[indices[i]];
+      sortedY[i] = y[indices[i]];
+      sortedZ[i] = z[indices[i]];
+    });
+    x = std::vector<uint32_t>();
+    y = std::vector<uint32_t>();
+    z = std::vector<uint32_t>();
+
+    // Half of the neighborhood, so that each pair of cells is joined once
+    const int reach = static_cast<int>(std::ceil(radius / cellSize));
+    std::vector<std::array<int, 3>> offsets;
+    for (int dx = -reach; dx <= reach; ++dx) {
+      for (int dy = -reach; dy <= reach; ++dy) {
+        for (int dz = -reach; dz <= reach; ++dz) {
+          if (dx < 0 || (dx == 0 && (dy < 0 || (dy == 0 && dz <= 0)))) {
+            continue;
+          }
+          double gap2 = 0;
+          for (int d : { dx, dy, dz }) {
+            double gap = std::max(std::abs(d) - 1, 0) * cellSize;
+            gap2 += gap * gap;
+          }
+          if (gap2 <= radius2) {
+            offsets.push_back({ { dx, dy, dz } });
+          }
+        }
+      }
+    }
+
+    auto linked = [&](uint32_t a, uint32_t b) {
+      double dx = (static_cast<double>(sortedX[a]) - sortedX[b]) * scale[0];
+      double dy = (static_cast<double>(sortedY[a]) - sortedY[b]) * scale[1];
+      double dz = (static_cast<double>(sortedZ[a]) - sortedZ[b]) * scale[2];
+      return dx * dx + dy * dy + dz * dz <= radius2;
+    };
+
+    _UnionFind sets(count);
+    parallelFor(cells.size(), [&](uint64_t c) {
+      const uint32_t begin = starts[c];
+      const uint32_t end = starts[c + 1];
+      for (uint32_t i = begin + 1; i < end; ++i) {
+        sets.unite(begin, i);
+      }
+
+      const int64_t cell[3] = {
+        static_cast<int64_t>(cells[c] >> (2 * CELL_BITS)),
+        static_cast<int64_t>((cells[c] >> CELL_BITS) & CELL_MASK),
+        static_cast<int64_t>(cells[c] & CELL_MASK) };
+
+      for (auto & offset : offsets) {
+        uint64_t key = 0;
+        bool inside = true;
+        for (int axis = 0; axis < 3; ++axis) {
+          int64_t value = cell[axis] + offset[axis];
+          inside = inside && value >= 0
+            && value <= static_cast<int64_t>(CELL_MASK);
+          key = (key << CELL_BITS) | (value & CELL_MASK);
+        }
+        if (!inside) {
+          continue;
+        }
+
+        auto found = std::lower_bound(cells.begin(), cells.end(), key);
+        if (found == cells.end() || *found != key) {
+          continue;
+        }
+        const uint64_t n = found - cells.begin();
+        if (sets.find(begin) == sets.find(starts[n])) {
+          continue;
+        }
+
+        bool joined = false;
+        for (uint32_t i = begin; i < end && !joined; ++i) {
+          for (uint32_t j = starts[n]; j < starts[n + 1]; ++j) {
+            if (linked(i, j)) {
+              sets.unite(i, j);
+              joined = true;
+              break;
+            }
+          }
+        }
+      }
+    });
+
+    // Every root is the first point of its set in grid order
+    std::vector<uint32_t> roots(count);
+    std::vector<std::atomic<uint32_t>> sizes(count);
+    parallelFor(count, [&](uint64_t i) {
+      sizes[i].store(0, std::memory_order_relaxed);
+    });
+    parallelFor(count, [&](uint64_t i) {
+      roots[i] = sets.find(static_cast<uint32_t>(i));
+      sizes[roots[i]].fetch_add(1, std::memory_order_relaxed);
+    });
+
+    std::vector<uint32_t> labels(count, 0);
+    uint32_t clusters = 0;
+    uint64_t clustered = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+      uint32_t size = sizes[i].load(std::memory_order_relaxed);
+      if (roots[i] == i && size >= minSize) {
+        labels[i] = ++clusters;
+        clustered += size;
+      }
+    }
+
+    if (clusters > 0xFFFF) {
+      throw clest::Exception::build(
+        "{} clusters of {} do not fit in the point source ID. Raise the "
+        "minimum size or the radius",
+        clusters, lasFile.filePath);
+    }
+
+    std::vector<uint32_t> ids(count);
+    parallelFor(count, [&](uint64_t i) {
+      ids[indices[i]] = labels[roots[i]];
+    });
+
+    LASWriter<N> writer(_generateName(lasFile.filePath, "cluster"),
+                        lasFile.publicHeader,
+                        lasFile.recordHeaders);
+
+    std::vector<PointData<N>> output;
+    forEachBlock(lasFile, [&](const PointData<N> * points,
+                              uint64_t size,
+                              uint64_t first) {
+      output.assign(points, points + size);
+      parallelFor(size, [&](uint64_t i) {
+        _setSegmentID(output[i], ids[first + i]);
+      });
+      writer.write(output);
+    });
+    writer.close();
+
+    clest::println("Found {} clusters of at least {} points, holding {} "
+                   "of {} points, into {}",
+                   clusters, minSize, clustered, count, writer.filePath);
+  }
+
+  /// Extracts planes from `lasFile` with RANSAC, one plane at a time
+  ///
+  /// Each round draws `iterations` hypotheses in parallel. A hypothesis
+  /// is the plane through a random unlabeled seed and two unlabeled
+  /// points of its cell in a grid of side `cellSize`, since points that
+  /// close are likely to lie on the same surface. The hypotheses are then
+  /// scored in batches by `_scorePlanes` over the unlabeled points, kept
+  /// as single precision coordinate arrays relative to the header minimum
+  ///
+  /// The best plane is refitted to its inliers by principal component
+  /// analysis, and the points within `threshold` of it are labeled and
+  /// removed from the next rounds. The extraction stops when the best
+  /// plane has less than `minPoints` points
+  ///
+  /// Planes are numbered from 1 and the points of no plane get 0. The ID
+  /// is stored in the point source ID of the points, streamed to a file
+  /// tagged "planes"
+  template <int N>
+  void segmentPlanes(const LASFile<N> & lasFile,
+                     const double threshold,
+                     const double cellSize,
+                     const uint64_t minPoints,
+                     const unsigned int iterations) {
+    _validateLAS(lasFile, "segment planes");
+
+    if (N == -1) {
+      throw clest::Exception::build(
+        "Point format -1 of {} has no field for the plane IDs",
+        lasFile.filePath);
+    }
+
+    if (!(threshold > 0)) {
+      throw clest::Exception::build(
+        "The threshold {} is invalid and must be larger than zero", threshold);
+    }
+
+    if (!(cellSize > 0)) {
+      throw clest::Exception::build(
+        "The cell size {} is invalid and must be larger than zero", cellSize);
+    }
+
+    if (minPoints < 3) {
+      throw clest::Exception("A plane needs at least 3 points");
+    }
+
+    if (iterations == 0) {
+      throw clest::Exception("The number of iterations has to be greater "
+                             "than zero");
+    }
+
+    const uint64_t count = lasFile.pointDataCount();
+    if (count >= 0xFFFFFFFF) {
+      throw clest::Exception::build("{} has too many points to segment",
+                                    lasFile.filePath);
+    }
+
+    constexpr uint64_t CHUNK_SIZE = 4096;
+    constexpr int SAMPLE_TRIES = 16;
+
+    const PublicHeader & header = lasFile.publicHeader;
+    const double origin[3] = { header.minX, header.minY, header.minZ };
+    const double extent = std::max(header.maxX - header.minX,
+                                   std::max(header.maxY - header.minY,
+                                            header.maxZ - header.minZ));
+    if (extent / cellSize >= CELL_MASK) {
+      throw clest::Exception::build(
+        "The cell size {} is too small for an extent of {}", cellSize, extent);
+    }
+
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    _gatherReal(lasFile, origin, x, y, z);
+
+    // Points outside of the header bounds fall in the border cells
+    auto cellOf = [&](float value) {
+      double cell = std::floor(value / cellSize);
+      return std::min(cell > 0 ? static_cast<uint64_t>(cell) : 0, CELL_MASK);
+    };
+
+    std::vector<uint32_t> cellPoints;
+    std::vector<uint64_t> cells;
+    std::vector<uint32_t> starts;
+    _sortIntoCells(count, [&](uint64_t i) {
+      return (cellOf(x[i]) << (2 * CELL_BITS))
+        | (cellOf(y[i]) << CELL_BITS)
+        | cellOf(z[i]);
+    }, cellPoints, cells, starts);
+
+    std::vector<uint32_t> pointCell(count);
+    parallelFor(cells.size(), [&](uint64_t c) {
+      for (uint32_t i = starts[c]; i < starts[c + 1]; ++i) {
+        pointCell[cellPoints[i]] = static_cast<uint32_t>(c);
+      }
+    });
+    cells = std::vector<uint64_t>();
+
+    // The unlabeled points, compacted after every plane
+    std::vector<uint32_t> remaining(count);
+    parallelFor(count, [&](uint64_t i) {
+      remaining[i] = static_cast<uint32_t>(i);
+    });
+    std::vector<float> remainingX(x);
+    std::vector<float> remainingY(y);
+    std::vector<float> remainingZ(z);
+    std::vector<uint32_t> labels(count, 0);
+
+    auto distance = [&](uint64_t i, const double plane[4]) {
+      return std::fabs(plane[0] * remainingX[i] + plane[1] * remainingY[i]
+                       + plane[2] * remainingZ[i] + plane[3]);
+    };
+
+    auto countInliers = [&](const double plane[4]) {
+      return parallelReduce(remaining.size(), uint64_t(0),
+                            [&](uint64_t & sum, uint64_t i) {
+                              sum += distance(i, plane) <= threshold ? 1 : 0;
+                            },
+                            [](uint64_t & sum, const uint64_t & other) {
+                              sum += other;
+                            });
+    };
+
+    const uint64_t batches = (iterations + PLANE_BATCH - 1) / PLANE_BATCH;
+    std::vector<_PlaneBatch> candidates(batches);
+    uint32_t planes = 0;
+    uint64_t labeled = 0;
+
+    while (remaining.size() >= minPoints && planes < 0xFFFF) {
+      const uint64_t remainingCount = remaining.size();
+
+      parallelFor(batches * PLANE_BATCH, [&](uint64_t h) {
+        _PlaneBatch & batch = candidates[h / PLANE_BATCH];
+        const int slot = h % PLANE_BATCH;
+
+        // Invalid hypotheses get no inliers
+        batch.a[slot] = 0;
+        batch.b[slot] = 0;
+        batch.c[slot] = 0;
+        batch.d[slot] = std::numeric_limits<float>::max();
+        if (h >= iterations) {
+          return;
+        }
+
+        // Seeded per hypothesis, so the result does not depend on threads
+        std::mt19937 random(
+          static_cast<uint32_t>(planes * batches * PLANE_BATCH + h));
+        std::uniform_int_distribution<uint64_t> anyPoint(0, remainingCount - 1);
+        uint32_t picked[3] = { remaining[anyPoint(random)], 0, 0 };
+
+        const uint32_t cell = pointCell[picked[0]];
+        std::uniform_int_distribution<uint32_t> inCell(starts[cell],
+                                                       starts[cell + 1] - 1);
+        int found = 1;
+        for (int t = 0; t < SAMPLE_TRIES && found < 3; ++t) {
+          uint32_t candidate = cellPoints[inCell(random)];
+          if (labels[candidate] == 0
+              && candidate != picked[0]
+              && (found < 2 || candidate != picked[1])) {
+            picked[found++] = candidate;
+          }
+        }
+        if (found < 3) {
+          return;
+        }
+
+        double e1[3] = { x[picked[1]] - x[picked[0]],
+                         y[picked[1]] - y[picked[0]],
+                         z[picked[1]] - z[picked[0]] };
+        double e2[3] = { x[picked[2]] - x[picked[0]],
+                         y[picked[2]] - y[picked[0]],
+                         z[picked[2]] - z[picked[0]] };
+        double normal[3] = { e1[1] * e2[2] - e1[2] * e2[1],
+                             e1[2] * e2[0] - e1[0] * e2[2],
+                             e1[0] * e2[1] - e1[1] * e2[0] };
+        double norm = std::sqrt(normal[0] * normal[0]
+                                + normal[1] * normal[1]
+                                + normal[2] * normal[2]);
+        double lengths = std::sqrt(e1[0] * e1[0] + e1[1] * e1[1] + e1[2] * e1[2])
+          * std::sqrt(e2[0] * e2[0] + e2[1] * e2[1] + e2[2] * e2[2]);
+
+        // Skip collinear samples
+        if (!(norm > 1e-6 * lengths)) {
+          return;
+        }
+
+        batch.a[slot] = static_cast<float>(normal[0] / norm);
+        batch.b[slot] = static_cast<float>(normal[1] / norm);
+        batch.c[slot] = static_cast<float>(normal[2] / norm);
+        batch.d[slot] = static_cast<float>(
+          -(normal[0] * x[picked[0]] + normal[1] * y[picked[0]]
+            + normal[2] * z[picked[0]]) / norm);
+      });
+
+      using Scores = std::vector<uint64_t>;
+      const uint64_t chunks = (remainingCount + CHUNK_SIZE - 1) / CHUNK_SIZE;
+      const Scores scores = parallelReduce(
+        chunks,
+        Scores(batches * PLANE_BATCH, 0),
+        [&](Scores & value, uint64_t chunk) {
+          const uint64_t begin = chunk * CHUNK_SIZE;
+          const uint32_t size = static_cast<uint32_t>(
+            std::min(CHUNK_SIZE, remainingCount - begin));
+          for (uint64_t b = 0; b < batches; ++b) {
+            _scorePlanes(remainingX.data() + begin,
+                         remainingY.data() + begin,
+                         remainingZ.data() + begin,
+                         size,
+                         candidates[b],
+                         static_cast<float>(threshold),
+                         value.data() + b * PLANE_BATCH);
+          }
+        },
+        [](Scores & value, const Scores & other) {
+          for (size_t i = 0; i < value.size(); ++i) {
+            value[i] += other[i];
+          }
+        });
+
+      const uint64_t best =
+        std::max_element(scores.begin(), scores.end()) - scores.begin();
+      if (scores[best] < minPoints) {
+        break;
+      }
+
+      const _PlaneBatch & batch = candidates[best / PLANE_BATCH];
+      const int slot = best % PLANE_BATCH;
+      double plane[4] = { batch.a[slot], batch.b[slot],
+                          batch.c[slot], batch.d[slot] };
+
+      // Refit to the inliers, around their centroid
+      using Moments = std::array<double, 6>;
+      const Moments sums = parallelReduce(
+        remainingCount, Moments{},
+        [&](Moments & value, uint64_t i) {
+          if (distance(i, plane) <= threshold) {
+            value[0] += remainingX[i];
+            value[1] += remainingY[i];
+            value[2] += remainingZ[i];
+            value[3] += 1;
+          }
+        },
+        [](Moments & value, const Moments & other) {
+          for (size_t i = 0; i < value.size(); ++i) {
+            value[i] += other[i];
+          }
+        });
+      const double centroid[3] = { sums[0] / sums[3],
+                                   sums[1] / sums[3],
+                                   sums[2] / sums[3] };
+
+      const Moments covariance = parallelReduce(
+        remainingCount, Moments{},
+        [&](Moments & value, uint64_t i) {
+          if (distance(i, plane) <= threshold) {
+            double dx = remainingX[i] - centroid[0];
+            double dy = remainingY[i] - centroid[1];
+            double dz = remainingZ[i] - centroid[2];
+            value[0] += dx * dx;
+            value[1] += dx * dy;
+            value[2] += dx * dz;
+            value[3] += dy * dy;
+            value[4] += dy * dz;
+            value[5] += dz * dz;
+          }
+        },
+        [](Moments & value, const Moments & other) {
+          for (size_t i = 0; i < value.size(); ++i) {
+            value[i] += other[i];
+          }
+        });
+
+      float terms[6];
+      for (int i = 0; i < 6; ++i) {
+        terms[i] = static_cast<float>(covariance[i] / sums[3]);
+      }
+      float normal[3];
+      float curvature;
+      _normalsFromCovariances(terms, terms + 1, terms + 2,
+                              terms + 3, terms + 4, terms + 5,
+                              1, normal, normal + 1, normal + 2, &curvature);
+
+      const double refit[4] = {
+        normal[0], normal[1], normal[2],
+        -(normal[0] * centroid[0] + normal[1] * centroid[1]
+          + normal[2] * centroid[2]) };
+      if (countInliers(refit) >= minPoints) {
+        std::copy(refit, refit + 4, plane);
+      }
+
+      ++planes;
+      uint64_t kept = 0;
+      for (uint64_t i = 0; i < remainingCount; ++i) {
+        if (distance(i, plane) <= threshold) {
+          labels[remaining[i]] = planes;
+          continue;
+        }
+        remaining[kept] = remaining[i];
+        remainingX[kept] = remainingX[i];
+        remainingY[kept] = remainingY[i];
+        remainingZ[kept] = remainingZ[i];
+        ++kept;
+      }
+      remaining.resize(kept);
+      remainingX.resize(kept);
+      remainingY.resize(kept);
+      remainingZ.resize(kept);
+      labeled += remainingCount - kept;
+
+      clest::println("Plane {}: {} points, normal [{}, {}, {}], offset {}",
+                     planes, remainingCount - kept,
+                     plane[0], plane[1], plane[2],
+                     plane[3] - plane[0] * origin[0] - plane[1] * origin[1]
+                     - plane[2] * origin[2]);
+    }
+
+    LASWriter<N> writer(_generateName(lasFile.filePath, "planes"),
+                        lasFile.publicHeader,
+                        lasFile.recordHeaders);
+
+    std::vector<PointData<N>> output;
+    forEachBlock(lasFile, [&](const PointData<N> * points,
+                              uint64_t size,
+                              uint64_t first) {
+      output.assign(points, points + size);
+      parallelFor(size, [&](uint64_t i) {
+        _setSegmentID(output[i], labels[first + i]);
+      });
+      writer.write(output);
+    });
+    writer.close();
+
+    clest::println("Extracted {} planes holding {} of {} points into {}",
+                   planes, labeled, count, writer.filePath);
+  }
+
+  /// Aligns `source` to `target` with point to plane ICP and returns the
+  /// rigid transform, as a row major 4x4 matrix in real units
+  ///
+  /// The target is indexed once with a `SpatialIndex`, and its normals
+  /// are estimated as in `estimateNormals`. Every iteration matches each
+  /// transformed source point to its nearest target point in parallel,
+  /// skipping pairs farther than `maxDistance`, and accumulates the
+  /// linearized 6x6 normal equations in one `_ICPSums` per parallel
+  /// range. The solved increment is composed into the transform until it
+  /// vanishes or `iterations` are done
+  ///
+  /// The computations are relative to the minimum of the target header,
+  /// to keep their precision. The result is applied to `source` with
+  /// `transform`, requantized with its own scale and offset
+  template <int N>
+  std::array<double, 16> registerICP(const LASFile<N> & source,
+                                     const LASFile<N> & target,
+                                     const double maxDistance,
+                                     const unsigned int iterations) {
+    _validateLAS(source, "register LAS");
+    _validateLAS(target, "register LAS");
+
+    if (!(maxDistance > 0)) {
+      throw clest::Exception::build(
+        "The distance {} is invalid and must be larger than zero",
+        maxDistance);
+    }
+
+    if (iterations == 0) {
+      throw clest::Exception("The number of iterations has to be greater "
+                             "than zero");
+    }
+
+    constexpr unsigned int NORMAL_NEIGHBORS = 16;
+    constexpr double CONVERGENCE = 1e-9;
+
+    const PublicHeader & targetHeader = target.publicHeader;
+    const double scale[3] = { targetHeader.xScaleFactor,
+                              targetHeader.yScaleFactor,
+                              targetHeader.zScaleFactor };
+    const double offset[3] = { targetHeader.xOffset,
+                               targetHeader.yOffset,
+                               targetHeader.zOffset };
+    const double origin[3] = { targetHeader.minX,
+                               targetHeader.minY,
+                               targetHeader.minZ };
+
+    std::vector<uint32_t> x;
+    std::vector<uint32_t> y;
+    std::vector<uint32_t> z;
+    _gatherCoordinates(target, x, y, z);
+
+    const uint64_t targetCount = target.pointDataCount();
+    SpatialIndex index(x.data(), y.data(), z.data(), targetCount,
+                       scale[0], scale[1], scale[2]);
+
+    std::vector<float> normalX(targetCount);
+    std::vector<float> normalY(targetCount);
+    std::vector<float> normalZ(targetCount);
+    {
+      std::vector<float> curvature(targetCount);
+      _pointNormals(index, x, y, z, scale, NORMAL_NEIGHBORS,
+                    normalX.data(), normalY.data(), normalZ.data(),
+                    curvature.data());
+    }
+
+    const PublicHeader & sourceHeader = source.publicHeader;
+    const uint64_t sourceCount = source.pointDataCount();
+    std::vector<double> sourceX;
+    std::vector<double> sourceY;
+    std::vector<double> sourceZ;
+    _gatherReal(source, origin, sourceX, sourceY, sourceZ);
+
+    double rotation[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    double translation[3] = { 0, 0, 0 };
+    const double maxDistance2 = maxDistance * maxDistance;
+
+    for (unsigned int iteration = 0; iteration < iterations; ++iteration) {
+      const _ICPSums sums = parallelReduce(
+        sourceCount, _ICPSums(),
+        [&](_ICPSums & value, uint64_t i) {
+          const double point[3] = { sourceX[i], sourceY[i], sourceZ[i] };
+          double moved[3];
+          uint32_t query[3];
+          for (int row = 0; row < 3; ++row) {
+            moved[row] = rotation[row * 3] * point[0]
+              + rotation[row * 3 + 1] * point[1]
+              + rotation[row * 3 + 2] * point[2]
+              + translation[row];
+
+            double quantized = std::floor(
+              (moved[row] + origin[row] - offset[row]) / scale[row] + 0.5);
+            if (quantized < 0 || quantized > _QUANTIZED_MAX) {
+              return;
+            }
+            query[row] = static_cast<uint32_t>(quantized);
+          }
+
+          index.knn(query[0], query[1], query[2], 1, value.neighbors);
+          if (value.neighbors.empty()
+              || value.neighbors[0].distance2 > maxDistance2) {
+            return;
+          }
+
+          const uint32_t j = value.neighbors[0].index;
+          const double normal[3] = { normalX[j], normalY[j], normalZ[j] };
+          const double residual =
+            normal[0] * (moved[0] - (x[j] * scale[0] + offset[0] - origin[0]))
+            + normal[1] * (moved[1] - (y[j] * scale[1] + offset[1] - origin[1]))
+            + normal[2] * (moved[2] - (z[j] * scale[2] + offset[2] - origin[2]));
+
+          // Derivatives by the small rotation angles and the translation
+          const double J[6] = { moved[1] * normal[2] - moved[2] * normal[1],
+                                moved[2] * normal[0] - moved[0] * normal[2],
+                                moved[0] * normal[1] - moved[1] * normal[0],
+                                normal[0],
+                                normal[1],
+                                normal[2] };
+          value.add(J, residual);
+        },
+        [](_ICPSums & value, const _ICPSums & other) {
+          value.join(other);
+        });
+
+      if (sums.count < 6) {
+        throw clest::Exception::build(
+          "Only {} points of {} are within {} of {}",
+          sums.count, source.filePath, maxDistance, target.filePath);
+      }
+
+      clest::println("ICP iteration {}: {} pairs, RMS {}",
+                     iteration + 1, sums.count,
+                     std::sqrt(sums.error / sums.count));
+
+      double step[6];
+      if (!_solveICP(sums, step)) {
+        clest::println(stderr,
+                       "The overlap of {} and {} does not constrain the "
+                       "transform, stopping",
+                       source.filePath, target.filePath);
+        break;
+      }
+
+      double increment[9];
+      _eulerRotation(step[0], step[1], step[2], increment);
+
+      double composed[9];
+      double moved[3];
+      for (int row = 0; row < 3; ++row) {
+        for (int column = 0; column < 3; ++column) {
+          composed[row * 3 + column] =
+            increment[row * 3] * rotation[column]
+            + increment[row * 3 + 1] * rotation[3 + column]
+            + increment[row * 3 + 2] * rotation[6 + column];
+        }
+        moved[row] = increment[row * 3] * translation[0]
+          + increment[row * 3 + 1] * translation[1]
+          + increment[row * 3 + 2] * translation[2]
+          + step[3 + row];
+      }
+      std::copy(composed, composed + 9, rotation);
+      std::copy(moved, moved + 3, translation);
+
+      double change = 0;
+      for (int i = 0; i < 6; ++i) {
+        change = std::max(change, std::fabs(step[i]));
+      }
+      if (change < CONVERGENCE) {
+        break;
+      }
+    }
+
+    // Back to absolute coordinates: R (p - o) + t + o
+    std::array<double, 16> matrix{};
+    for (int row = 0; row < 3; ++row) {
+      matrix[row * 4 + 3] = translation[row] + origin[row];
+      for (int column = 0; column < 3; ++column) {
+        matrix[row * 4 + column] = rotation[row * 3 + column];
+        matrix[row * 4 + 3] -= rotation[row * 3 + column] * origin[column];
+      }
+    }
+    matrix[15] = 1;
+
+    clest::println("Transform: [{}, {}, {}, {}]\n"
+                   "           [{}, {}, {}, {}]\n"
+                   "           [{}, {}, {}, {}]",
+                   matrix[0], matrix[1], matrix[2], matrix[3],
+                   matrix[4], matrix[5], matrix[6], matrix[7],
+                   matrix[8], matrix[9], matrix[10], matrix[11]);
+
+    transform(source,
+              matrix,
+              { { sourceHeader.xScaleFactor,
+                  sourceHeader.yScaleFactor,
+                  sourceHeader.zScaleFactor } },
+              { { sourceHeader.xOffset,
+                  sourceHeader.yOffset,
+                  sourceHeader.zOffset } });
+
+    return matrix;
+  }
+
+  /// Detects the changes between two epochs of a survey, voxel by voxel
+  ///
+  /// Both files are streamed into `_VoxelSet`s of the voxels they occupy,
+  /// on a common grid of side `voxelSize` starting at the lowest corner
+  /// of their headers, with the keys inserted in parallel. Each file is
+  /// then streamed again and filtered against the voxels of the other:
+  /// the points of `before` in voxels that `after` left empty go to a
+  /// file tagged "removed", and the points of `after` in voxels that
+  /// `before` had empty go to a file tagged "added"
+  template <int N>
+  void diff(const LASFile<N> & before,
+            const LASFile<N> & after,
+            const double voxelSize) {
+    _validateLAS(before, "compare LAS");
+    _validateLAS(after, "compare LAS");
+
+    if (!(voxelSize > 0)) {
+      throw clest::Exception::build(
+        "The voxel size {} is invalid and must be larger than zero",
+        voxelSize);
+    }
+
+    const PublicHeader & first = before.publicHeader;
+    const PublicHeader & second = after.publicHeader;
+    const double origin[3] = { std::min(first.minX, second.minX),
+                               std::min(first.minY, second.minY),
+                               std::min(first.minZ, second.minZ) };
+    const double extent = std::max(
+      std::max(first.maxX, second.maxX) - origin[0],
+      std::max(std::max(first.maxY, second.maxY) - origin[1],
+               std::max(first.maxZ, second.maxZ) - origin[2]));
+    if (extent / voxelSize >= CELL_MASK) {
+      throw clest::Exception::build(
+        "The voxel size {} is too small for an extent of {}",
+        voxelSize, extent);
+    }
+
+    auto occupy = [&](const LASFile<N> & lasFile, _VoxelSet & voxels) {
+      forEachBlock(lasFile, [&](const PointData<N> * points,
+                                uint64_t count,
+                                uint64_t) {
+        voxels.reserve(count);
+        parallelFor(count, [&](uint64_t i) {
+          voxels.insert(_voxelKey(points[i], lasFile.publicHeader,
+                                  origin, voxelSize));
+        });
+      });
+    };
+
+    auto changes = [&](const LASFile<N> & lasFile,
+                       const _VoxelSet & other,
+                       const std::string & tag) {
+      LASWriter<N> writer(_generateName(lasFile.filePath, tag),
+                          lasFile.publicHeader,
+                          lasFile.recordHeaders);
+
+      parallelFilter(lasFile,
+                     [&](const PointData<N> & point, uint64_t) {
+                       return !other.contains(
+                         _voxelKey(point, lasFile.publicHeader,
+                                   origin, voxelSize));
+                     },
+                     [&](const std::vector<PointData<N>> & changed) {
+                       writer.write(changed);
+                     });
+      writer.close();
+
+      clest::println("{} {} of {} points into {}",
+                     tag == "added" ? "Added" : "Removed",
+                     writer.count(), lasFile.pointDataCount(),
+                     writer.filePath);
+    };
+
+    _VoxelSet beforeVoxels;
+    _VoxelSet afterVoxels;
+    occupy(before, beforeVoxels);
+    occupy(after, afterVoxels);
+
+    clest::println("Occupied voxels: {} before, {} after",
+                   beforeVoxels.size(), afterVoxels.size());
+
+    changes(before, afterVoxels, "removed");
+    changes(after, beforeVoxels, "added");
+  }
+
+  /// Extracts the points within a horizontal `distance` of `polyline`,
+  /// such as the corridor of a power line or a road, into a file tagged
+  /// "corridor"
+  ///
+  /// The file is streamed, so it is never loaded in full, and skipped
+  /// altogether when its bounds are out of reach. Each chunk of points is
+  /// only tested against the segments that can reach its bounds, which
+  /// rejects most chunks of files stored in flight line or tile order
+  template <int N>
+  void extractCorridor(const LASFile<N> & lasFile,
+                       const std::vector<std::array<double, 2>> & polyline,
+                       const double distance) {
+    _validateLAS(lasFile, "extract corridor");
+    const _Corridor corridor = _makeCorridor(polyline, distance);
+
+    const PublicHeader & header = lasFile.publicHeader;
+    LASWriter<N> writer(_generateName(lasFile.filePath, "corridor"),
+                        header,
+                        lasFile.recordHeaders);
+
+    if (corridor.overlaps(header.minX, header.minY,
+                          header.maxX, header.maxY)) {
+      BlockFilter<N> blockFilter;
+      forEachBlock(lasFile, [&](const PointData<N> * points,
+                                uint64_t count,
+                                uint64_t first) {
+        writer.write(blockFilter.filter(points, count, first,
+                                        [&](const PointData<N> * chunk,
+                                            uint64_t size,
+                                            uint64_t,
+                                            uint8_t * keep) {
+          corridor.mark(chunk, size, header, keep);
+        }));
+      });
+    }
+    writer.close();
+
+    clest::println("Extracted {} of {} points within {} of the polyline into {}",
+                   writer.count(), lasFile.pointDataCount(), distance,
+                   writer.filePath);
+  }
+
+  /// Same as above, but only reads the nodes of `octree`, built from
+  /// `lasFile` by `buildOctree`, whose cubes the corridor reaches. The
+  /// points are written in node order
+  template <int N>
+  void extractCorridor(const LASFile<N> & lasFile,
+                       const OctreeIndex & octree,
+                       const std::vector<std::array<double, 2>> & polyline,
+                       const double distance) {
+    _validateLAS(lasFile, "extract corridor");
+    const _Corridor corridor = _makeCorridor(polyline, distance);
+
+    const PublicHeader & header = lasFile.publicHeader;
+    if (octree.pointFormat != N
+        || octree.scale[0] != header.xScaleFactor
+        || octree.scale[1] != header.yScaleFactor
+        || octree.offset[0] != header.xOffset
+        || octree.offset[1] != header.yOffset) {
+      throw clest::Exception::build(
+        "The octree {} was not built from {}",
+        octree.dataPath, lasFile.filePath);
+    }
+
+    LASWriter<N> writer(_generateName(lasFile.filePath, "corridor"),
+                        header,
+                        lasFile.recordHeaders);
+
+    BlockFilter<N> blockFilter;
+    uint64_t nodesRead = 0;
+    for (const OctreeNode & node : octree.nodes) {
+      const double side = octree.size / (1u << node.level);
+      const double nodeMinX = octree.min[0] + node.x * side;
+      const double nodeMinY = octree.min[1] + node.y * side;
+      if (!corridor.overlaps(nodeMinX, nodeMinY,
+                             nodeMinX + side, nodeMinY + side)) {
+        continue;
+      }
+
+      std::vector<PointData<N>> points = octree.readNode<N>(node);
+      writer.write(blockFilter.filter(points.data(), points.size(), 0,
+                                      [&](const PointData<N> * chunk,
+                                          uint64_t size,
+                                          uint64_t,
+                                          uint8_t * keep) {
+        corridor.mark(chunk, size, header, keep);
+      }));
+      nodesRead++;
+    }
+    writer.close();
+
+    clest::println("Read {} of {} octree nodes", nodesRead, octree.nodes.size());
+    clest::println("Extracted {} of {} points within {} of the polyline into {}",
+                   writer.count(), lasFile.pointDataCount(), distance,
+                   writer.filePath);
   }
-#endif
 
 #ifdef CGAL_LINKED_WITH_TBB
-#define __DECLARE_TEMPLATES(index)\
-  template void simplify(const LASFile<index> & lasFile, const double factor);\
-  template void colorize(const LASFile<index> & lasFile);\
+#define __DECLARE_CGAL_TEMPLATES(index)\
   template void wlopParallel(const LASFile<index> & lasFile,\
                              const double percentage,\
                              const double radius,\
                              const unsigned int iterations,\
                              const bool uniform);
 #else
+#define __DECLARE_CGAL_TEMPLATES(index)
+#endif
+
 #define __DECLARE_TEMPLATES(index)\
   template void simplify(const LASFile<index> & lasFile, const double factor);\
-  template void colorize(const LASFile<index> & lasFile);
-#endif
+  template void colorize(const LASFile<index> & lasFile);\
+  template void wlopFloat(const LASFile<index> & lasFile,\
+                          const double percentage,\
+                          const double radius,\
+                          const unsigned int iterations,\
+                          const bool uniform,\
+                          const double epsilon);\
+  template void wlopTiled(const LASFile<index> & lasFile,\
+                          const double percentage,\
+                          const double radius,\
+                          const unsigned int iterations,\
+                          const bool uniform,\
+                          const double tileSize,\
+                          const uint64_t memoryBudget,\
+                          const double epsilon);\
+  template void wlopOpenCL(const LASFile<index> & lasFile,\
+                           clest::ClRunner & runner,\
+                           const double percentage,\
+                           const double radius,\
+                           const unsigned int iterations,\
+                           const bool uniform);\
+  template void removeOutliers(const LASFile<index> & lasFile,\
+                               const unsigned int k,\
+                               const double stddevMultiplier);\
+  template void estimateNormals(const LASFile<index> & lasFile,\
+                                const unsigned int k);\
+  template void dedupe(const LASFile<index> & lasFile,\
+                       const double epsilon,\
+                       const bool useTime);\
+  template void dedupeStreamed(const LASFile<index> & lasFile,\
+                               const uint64_t memoryBudget,\
+                               const bool useTime);\
+  template void transform(const LASFile<index> & lasFile,\
+                          const std::array<double, 16> & matrix,\
+                          const std::array<double, 3> & newScale,\
+                          const std::array<double, 3> & newOffset);\
+  template void cluster(const LASFile<index> & lasFile,\
+                        const double radius,\
+                        const uint64_t minSize);\
+  template void segmentPlanes(const LASFile<index> & lasFile,\
+                              const double threshold,\
+                              const double cellSize,\
+                              const uint64_t minPoints,\
+                              const unsigned int iterations);\
+  template std::array<double, 16> registerICP(const LASFile<index> & source,\
+                                              const LASFile<index> & target,\
+                                              const double maxDistance,\
+                                              const unsigned int iterations);\
+  template void diff(const LASFile<index> & before,\
+                     const LASFile<index> & after,\
+                     const double voxelSize);\
+  template void extractCorridor(\
+    const LASFile<index> & lasFile,\
+    const std::vector<std::array<double, 2>> & polyline,\
+    const double distance);\
+  template void extractCorridor(\
+    const LASFile<index> & lasFile,\
+    const OctreeIndex & octree,\
+    const std::vector<std::array<double, 2>> & polyline,\
+    const double distance);\
+  __DECLARE_CGAL_TEMPLATES(index)
 
   __DECLARE_TEMPLATES(-1)
   __DECLARE_TEMPLATES(0)
@@ -460,5 +3451,6 @@ namespace las {
   __DECLARE_TEMPLATES(2)
   __DECLARE_TEMPLATES(3)
 #undef __DECLARE_TEMPLATES
+#undef __DECLARE_CGAL_TEMPLATES
 
 }
\ No newline at end of file
@@ -1,14 +1,107 @@
 #pragma once
 
+#include <array>
+#include <vector>
+
 #include "las_file.hpp"
 
+namespace clest {
+  class ClRunner;
+}
+
 namespace las {
+  class OctreeIndex;
+
   template <int N>
   void colorize(const LASFile<N> & lasFile);
 
   template <int N>
   void simplify(const LASFile<N> & lasFile, const double factor);
 
+  template <int N>
+  void wlopFloat(const LASFile<N> & lasFile,
+                 const double percentage,
+                 const double radius,
+                 const unsigned int iterations,
+                 const bool uniform,
+                 const double epsilon = 0);
+
+  template <int N>
+  void wlopTiled(const LASFile<N> & lasFile,
+                 const double percentage,
+                 const double radius,
+                 const unsigned int iterations,
+                 const bool uniform,
+                 const double tileSize,
+                 const uint64_t memoryBudget,
+                 const double epsilon = 0);
+
+  template <int N>
+  void wlopOpenCL(const LASFile<N> & lasFile,
+                  clest::ClRunner & runner,
+                  const double percentage,
+                  const double radius,
+                  const unsigned int iterations,
+                  const bool uniform);
+
+  template <int N>
+  void removeOutliers(const LASFile<N> & lasFile,
+                      const unsigned int k,
+                      const double stddevMultiplier);
+
+  template <int N>
+  void estimateNormals(const LASFile<N> & lasFile, const unsigned int k);
+
+  template <int N>
+  void dedupe(const LASFile<N> & lasFile,
+              const double epsilon = 0,
+              const bool useTime = false);
+
+  template <int N>
+  void dedupeStreamed(const LASFile<N> & lasFile,
+                      const uint64_t memoryBudget,
+                      const bool useTime = false);
+
+  template <int N>
+  void transform(const LASFile<N> & lasFile,
+                 const std::array<double, 16> & matrix,
+                 const std::array<double, 3> & newScale,
+                 const std::array<double, 3> & newOffset);
+
+  template <int N>
+  void cluster(const LASFile<N> & lasFile,
+               const double radius,
+               const uint64_t minSize);
+
+  template <int N>
+  void segmentPlanes(const LASFile<N> & lasFile,
+                     const double threshold,
+                     const double cellSize,
+                     const uint64_t minPoints,
+                     const unsigned int iterations);
+
+  template <int N>
+  std::array<double, 16> registerICP(const LASFile<N> & source,
+                                     const LASFile<N> & target,
+                                     const double maxDistance,
+                                     const unsigned int iterations);
+
+  template <int N>
+  void diff(const LASFile<N> & before,
+            const LASFile<N> & after,
+            const double voxelSize);
+
+  template <int N>
+  void extractCorridor(const LASFile<N> & lasFile,
+                       const std::vector<std::array<double, 2>> & polyline,
+                       const double distance);
+
+  template <int N>
+  void extractCorridor(const LASFile<N> & lasFile,
+                       const OctreeIndex & octree,
+                       const std::vector<std::array<double, 2>> & polyline,
+                       const double distance);
+
 #ifdef CGAL_LINKED_WITH_TBB
   template <int N>
   void wlopParallel(const LASFile<N> & lasFile,
@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <cstring>
+
+#include <clest/util.hpp>
+#include <clest/ostream.hpp>
+
+#include "las_stream.hpp"
+
+namespace {
+
+  /// Makes sure the file name is unique and not already taken
+  /// Returns the same string, adjusted if necessary
+  std::string _guaranteeNewFile(std::string file) {
+    clest::guaranteeNewFile(file, "las");
+    return file;
+  }
+}
+
+namespace las {
+
+  /// Opens the file and seeks to the point data
+  /// The headers of `lasFile` must have been loaded
+  template <int N>
+  LASReader<N>::LASReader(const LASFile<N> & lasFile) :
+    mStream(lasFile.filePath, std::ifstream::in | std::ifstream::binary),
+    mTypeSize(lasFile.publicHeader.pointDataRecordLength),
+    mCount(lasFile.pointDataCount()) {
+    if (!mStream.is_open()) {
+      throw clest::Exception::build("Could not open file {}",
+                                    lasFile.filePath);
+    }
+
+    if (mTypeSize == 0) {
+      throw clest::Exception::build("Invalid point record length in {}",
+                                    lasFile.filePath);
+    }
+
+    mStream.seekg(lasFile.publicHeader.offsetToPointData);
+  }
+
+  template <int N>
+  uint64_t LASReader<N>::read(std::vector<PointData<N>> & buffer,
+                              uint64_t max) {
+    uint64_t count = std::min(max, mCount - mPosition);
+    buffer.resize(count);
+
+    if (count == 0 || !mStream.good()) {
+      buffer.clear();
+      return 0;
+    }
+
+    // Read straight into the buffer when the layouts match
+    if (mTypeSize == sizeof(PointData<N>)) {
+      mStream.read(reinterpret_cast<char*>(buffer.data()),
+                   count * sizeof(PointData<N>));
+    } else {
+      mRaw.resize(count * mTypeSize);
+      mStream.read(mRaw.data(), mRaw.size());
+
+      // Copy the common prefix of each record and zero the remainder
+      size_t common = std::min<size_t>(mTypeSize, sizeof(PointData<N>));
+      for (uint64_t i = 0; i < count; ++i) {
+        char * target = reinterpret_cast<char*>(&buffer[i]);
+        std::memcpy(target, mRaw.data() + i * mTypeSize, common);
+        std::memset(target + common, 0, sizeof(PointData<N>) - common);
+      }
+    }
+
+    // Drop whatever could not be read from a truncated file
+    uint64_t read = static_cast<uint64_t>(mStream.gcount())
+      / (mTypeSize == sizeof(PointData<N>) ? sizeof(PointData<N>) : mTypeSize);
+    buffer.resize(read);
+    mPosition += read;
+    if (read < count) {
+      mPosition = mCount;
+    }
+
+    return read;
+  }
+
+  /// Writes the headers, adjusting the record format, length and the
+  /// offset to the point data to match `PointData<N>`
+  ///
+  /// If the file already exists, it will append a ".new" before the extension
+  template <int N>
+  LASWriter<N>::LASWriter(std::string file,
+                          const PublicHeader & publicHeader,
+                          const std::vector<RecordHeader> & recordHeaders) :
+    filePath(_guaranteeNewFile(std::move(file))),
+    mStream(filePath, std::ofstream::out | std::ofstream::binary),
+    mHeader(publicHeader) {
+    if (!mStream.is_open()) {
+      throw clest::Exception::build("Could not open file {}", filePath);
+    }
+
+    // Only the coordinates of the generic format are known, so they are
+    // written as format 0 points with the other fields cleared
+    mHeader.pointDataRecordFormat = static_cast<uint8_t>(N >= 0 ? N : 0);
+    mHeader.pointDataRecordLength =
+      N >= 0 ? sizeof(PointData<N>) : sizeof(PointData<0>);
+    mHeader.numberOfVariableLengthRecords =
+      static_cast<uint32_t>(recordHeaders.size());
+
+    uint32_t offset = mHeader.headerSize;
+    for (auto & header : recordHeaders) {
+      offset += RecordHeader::RAW_SIZE + header.recordLengthAfterHeader;
+    }
+    mHeader.offsetToPointData = offset;
+
+    // Write the public header directly, based on `headerSize`
+    mStream.write(reinterpret_cast<const char*>(&mHeader), mHeader.headerSize);
+
+    // Iterate the veriable length records and write them directly
+    for (auto & header : recordHeaders) {
+      mStream.write(reinterpret_cast<const char*>(&header),
+                    RecordHeader::RAW_SIZE);
+      mStream.write(header.data.data(), header.recordLengthAfterHeader);
+    }
+  }
+
+  template <int N>
+  LASWriter<N>::~LASWriter() {
+    try {
+      close();
+    } catch (...) {
+    }
+  }
+
+  template <int N>
+  void LASWriter<N>::write(const PointData<N> * points, uint64_t count) {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if (!mStream.is_open()) {
+      throw clest::Exception::build("Writing to closed file {}", filePath);
+    }
+
+    for (uint64_t i = 0; i < count; ++i) {
+      mLimits.update(points[i].x, points[i].y, points[i].z);
+    }
+
+    if (N >= 0) {
+      mStream.write(reinterpret_cast<const char*>(points),
+                    count * sizeof(PointData<N>));
+    } else {
+      std::vector<PointData<0>> padded(count);
+      for (uint64_t i = 0; i < count; ++i) {
+        padded[i].x = points[i].x;
+        padded[i].y = points[i].y;
+        padded[i].z = points[i].z;
+      }
+      mStream.write(reinterpret_cast<const char*>(padded.data()),
+                    count * sizeof(PointData<0>));
+    }
+    mCount += count;
+  }
+
+  /// Patches the point count and the bounds into the public header, and
+  /// clears the counts by return
+  template <int N>
+  void LASWriter<N>::close() {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if (!mStream.is_open()) {
+      return;
+    }
+
+    mHeader.legacyNumberOfPointRecords =
+      mCount > 0xFFFFFFFF ? 0 : static_cast<uint32_t>(mCount);
+    mHeader.numberOfPointRecords = mCount;
+
+    // The returns of the written points are not tracked
+    mHeader.legacyNumberOfPointRecordsByReturn.fill(0);
+    mHeader.numberOfPointsByReturn.fill(0);
+
+    if (mCount > 0) {
+      mHeader.minX = mLimits.minX * mHeader.xScaleFactor + mHeader.xOffset;
+      mHeader.maxX = mLimits.maxX * mHeader.xScaleFactor + mHeader.xOffset;
+      mHeader.minY = mLimits.minY * mHeader.yScaleFactor + mHeader.yOffset;
+      mHeader.maxY = mLimits.maxY * mHeader.yScaleFactor + mHeader.yOffset;
+      mHeader.minZ = mLimits.minZ * mHeader.zScaleFactor + mHeader.zOffset;
+      mHeader.maxZ = mLimits.maxZ * mHeader.zScaleFactor + mHeader.zOffset;
+    }
+
+    mStream.seekp(0);
+    mStream.write(reinterpret_cast<const char*>(&mHeader), mHeader.headerSize);
+    mStream.close();
+  }
+
+#define __DECLARE_TEMPLATES(index)\
+  template class LASReader<index>;\
+  template class LASWriter<index>;
+
+  __DECLARE_TEMPLATES(-1)
+  __DECLARE_TEMPLATES(0)
+  __DECLARE_TEMPLATES(1)
+  __DECLARE_TEMPLATES(2)
+  __DECLARE_TEMPLATES(3)
+#undef __DECLARE_TEMPLATES
+
+}
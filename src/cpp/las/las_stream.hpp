@@ -0,0 +1,73 @@
+#pragma once
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "las_file.hpp"
+
+namespace las {
+
+  /// Sequential chunked reader over the point data of a LAS file
+  ///
+  /// Only the headers of `lasFile` are used, so the points never need
+  /// to be fully resident. Records are copied field by field up to
+  /// `sizeof(PointData<N>)`, so files with extra bytes or with a
+  /// different record length can be read as any `PointData<N>`
+  template <int N>
+  class LASReader {
+  public:
+    LASReader(const LASFile<N> & lasFile);
+
+    /// Reads up to `max` points into `buffer`, replacing its contents
+    /// Returns the number of points read; zero when the end is reached
+    uint64_t read(std::vector<PointData<N>> & buffer, uint64_t max);
+
+    /// Index of the next point to be read
+    uint64_t position() const { return mPosition; }
+    bool done() const { return mPosition >= mCount; }
+
+  private:
+    std::ifstream mStream;
+    const uint16_t mTypeSize;
+    const uint64_t mCount;
+    uint64_t mPosition = 0;
+    std::vector<char> mRaw;
+  };
+
+  /// Streaming writer for LAS files
+  ///
+  /// The headers are written on construction and the points are appended
+  /// as they arrive. `write` is thread safe, so parallel producers can
+  /// share a writer. The point count and the bounds of the public header
+  /// are patched on `close`, which is also called on destruction
+  template <int N>
+  class LASWriter {
+  public:
+    LASWriter(std::string file,
+              const PublicHeader & publicHeader,
+              const std::vector<RecordHeader> & recordHeaders);
+    ~LASWriter();
+
+    LASWriter(const LASWriter &) = delete;
+    LASWriter & operator=(const LASWriter &) = delete;
+
+    void write(const PointData<N> * points, uint64_t count);
+    void write(const std::vector<PointData<N>> & points) {
+      write(points.data(), points.size());
+    }
+    void close();
+
+    uint64_t count() const { return mCount; }
+
+    const std::string filePath;
+
+  private:
+    std::mutex mMutex;
+    std::ofstream mStream;
+    PublicHeader mHeader;
+    Limits<uint32_t> mLimits;
+    uint64_t mCount = 0;
+  };
+}
@@ -0,0 +1,625 @@
+#include "octree.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <unordered_set>
+
+#include <clest/util.hpp>
+#include <clest/ostream.hpp>
+
+#include "parallel.hpp"
+
+namespace {
+
+  /// Level of the grid that counts the points to choose the tiles
+  constexpr int COUNT_LEVEL = 6;
+  constexpr uint32_t COUNT_SIZE = 1 << COUNT_LEVEL;
+
+  /// Deepest level; nodes at this level keep all their points
+  constexpr uint8_t MAX_LEVEL = 20;
+
+  /// Bits per axis of a packed sampling cell
+  constexpr int CELL_BITS = 21;
+  constexpr uint64_t CELL_MASK = (1ull << CELL_BITS) - 1;
+
+  /// Position of a node in the octree
+  struct _NodeKey {
+    uint8_t level;
+    uint32_t x;
+    uint32_t y;
+    uint32_t z;
+
+    bool operator<(const _NodeKey & other) const {
+      return std::tie(level, x, y, z)
+        < std::tie(other.level, other.x, other.y, other.z);
+    }
+
+    _NodeKey parent() const {
+      return { static_cast<uint8_t>(level - 1), x >> 1, y >> 1, z >> 1 };
+    }
+
+    _NodeKey child(int octant) const {
+      return { static_cast<uint8_t>(level + 1),
+               (x << 1) | (octant & 1),
+               (y << 1) | ((octant >> 1) & 1),
+               (z << 1) | ((octant >> 2) & 1) };
+    }
+
+    int octant() const {
+      return (x & 1) | ((y & 1) << 1) | ((z & 1) << 2);
+    }
+  };
+
+  /// Points of a node waiting for its ancestors to sample them
+  template <int N>
+  struct _PendingNode {
+    std::vector<las::PointData<N>> points;
+    bool hasChildren;
+  };
+
+  /// Builds the nodes and appends their chunks to the data file
+  ///
+  /// `emit` may be called concurrently by the tiles
+  template <int N>
+  class _OctreeBuilder {
+  public:
+    _OctreeBuilder(const las::OctreeIndex & index,
+                   uint32_t maxNodePoints) :
+      mIndex(index),
+      mMaxNodePoints(maxNodePoints),
+      mStream(index.dataPath, std::ofstream::binary) {
+      if (!mStream.is_open()) {
+        throw clest::Exception::build("Could not open file {}",
+                                      index.dataPath);
+      }
+    }
+
+    double real(const las::PointData<N> & point, int axis) const {
+      const uint32_t value = axis == 0 ? point.x : axis == 1 ? point.y : point.z;
+      return value * mIndex.scale[axis] + mIndex.offset[axis];
+    }
+
+    /// Cell of `point` at `level` of a regular grid over the root cube
+    /// Points outside of the header bounds fall in the border cells
+    uint32_t cellOf(const las::PointData<N> & point,
+                    int axis,
+                    uint8_t level) const {
+      const double cells = std::ldexp(1.0, level);
+      const double cell =
+        std::floor((real(point, axis) - mIndex.min[axis]) / mIndex.size * cells);
+      return static_cast<uint32_t>(std::min(std::max(cell, 0.0), cells - 1));
+    }
+
+    /// Moves the first point of every free sampling cell of `key` from
+    /// `points` to `selected`, marking the cell in `taken`
+    void sample(const _NodeKey & key,
+                std::vector<las::PointData<N>> & points,
+                std::vector<las::PointData<N>> & selected,
+                std::unordered_set<uint64_t> & taken) const {
+      const double nodeSize = std::ldexp(mIndex.size, -key.level);
+      const double cellSize = std::ldexp(mIndex.spacing, -key.level);
+      const double origin[3] = { mIndex.min[0] + key.x * nodeSize,
+                                 mIndex.min[1] + key.y * nodeSize,
+                                 mIndex.min[2] + key.z * nodeSize };
+
+      std::vector<las::PointData<N>> rest;
+      for (auto & point : points) {
+        uint64_t cell = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+          double value = std::floor((real(point, axis) - origin[axis])
+                                    / cellSize);
+          uint64_t clamped = value > 0 ? static_cast<uint64_t>(value) : 0;
+          cell = (cell << CELL_BITS) | std::min(clamped, CELL_MASK);
+        }
+
+        if (taken.insert(cell).second) {
+          selected.push_back(point);
+        } else {
+          rest.push_back(point);
+        }
+      }
+      points.swap(rest);
+    }
+
+    /// Builds the subtree of `key` from `points`, emitting every node
+    /// below `key`. On return, `points` holds the points of `key` itself
+    /// Returns whether `key` has children
+    bool buildSubtree(const _NodeKey & key,
+                      std::vector<las::PointData<N>> & points) {
+      if (points.size() <= mMaxNodePoints || key.level >= MAX_LEVEL) {
+        return false;
+      }
+
+      std::vector<las::PointData<N>> selected;
+      std::unordered_set<uint64_t> taken;
+      sample(key, points, selected, taken);
+
+      std::vector<las::PointData<N>> children[8];
+      for (auto & point : points) {
+        int octant = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+          octant |= (cellOf(point, axis, key.level + 1) & 1) << axis;
+        }
+        children[octant].push_back(point);
+      }
+      points.swap(selected);
+      selected = std::vector<las::PointData<N>>();
+
+      bool hasChildren = false;
+      for (int octant = 0; octant < 8; ++octant) {
+        if (children[octant].empty()) {
+          continue;
+        }
+
+        const _NodeKey child = key.child(octant);
+        buildSubtree(child, children[octant]);
+        emit(child, children[octant]);
+        children[octant] = std::vector<las::PointData<N>>();
+        hasChildren = true;
+      }
+
+      return hasChildren;
+    }
+
+    /// Appends the chunk of `key` to the data file
+    void emit(const _NodeKey & key,
+              const std::vector<las::PointData<N>> & points) {
+      std::lock_guard<std::mutex> lock(mMutex);
+
+      las::OctreeNode node{};
+      node.level = key.level;
+      node.x = key.x;
+      node.y = key.y;
+      node.z = key.z;
+      node.offset = mOffset;
+      node.count = points.size();
+      mNodes.push_back(node);
+
+      mStream.write(reinterpret_cast<const char*>(points.data()),
+                    points.size() * sizeof(las::PointData<N>));
+      mOffset += points.size() * sizeof(las::PointData<N>);
+    }
+
+    /// Closes the data file and returns the nodes sorted, with their
+    /// child masks
+    std::vector<las::OctreeNode> finish() {
+      mStream.close();
+
+      std::sort(mNodes.begin(), mNodes.end(),
+                [](const las::OctreeNode & a, const las::OctreeNode & b) {
+        return std::tie(a.level, a.x, a.y, a.z)
+          < std::tie(b.level, b.x, b.y, b.z);
+      });
+
+      std::map<_NodeKey, size_t> positions;
+      for (size_t i = 0; i < mNodes.size(); ++i) {
+        positions[{ mNodes[i].level, mNodes[i].x, mNodes[i].y, mNodes[i].z }] = i;
+      }
+      for (auto & node : mNodes) {
+        if (node.level == 0) {
+          continue;
+        }
+        const _NodeKey key{ node.level, node.x, node.y, node.z };
+        auto parent = positions.find(key.parent());
+        if (parent != positions.end()) {
+          mNodes[parent->second].childMask |=
+            static_cast<uint8_t>(1 << key.octant());
+        }
+      }
+
+      return std::move(mNodes);
+    }
+
+  private:
+    const las::OctreeIndex & mIndex;
+    const uint32_t mMaxNodePoints;
+
+    std::mutex mMutex;
+    std::ofstream mStream;
+    uint64_t mOffset = 0;
+    std::vector<las::OctreeNode> mNodes;
+  };
+
+  /// Reads back the `count` points spilled to `path` and removes the file
+  template <int N>
+  std::vector<las::PointData<N>> _loadSpill(const std::string & path,
+                                            uint64_t count) {
+    std::vector<las::PointData<N>> points(count);
+    std::ifstream fileStream(path, std::ifstream::binary);
+    if (!fileStream.is_open()) {
+      throw clest::Exception::build("Could not open file {}", path);
+    }
+    fileStream.read(reinterpret_cast<char*>(points.data()),
+                    count * sizeof(las::PointData<N>));
+    fileStream.close();
+    std::remove(path.c_str());
+    return points;
+  }
+}
+
+namespace las {
+
+  /// Saves the header followed by the nodes
+  /// If the file already exists, it will append a ".new" before the extension
+  void OctreeIndex::save(std::string path) const {
+    clest::guaranteeNewFile(path, "octree");
+
+    std::ofstream fileStream(path, std::ofstream::binary);
+
+    if (!fileStream.is_open()) {
+      throw clest::Exception::build("Could not open file {}", path);
+    }
+
+    OctreeHeader header;
+    header.pointFormat = pointFormat;
+    header.recordLength = recordLength;
+    std::copy(scale, scale + 3, header.scale);
+    std::copy(offset, offset + 3, header.offset);
+    std::copy(min, min + 3, header.min);
+    header.size = size;
+    header.spacing = spacing;
+    header.nodeCount = nodes.size();
+    fileStream.write(reinterpret_cast<const char*>(&header),
+                     sizeof(OctreeHeader));
+    fileStream.write(reinterpret_cast<const char*>(nodes.data()),
+                     nodes.size() * sizeof(OctreeNode));
+
+    fileStream.close();
+  }
+
+  /// Load the index from file
+  /// Integrity will be checked with regards to the values of the header
+  void OctreeIndex::load(const std::string & path) {
+    std::ifstream fileStream(path, std::ifstream::binary);
+
+    if (!fileStream.is_open()) {
+      throw clest::Exception::build("Could not open file {}\n", path);
+    }
+
+    OctreeHeader expected;
+    OctreeHeader header;
+    fileStream.read(reinterpret_cast<char*>(&header), sizeof(OctreeHeader));
+
+    if (!fileStream.good()
+        || std::memcmp(header.signature, expected.signature, 4) != 0) {
+      throw clest::Exception::build("The file {} seems to be corrupted", path);
+    }
+
+    dataPath = path + ".bin";
+    pointFormat = header.pointFormat;
+    recordLength = header.recordLength;
+    std::copy(header.scale, header.scale + 3, scale);
+    std::copy(header.offset, header.offset + 3, offset);
+    std::copy(header.min, header.min + 3, min);
+    size = header.size;
+    spacing = header.spacing;
+
+    nodes.resize(header.nodeCount);
+    fileStream.read(reinterpret_cast<char*>(nodes.data()),
+                    nodes.size() * sizeof(OctreeNode));
+
+    if (!fileStream.good()) {
+      throw clest::Exception::build("The file {} seems to be truncated", path);
+    }
+
+    fileStream.close();
+  }
+
+  template <int N>
+  std::vector<PointData<N>> OctreeIndex::readNode(const OctreeNode & node) const {
+    if (pointFormat != N || recordLength != sizeof(PointData<N>)) {
+      throw clest::Exception::build(
+        "The octree of {} holds format {}, not {}", dataPath, pointFormat, N);
+    }
+
+    std::ifstream fileStream(dataPath, std::ifstream::binary);
+    if (!fileStream.is_open()) {
+      throw clest::Exception::build("Could not open file {}", dataPath);
+    }
+
+    std::vector<PointData<N>> points(node.count);
+    fileStream.seekg(node.offset);
+    fileStream.read(reinterpret_cast<char*>(points.data()),
+                    node.count * sizeof(PointData<N>));
+
+    if (!fileStream.good()) {
+      throw clest::Exception::build("The file {} seems to be truncated",
+                                    dataPath);
+    }
+
+    return points;
+  }
+
+  /// The build runs in three steps:
+  ///
+  /// - A streaming pass counts the points in a 64^3 grid over the root
+  ///   cube, and the octree is cut top down into tiles: the shallowest
+  ///   nodes whose points fit the memory budget
+  /// - A second pass spills every point to its tile, and the tiles are
+  ///   built in parallel, in waves that fit the budget. Each tile splits
+  ///   recursively, keeping one point per sampling cell of its level and
+  ///   passing the rest down to its children
+  /// - The nodes above the tiles are built bottom up, each sampling its
+  ///   points from the points of its children, which are then final
+  template <int N>
+  void buildOctree(const LASFile<N> & lasFile,
+                   double spacing,
+                   uint32_t maxNodePoints,
+                   uint64_t memoryBudget) {
+    if (!lasFile.isValid() || lasFile.pointDataCount() < 1) {
+      throw clest::Exception::build(
+        "Trying to build an octree, but {} seems to be corrupted or empty",
+        lasFile.filePath);
+    }
+
+    if (maxNodePoints == 0) {
+      throw clest::Exception("The node capacity has to be greater than zero");
+    }
+
+    // Estimated peak memory per point of a tile: the points, their split
+    // into the children, the samples and the sampling cells
+    constexpr uint64_t BYTES_PER_POINT = 3 * sizeof(PointData<N>) + 32;
+    constexpr uint64_t SPILL_SIZE = 1 << 12;
+
+    const PublicHeader & header = lasFile.publicHeader;
+
+    OctreeIndex index;
+    index.pointFormat = static_cast<int8_t>(N);
+    index.recordLength = sizeof(PointData<N>);
+    index.scale[0] = header.xScaleFactor;
+    index.scale[1] = header.yScaleFactor;
+    index.scale[2] = header.zScaleFactor;
+    index.offset[0] = header.xOffset;
+    index.offset[1] = header.yOffset;
+    index.offset[2] = header.zOffset;
+    index.min[0] = header.minX;
+    index.min[1] = header.minY;
+    index.min[2] = header.minZ;
+    index.size = std::max(header.maxX - header.minX,
+                          std::max(header.maxY - header.minY,
+                                   header.maxZ - header.minZ));
+    if (!(index.size > 0)) {
+      index.size = std::max(header.xScaleFactor,
+                            std::max(header.yScaleFactor, header.zScaleFactor));
+    }
+    index.spacing = spacing > 0 ? spacing : index.size / 128;
+
+    if (index.size / index.spacing >= CELL_MASK) {
+      throw clest::Exception::build(
+        "The spacing {} is too small for a cube of {}",
+        index.spacing, index.size);
+    }
+
+    std::string indexPath =
+      lasFile.filePath.substr(0, lasFile.filePath.rfind(".las")) + ".octree";
+    clest::guaranteeNewFile(indexPath, "octree");
+    index.dataPath = indexPath + ".bin";
+
+    _OctreeBuilder<N> builder(index, maxNodePoints);
+
+    auto countCell = [&](const PointData<N> & point) {
+      return (builder.cellOf(point, 0, COUNT_LEVEL) * COUNT_SIZE
+              + builder.cellOf(point, 1, COUNT_LEVEL)) * COUNT_SIZE
+        + builder.cellOf(point, 2, COUNT_LEVEL);
+    };
+
+    // Count the points of every node down to `COUNT_LEVEL`
+    std::vector<std::vector<uint64_t>> counts(COUNT_LEVEL + 1);
+    counts[COUNT_LEVEL].assign(COUNT_SIZE * COUNT_SIZE * COUNT_SIZE, 0);
+    std::vector<uint32_t> cells;
+    forEachBlock(lasFile, [&](const PointData<N> * points,
+                              uint64_t count,
+                              uint64_t) {
+      cells.resize(count);
+      parallelFor(count, [&](uint64_t i) {
+        cells[i] = countCell(points[i]);
+      });
+      for (auto cell : cells) {
+        counts[COUNT_LEVEL][cell]++;
+      }
+    });
+
+    for (int level = COUNT_LEVEL - 1; level >= 0; --level) {
+      const uint32_t size = 1 << level;
+      counts[level].assign(size * size * size, 0);
+      for (uint32_t x = 0; x < 2 * size; ++x) {
+        for (uint32_t y = 0; y < 2 * size; ++y) {
+          for (uint32_t z = 0; z < 2 * size; ++z) {
+            counts[level][((x >> 1) * size + (y >> 1)) * size + (z >> 1)] +=
+              counts[level + 1][(x * 2 * size + y) * 2 * size + z];
+          }
+        }
+      }
+    }
+
+    auto countOf = [&](const _NodeKey & key) {
+      const uint32_t size = 1 << key.level;
+      return counts[key.level][(key.x * size + key.y) * size + key.z];
+    };
+
+    // Cut the tiles top down; the nodes above them are the ancestors
+    const uint64_t tilePoints = std::max<uint64_t>(
+      1, memoryBudget / BYTES_PER_POINT);
+    std::vector<_NodeKey> tiles;
+    std::vector<_NodeKey> ancestors;
+    std::vector<_NodeKey> stack{ { 0, 0, 0, 0 } };
+    while (!stack.empty()) {
+      const _NodeKey key = stack.back();
+      stack.pop_back();
+
+      if (countOf(key) == 0) {
+        continue;
+      }
+      if (countOf(key) <= tilePoints || key.level == COUNT_LEVEL) {
+        tiles.push_back(key);
+        continue;
+      }
+
+      ancestors.push_back(key);
+      for (int octant = 0; octant < 8; ++octant) {
+        stack.push_back(key.child(octant));
+      }
+    }
+
+    // Map every counting cell to its tile
+    std::vector<uint32_t> cellTile(counts[COUNT_LEVEL].size(), 0);
+    for (uint32_t t = 0; t < tiles.size(); ++t) {
+      const uint32_t span = 1 << (COUNT_LEVEL - tiles[t].level);
+      for (uint32_t x = 0; x < span; ++x) {
+        for (uint32_t y = 0; y < span; ++y) {
+          for (uint32_t z = 0; z < span; ++z) {
+            cellTile[((tiles[t].x * span + x) * COUNT_SIZE
+                      + tiles[t].y * span + y) * COUNT_SIZE
+                     + tiles[t].z * span + z] = t;
+          }
+        }
+      }
+    }
+
+    clest::println("Spilling {} points into {} tiles",
+                   lasFile.pointDataCount(), tiles.size());
+
+    std::vector<std::string> paths(tiles.size());
+    std::vector<uint64_t> sizes(tiles.size(), 0);
+    std::vector<std::vector<PointData<N>>> buffers(tiles.size());
+    for (size_t t = 0; t < tiles.size(); ++t) {
+      paths[t] = fmt::format("{}.octree{}.tmp", lasFile.filePath, t);
+      std::remove(paths[t].c_str());
+    }
+
+    auto spill = [&](size_t t) {
+      std::ofstream fileStream(paths[t],
+                               std::ofstream::binary | std::ofstream::app);
+      if (!fileStream.is_open()) {
+        throw clest::Exception::build("Could not open file {}", paths[t]);
+      }
+      fileStream.write(reinterpret_cast<const char*>(buffers[t].data()),
+                       buffers[t].size() * sizeof(PointData<N>));
+      sizes[t] += buffers[t].size();
+      buffers[t].clear();
+    };
+
+    forEachBlock(lasFile, [&](const PointData<N> * points,
+                              uint64_t count,
+                              uint64_t) {
+      cells.resize(count);
+      parallelFor(count, [&](uint64_t i) {
+        cells[i] = cellTile[countCell(points[i])];
+      });
+      for (uint64_t i = 0; i < count; ++i) {
+        buffers[cells[i]].push_back(points[i]);
+        if (buffers[cells[i]].size() >= SPILL_SIZE) {
+          spill(cells[i]);
+        }
+      }
+    });
+
+    for (size_t t = 0; t < tiles.size(); ++t) {
+      if (!buffers[t].empty()) {
+        spill(t);
+      }
+      buffers[t] = std::vector<PointData<N>>();
+    }
+
+    // Group the tiles, largest first, into waves that fit the budget
+    std::vector<size_t> order(tiles.size());
+    for (size_t t = 0; t < tiles.size(); ++t) {
+      order[t] = t;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return sizes[a] > sizes[b];
+    });
+
+    std::vector<std::vector<size_t>> waves;
+    uint64_t waveMemory = 0;
+    for (auto t : order) {
+      uint64_t memory = sizes[t] * BYTES_PER_POINT;
+      if (memory > memoryBudget) {
+        clest::println(stderr,
+                       "Tile {} needs about {} bytes, above the budget of {}",
+                       paths[t], memory, memoryBudget);
+      }
+      if (waves.empty() || waveMemory + memory > memoryBudget) {
+        waves.emplace_back();
+        waveMemory = 0;
+      }
+      waves.back().push_back(t);
+      waveMemory += memory;
+    }
+
+    std::map<_NodeKey, _PendingNode<N>> pending;
+    std::mutex pendingMutex;
+    for (size_t w = 0; w < waves.size(); ++w) {
+      clest::println("Octree wave {}/{} with {} tiles",
+                     w + 1, waves.size(), waves[w].size());
+
+      parallelFor(waves[w].size(), [&](uint64_t i) {
+        const size_t t = waves[w][i];
+        std::vector<PointData<N>> points = _loadSpill<N>(paths[t], sizes[t]);
+        bool hasChildren = builder.buildSubtree(tiles[t], points);
+
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pending[tiles[t]] = { std::move(points), hasChildren };
+      });
+    }
+
+    // Sample the ancestors bottom up from their children
+    std::sort(ancestors.begin(), ancestors.end(),
+              [](const _NodeKey & a, const _NodeKey & b) {
+      return b < a;
+    });
+    for (auto & key : ancestors) {
+      std::vector<PointData<N>> selected;
+      std::unordered_set<uint64_t> taken;
+      for (int octant = 0; octant < 8; ++octant) {
+        auto child = pending.find(key.child(octant));
+        if (child == pending.end()) {
+          continue;
+        }
+
+        builder.sample(key, child->second.points, selected, taken);
+        if (!child->second.points.empty() || child->second.hasChildren) {
+          builder.emit(child->first, child->second.points);
+        }
+        pending.erase(child);
+      }
+      pending[key] = { std::move(selected), true };
+    }
+
+    for (auto & node : pending) {
+      builder.emit(node.first, node.second.points);
+    }
+
+    index.nodes = builder.finish();
+    index.save(indexPath);
+
+    uint8_t depth = 0;
+    for (auto & node : index.nodes) {
+      depth = std::max(depth, node.level);
+    }
+    clest::println("Octree of {} nodes over {} levels saved to {}",
+                   index.nodes.size(), depth + 1, indexPath);
+  }
+
+#define __DECLARE_TEMPLATES(index)\
+  template std::vector<PointData<index>> OctreeIndex::readNode(\
+    const OctreeNode & node) const;\
+  template void buildOctree(const LASFile<index> & lasFile,\
+                            double spacing,\
+                            uint32_t maxNodePoints,\
+                            uint64_t memoryBudget);
+
+  __DECLARE_TEMPLATES(-1)
+  __DECLARE_TEMPLATES(0)
+  __DECLARE_TEMPLATES(1)
+  __DECLARE_TEMPLATES(2)
+  __DECLARE_TEMPLATES(3)
+#undef __DECLARE_TEMPLATES
+
+}
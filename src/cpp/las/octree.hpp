@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "las_file.hpp"
+#include "point_data.hpp"
+
+namespace las {
+
+#pragma pack(push, 1)
+  /// A node of a level of detail octree
+  ///
+  /// The node covers the cube of side `size / 2^level` starting at
+  /// `min + (x, y, z) * size / 2^level`, and bit `i` of `childMask` is set
+  /// when the child with octant `i` (x: 1, y: 2, z: 4) exists. Its points
+  /// are the `count` records starting at byte `offset` of the data file
+  struct OctreeNode {
+    uint8_t level;
+    uint32_t x;
+    uint32_t y;
+    uint32_t z;
+    uint8_t childMask;
+    uint64_t offset;
+    uint64_t count;
+  };
+#pragma pack(pop)
+
+  /// Hierarchy of a level of detail octree, saved next to the data file
+  /// holding the points of every node as a contiguous chunk
+  ///
+  /// Each node holds a subset of its points sampled with a minimum
+  /// spacing of `spacing / 2^level`, and the points of a node and of its
+  /// ancestors together form its level of detail. A viewer reads the
+  /// index and then only the chunks of the nodes it needs
+  class OctreeIndex {
+  public:
+    OctreeIndex() = default;
+    OctreeIndex(const std::string & path) {
+      load(path);
+    }
+
+    void save(std::string path) const;
+    void load(const std::string & path);
+
+    /// Reads the points of `node` from `dataPath`
+    template <int N>
+    std::vector<PointData<N>> readNode(const OctreeNode & node) const;
+
+    /// Data file of the node chunks: the index path followed by ".bin"
+    std::string dataPath;
+
+    /// Record format of the chunks, quantized with `scale` and `offset`
+    int8_t pointFormat = 0;
+    uint16_t recordLength = 0;
+    double scale[3] = { 1, 1, 1 };
+    double offset[3] = { 0, 0, 0 };
+
+    /// Cube of the root node, in real units
+    double min[3] = { 0, 0, 0 };
+    double size = 0;
+
+    /// Minimum distance between the points of the root node
+    double spacing = 0;
+
+    /// Sorted by level and position, so parents come before children
+    std::vector<OctreeNode> nodes;
+
+  private:
+#pragma pack(push, 1)
+    struct OctreeHeader {
+      char signature[4] = { 'C', 'L', 'O', 'T' };
+      int8_t pointFormat;
+      uint16_t recordLength;
+      double scale[3];
+      double offset[3];
+      double min[3];
+      double size;
+      double spacing;
+      uint64_t nodeCount;
+    };
+#pragma pack(pop)
+  };
+
+  /// Builds a level of detail octree of `lasFile` out of core
+  ///
+  /// The index is saved as "<file>.octree" and the node chunks as
+  /// "<file>.octree.bin". A non positive `spacing` defaults to 1/128 of
+  /// the root cube. Nodes with more than `maxNodePoints` points are split,
+  /// and the tiles built in parallel fit within `memoryBudget` bytes
+  template <int N>
+  void buildOctree(const LASFile<N> & lasFile,
+                   double spacing,
+                   uint32_t maxNodePoints,
+                   uint64_t memoryBudget);
+}
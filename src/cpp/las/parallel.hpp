@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "las_file.hpp"
+#include "las_stream.hpp"
+#include "point_data.hpp"
+
+#ifdef _CMAKE_TBB_FOUND
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/task_group.h>
+#endif
+
+namespace las {
+
+  /// Points read at a time when a LAS file is not loaded in memory
+  constexpr uint64_t PARALLEL_BLOCK_SIZE = 0x10000;
+
+  /// Points per chunk of the order preserving compaction
+  constexpr uint64_t PARALLEL_CHUNK_SIZE = 0x1000;
+
+  /// Calls `func(index)` for every index in [0, `size`), in parallel
+  /// if TBB is available
+  template <typename F>
+  void parallelFor(uint64_t size, const F & func) {
+#ifdef _CMAKE_TBB_FOUND
+    tbb::blocked_range<uint64_t> block(0, size);
+    tbb::parallel_for(block, [&](const tbb::blocked_range<uint64_t> & range) {
+      for (uint64_t i = range.begin(); i != range.end(); ++i) {
+        func(i);
+      }
+    });
+#else
+    for (uint64_t i = 0; i < size; ++i) {
+      func(i);
+    }
+#endif
+  }
+
+  /// Reduces [0, `size`) with one accumulator per parallel range
+  ///
+  /// Each accumulator starts as a copy of `identity` and is updated with
+  /// `accumulate(T & value, index)`. The accumulators are then merged
+  /// with `join(T & value, const T & other)`
+  template <typename T, typename F, typename J>
+  T parallelReduce(uint64_t size,
+                   const T & identity,
+                   const F & accumulate,
+                   const J & join) {
+#ifdef _CMAKE_TBB_FOUND
+    return tbb::parallel_reduce(
+      tbb::blocked_range<uint64_t>(0, size),
+      identity,
+      [&](const tbb::blocked_range<uint64_t> & range, T value) {
+        for (uint64_t i = range.begin(); i != range.end(); ++i) {
+          accumulate(value, i);
+        }
+        return value;
+      },
+      [&](T value, const T & other) {
+        join(value, other);
+        return value;
+      });
+#else
+    T value = identity;
+    for (uint64_t i = 0; i < size; ++i) {
+      accumulate(value, i);
+    }
+    return value;
+#endif
+  }
+
+  /// Calls `func(points, count, first)` for consecutive blocks of the
+  /// points of `lasFile`, in file order, where `first` is the index of
+  /// `points[0]`. A fully loaded file is a single block, otherwise the
+  /// points are streamed `blockSize` at a time
+  ///
+  /// When streaming with TBB, the next block is read by a task of a
+  /// `tbb::task_group` while `func` runs on the current one, so only two
+  /// blocks are ever resident and the reads overlap with the processing
+  template <int N, typename F>
+  void forEachBlock(const LASFile<N> & lasFile,
+                    const F & func,
+                    uint64_t blockSize = PARALLEL_BLOCK_SIZE) {
+    const uint64_t count = lasFile.pointDataCount();
+
+    if (lasFile.pointData.size() == count) {
+      func(lasFile.pointData.data(), count, uint64_t(0));
+      return;
+    }
+
+    LASReader<N> reader(lasFile);
+    std::vector<PointData<N>> buffer;
+#ifdef _CMAKE_TBB_FOUND
+    std::vector<PointData<N>> next;
+    uint64_t first = reader.position();
+    reader.read(buffer, blockSize);
+
+    tbb::task_group readAhead;
+    while (!buffer.empty()) {
+      const uint64_t nextFirst = reader.position();
+      readAhead.run([&]() {
+        reader.read(next, blockSize);
+      });
+
+      try {
+        func(buffer.data(), static_cast<uint64_t>(buffer.size()), first);
+      } catch (...) {
+        readAhead.wait();
+        throw;
+      }
+      readAhead.wait();
+
+      std::swap(buffer, next);
+      first = nextFirst;
+    }
+#else
+    while (!reader.done()) {
+      uint64_t first = reader.position();
+      if (reader.read(buffer, blockSize) == 0) { break; }
+      func(buffer.data(), static_cast<uint64_t>(buffer.size()), first);
+    }
+#endif
+  }
+
+  /// Returns `func(point, index)` of every point, in file order
+  template <int N, typename F>
+  auto parallelMap(const LASFile<N> & lasFile, const F & func)
+    -> std::vector<decltype(func(PointData<N>(), uint64_t(0)))> {
+    std::vector<decltype(func(PointData<N>(), uint64_t(0)))> result(
+      lasFile.pointDataCount());
+
+    forEachBlock(lasFile, [&](const PointData<N> * points,
+                              uint64_t count,
+                              uint64_t first) {
+      parallelFor(count, [&](uint64_t i) {
+        result[first + i] = func(points[i], first + i);
+      });
+    });
+
+    return result;
+  }
+
+  /// Order preserving filter of blocks of points, reusing its buffers
+  /// from one block to the next
+  ///
+  /// `mark(points, count, first, keep)` sets `keep[i]` to 1 or 0 for
+  /// each of the `count` points of a chunk, where `first` is the index of
+  /// `points[0]`. The chunks are marked in parallel and then compacted in
+  /// parallel at the offsets given by the prefix sum of their counts
+  template <int N>
+  class BlockFilter {
+  public:
+    template <typename M>
+    const std::vector<PointData<N>> & filter(const PointData<N> * points,
+                                             uint64_t count,
+                                             uint64_t first,
+                                             const M & mark) {
+      const uint64_t chunks =
+        (count + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+      mKeep.resize(count);
+      mOffsets.assign(chunks + 1, 0);
+
+      parallelFor(chunks, [&](uint64_t chunk) {
+        uint64_t begin = chunk * PARALLEL_CHUNK_SIZE;
+        uint64_t end = std::min(count, begin + PARALLEL_CHUNK_SIZE);
+        mark(points + begin, end - begin, first + begin, mKeep.data() + begin);
+
+        uint64_t total = 0;
+        for (uint64_t i = begin; i < end; ++i) {
+          total += mKeep[i];
+        }
+        mOffsets[chunk + 1] = total;
+      });
+
+      for (uint64_t chunk = 0; chunk < chunks; ++chunk) {
+        mOffsets[chunk + 1] += mOffsets[chunk];
+      }
+
+      mKept.resize(mOffsets[chunks]);
+      parallelFor(chunks, [&](uint64_t chunk) {
+        uint64_t end = std::min(count, (chunk + 1) * PARALLEL_CHUNK_SIZE);
+        uint64_t target = mOffsets[chunk];
+        for (uint64_t i = chunk * PARALLEL_CHUNK_SIZE; i < end; ++i) {
+          if (mKeep[i]) {
+            mKept[target++] = points[i];
+          }
+        }
+      });
+
+      return mKept;
+    }
+
+  private:
+    std::vector<uint8_t> mKeep;
+    std::vector<uint64_t> mOffsets;
+    std::vector<PointData<N>> mKept;
+  };
+
+  /// Order preserving filter: calls `consume(kept)` with the points of
+  /// each block for which `predicate(point, index)` holds, given as a
+  /// `std::vector<PointData<N>>`, so the result never has to be resident
+  template <int N, typename P, typename C>
+  void parallelFilter(const LASFile<N> & lasFile,
+                      const P & predicate,
+                      const C & consume) {
+    BlockFilter<N> blockFilter;
+
+    forEachBlock(lasFile, [&](const PointData<N> * points,
+                              uint64_t count,
+                              uint64_t first) {
+      consume(blockFilter.filter(points, count, first,
+                                 [&](const PointData<N> * chunk,
+                                     uint64_t size,
+                                     uint64_t index,
+                                     uint8_t * keep) {
+        for (uint64_t i = 0; i < size; ++i) {
+          keep[i] = predicate(chunk[i], index + i) ? 1 : 0;
+        }
+      }));
+    });
+  }
+
+  /// Returns the points for which `predicate(point, index)` holds, in
+  /// file order
+  template <int N, typename P>
+  std::vector<PointData<N>> parallelFilter(const LASFile<N> & lasFile,
+                                           const P & predicate) {
+    std::vector<PointData<N>> result;
+    parallelFilter(lasFile,
+                   predicate,
+                   [&](const std::vector<PointData<N>> & kept) {
+                     result.insert(result.end(), kept.begin(), kept.end());
+                   });
+    return result;
+  }
+
+  /// Reduces the points of `lasFile` with one accumulator per parallel
+  /// range, updated with `accumulate(T & value, point, index)` and merged
+  /// with `join(T & value, const T & other)`
+  template <int N, typename T, typename F, typename J>
+  T parallelReduce(const LASFile<N> & lasFile,
+                   const T & identity,
+                   const F & accumulate,
+                   const J & join) {
+    T result = identity;
+
+    forEachBlock(lasFile, [&](const PointData<N> * points,
+                              uint64_t count,
+                              uint64_t first) {
+      T block = parallelReduce(count, identity, [&](T & value, uint64_t i) {
+        accumulate(value, points[i], first + i);
+      }, join);
+      join(result, block);
+    });
+
+    return result;
+  }
+}
@@ -0,0 +1,206 @@
+#include "pipeline.hpp"
+
+#include <cmath>
+#include <limits>
+
+#include <clest/ostream.hpp>
+
+#include "parallel.hpp"
+
+namespace {
+
+  /// Blocks read ahead before running the stages on them, which is the
+  /// parallelism available to unordered stages and to the sinks
+  constexpr size_t ROUND_SIZE = 16;
+
+  /// Bits per axis of a packed voxel key
+  constexpr int KEY_BITS = 21;
+  constexpr uint64_t KEY_MASK = (1ull << KEY_BITS) - 1;
+}
+
+namespace las {
+  namespace pipeline {
+
+    template <int N>
+    VoxelThinning<N>::VoxelThinning(const PublicHeader & header,
+                                    double voxelSize) {
+      if (!(voxelSize > 0)) {
+        throw clest::Exception::build(
+          "The voxel size {} is invalid and must be larger than zero",
+          voxelSize);
+      }
+
+      const double scale[3] = { header.xScaleFactor,
+                                header.yScaleFactor,
+                                header.zScaleFactor };
+      const double offset[3] = { header.xOffset,
+                                 header.yOffset,
+                                 header.zOffset };
+      const double min[3] = { header.minX, header.minY, header.minZ };
+      const double max[3] = { header.maxX, header.maxY, header.maxZ };
+
+      for (int axis = 0; axis < 3; ++axis) {
+        mStep[axis] = voxelSize / scale[axis];
+        mOffset[axis] = (min[axis] - offset[axis]) / scale[axis];
+
+        if ((max[axis] - min[axis]) / voxelSize >= (1 << KEY_BITS)) {
+          throw clest::Exception::build(
+            "The voxel size {} is too small for an extent of {}",
+            voxelSize, max[axis] - min[axis]);
+        }
+      }
+    }
+
+    template <int N>
+    void VoxelThinning<N>::process(Block<N> & block) {
+      auto keyOf = [this](const PointData<N> & point) {
+        const uint32_t coordinates[3] = { point.x, point.y, point.z };
+        uint64_t key = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+          // Points outside of the header bounds share the border voxels
+          double cell = std::floor((coordinates[axis] - mOffset[axis])
+                                   / mStep[axis]);
+          uint64_t clamped = cell > 0 ? static_cast<uint64_t>(cell) : 0;
+          key = (key << KEY_BITS) | std::min(clamped, KEY_MASK);
+        }
+        return key;
+      };
+
+      block.erase(std::remove_if(block.begin(),
+                                 block.end(),
+                                 [&](const PointData<N> & point) {
+                                   return !mTaken.insert(keyOf(point)).second;
+                                 }),
+                  block.end());
+    }
+
+    template <int N>
+    StatsSink<N>::StatsSink(const PublicHeader & header) :
+      mScale{ header.xScaleFactor, header.yScaleFactor, header.zScaleFactor },
+      mOffset{ header.xOffset, header.yOffset, header.zOffset } {
+      for (int axis = 0; axis < 3; ++axis) {
+        mMin[axis] = std::numeric_limits<double>::max();
+        mMax[axis] = std::numeric_limits<double>::lowest();
+      }
+    }
+
+    template <int N>
+    void StatsSink<N>::consume(const Block<N> & block) {
+      for (const auto & point : block) {
+        const uint32_t coordinates[3] = { point.x, point.y, point.z };
+        for (int axis = 0; axis < 3; ++axis) {
+          double value = coordinates[axis] * mScale[axis] + mOffset[axis];
+          mMin[axis] = std::min(mMin[axis], value);
+          mMax[axis] = std::max(mMax[axis], value);
+          mSum[axis] += value;
+        }
+        mClasses[classOf(point)]++;
+      }
+      mCount += block.size();
+    }
+
+    template <int N>
+    void StatsSink<N>::print() const {
+      clest::println("Points: {}", mCount);
+      if (mCount == 0) {
+        return;
+      }
+
+      clest::println("Min: [{}, {}, {}]", mMin[0], mMin[1], mMin[2]);
+      clest::println("Max: [{}, {}, {}]", mMax[0], mMax[1], mMax[2]);
+      clest::println("Mean: [{}, {}, {}]", mean(0), mean(1), mean(2));
+      for (int i = 0; i < 32; ++i) {
+        if (mClasses[i] > 0) {
+          clest::println("Class {}: {}", i, mClasses[i]);
+        }
+      }
+    }
+
+    /// Reads rounds of `ROUND_SIZE` blocks and runs the stages over each
+    /// round, in parallel across the blocks unless the stage is ordered.
+    /// The sinks then consume the round concurrently with each other,
+    /// each of them walking the blocks in order
+    template <int N>
+    uint64_t Pipeline<N>::run(const LASFile<N> & lasFile, uint64_t blockSize) {
+      if (blockSize == 0) {
+        throw clest::Exception("The block size must be larger than zero");
+      }
+
+      const uint64_t total = lasFile.pointDataCount();
+      const bool inMemory = lasFile.pointData.size() == total;
+
+      std::unique_ptr<LASReader<N>> reader;
+      if (!inMemory) {
+        reader = std::make_unique<LASReader<N>>(lasFile);
+      }
+
+      std::vector<Block<N>> blocks(ROUND_SIZE);
+      uint64_t position = 0;
+      uint64_t passed = 0;
+
+      while (inMemory ? position < total : !reader->done()) {
+        size_t count = 0;
+        for (; count < ROUND_SIZE; ++count) {
+          if (inMemory) {
+            uint64_t end = std::min(position + blockSize, total);
+            blocks[count].assign(lasFile.pointData.begin() + position,
+                                 lasFile.pointData.begin() + end);
+          } else {
+            reader->read(blocks[count], blockSize);
+          }
+
+          if (blocks[count].empty()) {
+            break;
+          }
+          position += blocks[count].size();
+        }
+
+        for (auto & stage : mStages) {
+          if (stage->ordered()) {
+            for (size_t i = 0; i < count; ++i) {
+              stage->process(blocks[i]);
+            }
+          } else {
+            parallelFor(count, [&](uint64_t i) {
+              stage->process(blocks[i]);
+            });
+          }
+        }
+
+        parallelFor(mSinks.size(), [&](uint64_t s) {
+          for (size_t i = 0; i < count; ++i) {
+            mSinks[s]->consume(blocks[i]);
+          }
+        });
+
+        for (size_t i = 0; i < count; ++i) {
+          passed += blocks[i].size();
+        }
+      }
+
+      for (auto sink : mSinks) {
+        sink->finish();
+      }
+
+      if (position < total) {
+        clest::println("Pipeline stopped after {} of {} points of {}",
+                       position, total, lasFile.filePath);
+      }
+
+      return passed;
+    }
+
+#define __DECLARE_TEMPLATES(index)\
+  template class VoxelThinning<index>;\
+  template class StatsSink<index>;\
+  template class Pipeline<index>;
+
+    __DECLARE_TEMPLATES(-1)
+    __DECLARE_TEMPLATES(0)
+    __DECLARE_TEMPLATES(1)
+    __DECLARE_TEMPLATES(2)
+    __DECLARE_TEMPLATES(3)
+#undef __DECLARE_TEMPLATES
+
+  }
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "grid_file.hpp"
+#include "las_file.hpp"
+#include "las_stream.hpp"
+#include "point_data.hpp"
+
+namespace las {
+
+  /// Composable single pass processing of a LAS file
+  ///
+  /// The points are read once, in blocks, and every block goes through
+  /// the stages in order and is then handed to all the sinks. Chaining
+  /// operations this way touches the data once, instead of once per
+  /// operation plus an intermediate file for each of them
+  namespace pipeline {
+
+    template <int N>
+    using Block = std::vector<PointData<N>>;
+
+    /// Classification of a point, without the flag bits
+    /// Format -1 has no classification, so every point is unclassified
+    template <int N>
+    uint8_t classOf(const PointData<N> & point) {
+      return point.classification & 0x1F;
+    }
+
+    template <>
+    inline uint8_t classOf<-1>(const PointData<-1> &) {
+      return 0;
+    }
+
+    /// Filters or modifies the points of a block in place
+    template <int N>
+    class Stage {
+    public:
+      virtual ~Stage() = default;
+
+      virtual void process(Block<N> & block) = 0;
+
+      /// Unordered stages process many blocks concurrently. A stage that
+      /// keeps state across blocks must be ordered, so that it sees one
+      /// block at a time, in file order
+      virtual bool ordered() const { return false; }
+    };
+
+    /// Receives the blocks that come out of the stages, in file order
+    /// Different sinks run concurrently, so they must not share state
+    template <int N>
+    class Sink {
+    public:
+      virtual ~Sink() = default;
+
+      virtual void consume(const Block<N> & block) = 0;
+
+      /// Called once, after the last block
+      virtual void finish() {}
+    };
+
+    /// Keeps the points for which `predicate(point)` is true
+    template <int N, typename P>
+    class FilterStage : public Stage<N> {
+    public:
+      FilterStage(P predicate) : mPredicate(predicate) {}
+
+      void process(Block<N> & block) override {
+        block.erase(std::remove_if(block.begin(),
+                                   block.end(),
+                                   [this](const PointData<N> & point) {
+                                     return !mPredicate(point);
+                                   }),
+                    block.end());
+      }
+
+    private:
+      P mPredicate;
+    };
+
+    /// Calls `func(point)` on every point, which may modify it
+    template <int N, typename F>
+    class TransformStage : public Stage<N> {
+    public:
+      TransformStage(F func) : mFunc(func) {}
+
+      void process(Block<N> & block) override {
+        for (auto & point : block) {
+          mFunc(point);
+        }
+      }
+
+    private:
+      F mFunc;
+    };
+
+    template <int N, typename P>
+    std::unique_ptr<Stage<N>> filter(P predicate) {
+      return std::make_unique<FilterStage<N, P>>(predicate);
+    }
+
+    template <int N, typename F>
+    std::unique_ptr<Stage<N>> transform(F func) {
+      return std::make_unique<TransformStage<N, F>>(func);
+    }
+
+    /// Keeps the points of the given class
+    template <int N>
+    std::unique_ptr<Stage<N>> classification(uint8_t value) {
+      return filter<N>([value](const PointData<N> & point) {
+        return classOf(point) == value;
+      });
+    }
+
+    /// Keeps the first point to fall in each cubic voxel of side
+    /// `voxelSize`, in real units
+    template <int N>
+    class VoxelThinning : public Stage<N> {
+    public:
+      VoxelThinning(const PublicHeader & header, double voxelSize);
+
+      void process(Block<N> & block) override;
+      bool ordered() const override { return true; }
+
+    private:
+      double mStep[3];
+      double mOffset[3];
+      std::unordered_set<uint64_t> mTaken;
+    };
+
+    /// Writes the points to a new LAS file with the headers of `source`
+    template <int N>
+    class LASSink : public Sink<N> {
+    public:
+      LASSink(const LASFile<N> & source, std::string path) :
+        mWriter(path, source.publicHeader, source.recordHeaders) {}
+
+      void consume(const Block<N> & block) override {
+        mWriter.write(block);
+      }
+
+      void finish() override { mWriter.close(); }
+
+      const std::string & filePath() const { return mWriter.filePath; }
+
+    private:
+      LASWriter<N> mWriter;
+    };
+
+    /// Point count, bounds, centroid and classification histogram
+    template <int N>
+    class StatsSink : public Sink<N> {
+    public:
+      StatsSink(const PublicHeader & header);
+
+      void consume(const Block<N> & block) override;
+
+      uint64_t count() const { return mCount; }
+      const double * min() const { return mMin; }
+      const double * max() const { return mMax; }
+      const uint64_t * classes() const { return mClasses; }
+      double mean(int axis) const {
+        return mCount > 0 ? mSum[axis] / mCount : 0;
+      }
+
+      void print() const;
+
+    private:
+      double mScale[3];
+      double mOffset[3];
+      uint64_t mCount = 0;
+      double mMin[3];
+      double mMax[3];
+      double mSum[3] = { 0, 0, 0 };
+      uint64_t mClasses[32] = {};
+    };
+
+    /// Accumulates the points into a density grid over the bounds of
+    /// the header
+    template <int N>
+    class GridSink : public Sink<N> {
+    public:
+      GridSink(const PublicHeader & header,
+               uint16_t sizeX,
+               uint16_t sizeY,
+               uint16_t sizeZ) {
+        mGrid.prepare(header, sizeX, sizeY, sizeZ);
+      }
+
+      void consume(const Block<N> & block) override {
+        for (const auto & point : block) {
+          mGrid.add(point.x, point.y, point.z);
+        }
+      }
+
+      grid::GridFile & grid() { return mGrid; }
+
+    private:
+      grid::GridFile mGrid;
+    };
+
+    /// Chain of stages feeding a set of sinks
+    ///
+    /// The stages are owned by the pipeline, while the sinks are owned by
+    /// the caller so that their results can be read after `run`
+    template <int N>
+    class Pipeline {
+    public:
+      Pipeline & add(std::unique_ptr<Stage<N>> stage) {
+        mStages.push_back(std::move(stage));
+        return *this;
+      }
+
+      Pipeline & sink(Sink<N> & sink) {
+        mSinks.push_back(&sink);
+        return *this;
+      }
+
+      /// Streams the points of `lasFile` through the pipeline, from memory
+      /// if fully loaded or else from the file, `blockSize` points at a
+      /// time. Returns the number of points that reached the sinks
+      uint64_t run(const LASFile<N> & lasFile, uint64_t blockSize = 0x10000);
+
+    private:
+      std::vector<std::unique_ptr<Stage<N>>> mStages;
+      std::vector<Sink<N>*> mSinks;
+    };
+  }
+}
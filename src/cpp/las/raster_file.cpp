@@ -0,0 +1,281 @@
+#include "raster_file.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include <clest/util.hpp>
+#include <clest/ostream.hpp>
+
+#include "parallel.hpp"
+
+namespace {
+
+  /// Side, in cells, of the tiles that are binned in parallel
+  constexpr uint32_t TILE_SIZE = 256;
+
+  /// Points binned at a time, split into at most `SLICE_CHUNKS` chunks
+  constexpr uint64_t SLICE_SIZE = 1 << 20;
+  constexpr uint64_t SLICE_CHUNKS = 64;
+
+  constexpr uint32_t NO_CELL = 0xFFFFFFFF;
+
+  template <int N>
+  bool _accepts(const las::PointData<N> & point,
+                las::RasterFile::Filter filter) {
+    switch (filter) {
+      case las::RasterFile::Filter::LAST_RETURN:
+        return point.returnNumber == point.numberOfReturns;
+      case las::RasterFile::Filter::GROUND:
+        return (point.classification & 0x1F) == 2;
+      default:
+        return true;
+    }
+  }
+
+  template <>
+  bool _accepts(const las::PointData<-1> &, las::RasterFile::Filter) {
+    return true;
+  }
+}
+
+namespace las {
+
+  /// Saves the header followed by every band in full
+  /// If the file already exists, it will append a ".new" before the extension
+  void RasterFile::save(std::string path) const {
+    clest::guaranteeNewFile(path, "raster");
+
+    std::ofstream fileStream(path, std::ofstream::binary);
+
+    if (!fileStream.is_open()) {
+      throw clest::Exception::build("Could not open file {}", path);
+    }
+
+    RasterHeader header;
+    header.width = width;
+    header.height = height;
+    header.minX = minX;
+    header.minY = minY;
+    header.cellSize = cellSize;
+    header.filter = static_cast<uint8_t>(filter);
+    fileStream.write(reinterpret_cast<const char*>(&header),
+                     sizeof(RasterHeader));
+
+    for (auto band : { &minZ, &maxZ, &meanZ }) {
+      fileStream.write(reinterpret_cast<const char*>(band->data()),
+                       band->size() * sizeof(float));
+    }
+    fileStream.write(reinterpret_cast<const char*>(count.data()),
+                     count.size() * sizeof(uint32_t));
+
+    fileStream.close();
+  }
+
+  /// Load the raster from file
+  /// Integrity will be checked with regards to the values of the header
+  void RasterFile::load(const std::string & path) {
+    std::ifstream fileStream(path, std::ifstream::binary);
+
+    if (!fileStream.is_open()) {
+      throw clest::Exception::build("Could not open file {}\n", path);
+    }
+
+    RasterHeader expected;
+    RasterHeader header;
+    fileStream.read(reinterpret_cast<char*>(&header), sizeof(RasterHeader));
+
+    if (!fileStream.good()
+        || std::memcmp(header.signature, expected.signature, 4) != 0
+        || header.bandCount != expected.bandCount) {
+      throw clest::Exception::build("The file {} seems to be corrupted", path);
+    }
+
+    width = header.width;
+    height = header.height;
+    minX = header.minX;
+    minY = header.minY;
+    cellSize = header.cellSize;
+    filter = static_cast<Filter>(header.filter);
+
+    const uint64_t cells = static_cast<uint64_t>(width) * height;
+    for (auto band : { &minZ, &maxZ, &meanZ }) {
+      band->resize(cells);
+      fileStream.read(reinterpret_cast<char*>(band->data()),
+                      band->size() * sizeof(float));
+    }
+    count.resize(cells);
+    fileStream.read(reinterpret_cast<char*>(count.data()),
+                    count.size() * sizeof(uint32_t));
+
+    if (!fileStream.good()) {
+      throw clest::Exception::build("The file {} seems to be truncated", path);
+    }
+
+    fileStream.close();
+  }
+
+  /// The points are streamed in slices. Each slice is binned in parallel
+  /// chunks, which count their points per tile of `TILE_SIZE` cells, and
+  /// then scattered into tile order at the offsets given by the prefix
+  /// sum of those counts. Every tile is then reduced into the raster by a
+  /// single task, so the cells need no atomics nor per thread copies
+  template <int N>
+  void RasterFile::rasterize(const LASFile<N> & lasFile,
+                             double cellSize,
+                             Filter filter) {
+    if (!lasFile.isValid() || lasFile.pointDataCount() < 1) {
+      throw clest::Exception::build(
+        "Trying to rasterize, but {} seems to be corrupted or empty",
+        lasFile.filePath);
+    }
+
+    if (N == -1 && filter != Filter::ALL) {
+      throw clest::Exception::build(
+        "Point format -1 of {} has no returns nor classes to filter",
+        lasFile.filePath);
+    }
+
+    if (!(cellSize > 0)) {
+      throw clest::Exception::build(
+        "The cell size {} is invalid and must be larger than zero", cellSize);
+    }
+
+    const PublicHeader & header = lasFile.publicHeader;
+    const double columns =
+      std::max(1.0, std::ceil((header.maxX - header.minX) / cellSize));
+    const double rows =
+      std::max(1.0, std::ceil((header.maxY - header.minY) / cellSize));
+    if (columns * rows >= NO_CELL) {
+      throw clest::Exception::build(
+        "The cell size {} is too small for the bounds of {}",
+        cellSize, lasFile.filePath);
+    }
+
+    this->width = static_cast<uint32_t>(columns);
+    this->height = static_cast<uint32_t>(rows);
+    this->minX = header.minX;
+    this->minY = header.minY;
+    this->cellSize = cellSize;
+    this->filter = filter;
+
+    const uint64_t cells = static_cast<uint64_t>(width) * height;
+    minZ.assign(cells, std::numeric_limits<float>::max());
+    maxZ.assign(cells, std::numeric_limits<float>::lowest());
+    meanZ.assign(cells, 0);
+    count.assign(cells, 0);
+    std::vector<double> sums(cells, 0);
+
+    const uint32_t tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    const uint32_t tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    const uint64_t tiles = static_cast<uint64_t>(tilesX) * tilesY;
+
+    auto cellOf = [&](const PointData<N> & point) {
+      const double x = point.x * header.xScaleFactor + header.xOffset;
+      const double y = point.y * header.yScaleFactor + header.yOffset;
+      const double column = std::floor((x - minX) / cellSize);
+      const double row = std::floor((y - minY) / cellSize);
+      return index(
+        static_cast<uint32_t>(std::min(std::max(column, 0.0), columns - 1)),
+        static_cast<uint32_t>(std::min(std::max(row, 0.0), rows - 1)));
+    };
+
+    auto tileOf = [&](uint64_t cell) {
+      const uint64_t row = cell / width;
+      const uint64_t column = cell % width;
+      return (row / TILE_SIZE) * tilesX + column / TILE_SIZE;
+    };
+
+    constexpr uint64_t CHUNK_SIZE = SLICE_SIZE / SLICE_CHUNKS;
+    std::vector<uint32_t> binned(SLICE_SIZE);
+    std::vector<uint32_t> sortedCells(SLICE_SIZE);
+    std::vector<float> sortedValues(SLICE_SIZE);
+    std::vector<uint64_t> offsets(SLICE_CHUNKS * tiles);
+    std::vector<uint64_t> tileStarts(tiles + 1);
+
+    forEachBlock(lasFile, [&](const PointData<N> * block,
+                              uint64_t blockSize,
+                              uint64_t) {
+      for (uint64_t slice = 0; slice < blockSize; slice += SLICE_SIZE) {
+        const PointData<N> * points = block + slice;
+        const uint64_t size = std::min(SLICE_SIZE, blockSize - slice);
+        const uint64_t chunks = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+        std::fill(offsets.begin(), offsets.begin() + chunks * tiles, 0);
+        parallelFor(chunks, [&](uint64_t chunk) {
+          const uint64_t end = std::min(size, (chunk + 1) * CHUNK_SIZE);
+          for (uint64_t i = chunk * CHUNK_SIZE; i < end; ++i) {
+            if (!_accepts(points[i], filter)) {
+              binned[i] = NO_CELL;
+              continue;
+            }
+            binned[i] = static_cast<uint32_t>(cellOf(points[i]));
+            offsets[chunk * tiles + tileOf(binned[i])]++;
+          }
+        });
+
+        // Tile major, so each tile is contiguous and its chunks in order
+        uint64_t total = 0;
+        for (uint64_t tile = 0; tile < tiles; ++tile) {
+          tileStarts[tile] = total;
+          for (uint64_t chunk = 0; chunk < chunks; ++chunk) {
+            uint64_t tileCount = offsets[chunk * tiles + tile];
+            offsets[chunk * tiles + tile] = total;
+            total += tileCount;
+          }
+        }
+        tileStarts[tiles] = total;
+
+        parallelFor(chunks, [&](uint64_t chunk) {
+          const uint64_t end = std::min(size, (chunk + 1) * CHUNK_SIZE);
+          for (uint64_t i = chunk * CHUNK_SIZE; i < end; ++i) {
+            if (binned[i] == NO_CELL) {
+              continue;
+            }
+            uint64_t & target = offsets[chunk * tiles + tileOf(binned[i])];
+            sortedCells[target] = binned[i];
+            sortedValues[target] = static_cast<float>(
+              points[i].z * header.zScaleFactor + header.zOffset);
+            target++;
+          }
+        });
+
+        parallelFor(tiles, [&](uint64_t tile) {
+          for (uint64_t i = tileStarts[tile]; i < tileStarts[tile + 1]; ++i) {
+            const uint32_t cell = sortedCells[i];
+            const float value = sortedValues[i];
+            minZ[cell] = std::min(minZ[cell], value);
+            maxZ[cell] = std::max(maxZ[cell], value);
+            sums[cell] += value;
+            count[cell]++;
+          }
+        });
+      }
+    });
+
+    parallelFor(cells, [&](uint64_t cell) {
+      if (count[cell] == 0) {
+        minZ[cell] = NO_DATA;
+        maxZ[cell] = NO_DATA;
+        meanZ[cell] = NO_DATA;
+      } else {
+        meanZ[cell] = static_cast<float>(sums[cell] / count[cell]);
+      }
+    });
+  }
+
+#define __DECLARE_TEMPLATES(index)\
+  template void RasterFile::rasterize(const LASFile<index> & lasFile,\
+                                      double cellSize,\
+                                      Filter filter);
+
+  __DECLARE_TEMPLATES(-1)
+  __DECLARE_TEMPLATES(0)
+  __DECLARE_TEMPLATES(1)
+  __DECLARE_TEMPLATES(2)
+  __DECLARE_TEMPLATES(3)
+#undef __DECLARE_TEMPLATES
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "las_file.hpp"
+
+namespace las {
+
+  /// 2.5D raster of the elevations of a LAS file, such as a DSM (highest
+  /// points) or a DTM (ground points)
+  ///
+  /// Columns run along X from `minX` and rows along Y from `minY`, row
+  /// major. Each statistic is stored as its own band of `width * height`
+  /// values, and the cells without points hold `NO_DATA` in the
+  /// elevation bands
+  class RasterFile {
+  public:
+    static constexpr float NO_DATA = -9999;
+
+    /// Points that go into the raster
+    enum class Filter : uint8_t {
+      ALL = 0,
+      LAST_RETURN = 1,
+      GROUND = 2
+    };
+
+    RasterFile() = default;
+    RasterFile(const std::string & path) {
+      load(path);
+    }
+
+    void save(std::string path) const;
+    void load(const std::string & path);
+
+    /// Bins the points of `lasFile` that pass `filter` into square cells
+    /// of side `cellSize` over the bounds of its header. Points outside
+    /// of the bounds are clamped to the border cells
+    template <int N>
+    void rasterize(const LASFile<N> & lasFile,
+                   double cellSize,
+                   Filter filter = Filter::ALL);
+
+    uint64_t index(uint32_t column, uint32_t row) const {
+      return static_cast<uint64_t>(row) * width + column;
+    }
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    double minX = 0;
+    double minY = 0;
+    double cellSize = 1;
+    Filter filter = Filter::ALL;
+
+    std::vector<float> minZ;
+    std::vector<float> maxZ;
+    std::vector<float> meanZ;
+    std::vector<uint32_t> count;
+
+  private:
+#pragma pack(push, 1)
+    struct RasterHeader {
+      char signature[4] = { 'C', 'L', 'R', 'S' };
+      uint32_t width;
+      uint32_t height;
+      double minX;
+      double minY;
+      double cellSize;
+      float noData = NO_DATA;
+      uint8_t filter;
+      uint16_t bandCount = 4;
+    };
+#pragma pack(pop)
+  };
+}
@@ -0,0 +1,302 @@
+#include "sparse_grid_file.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include <clest/util.hpp>
+#include <clest/ostream.hpp>
+
+#include "parallel.hpp"
+
+namespace {
+
+  /// Points read and binned at a time, split into `SLICE_CHUNKS` chunks
+  constexpr uint64_t SLICE_SIZE = 1 << 20;
+  constexpr uint64_t SLICE_CHUNKS = 64;
+}
+
+namespace grid {
+
+  uint32_t SparseGridFile::Shard::allocate(uint64_t key) {
+    auto inserted = index.emplace(key, static_cast<uint32_t>(bricks.size()));
+    if (inserted.second) {
+      bricks.emplace_back();
+      bricks.back().fill(0);
+    }
+    return inserted.first->second;
+  }
+
+  /// Saves the header followed by the key and the values of every brick
+  /// If the file already exists, it will append a ".new" before the extension
+  void SparseGridFile::save(std::string path) const {
+    clest::guaranteeNewFile(path, "sgrid");
+
+    std::ofstream fileStream(path, std::ofstream::binary);
+
+    if (!fileStream.is_open()) {
+      throw clest::Exception::build("Could not open file {}", path);
+    }
+
+    SparseGridHeader header = mHeader;
+    header.brickCount = brickCount();
+    fileStream.write(reinterpret_cast<const char*>(&header),
+                     sizeof(SparseGridHeader));
+
+    for (const Shard & shard : mShards) {
+      for (const auto & entry : shard.index) {
+        fileStream.write(reinterpret_cast<const char*>(&entry.first),
+                         sizeof(uint64_t));
+        fileStream.write(
+          reinterpret_cast<const char*>(shard.bricks[entry.second].data()),
+          sizeof(Brick));
+      }
+    }
+
+    fileStream.close();
+  }
+
+  /// Load the grid from file
+  /// Integrity will be checked with regards to the values of the header
+  void SparseGridFile::load(const std::string & path) {
+    std::ifstream fileStream(path, std::ifstream::binary);
+
+    if (!fileStream.is_open()) {
+      throw clest::Exception::build("Could not open file {}\n", path);
+    }
+
+    SparseGridHeader expected;
+    fileStream.read(reinterpret_cast<char*>(&mHeader),
+                    sizeof(SparseGridHeader));
+
+    if (!fileStream.good()
+        || std::memcmp(mHeader.signature, expected.signature, 4) != 0
+        || mHeader.sizeX == 0 || mHeader.sizeX > MAX_SIZE
+        || mHeader.sizeY == 0 || mHeader.sizeY > MAX_SIZE
+        || mHeader.sizeZ == 0 || mHeader.sizeZ > MAX_SIZE) {
+      throw clest::Exception::build("The file {} seems to be corrupted", path);
+    }
+
+    mShards = std::vector<Shard>(SHARD_COUNT);
+    uint64_t key;
+    for (uint64_t i = 0; i < mHeader.brickCount; ++i) {
+      fileStream.read(reinterpret_cast<char*>(&key), sizeof(uint64_t));
+      Shard & shard = mShards[shardOf(key)];
+      Brick & brick = shard.bricks[shard.allocate(key)];
+      fileStream.read(reinterpret_cast<char*>(brick.data()), sizeof(Brick));
+    }
+
+    if (!fileStream.good()) {
+      throw clest::Exception::build("The file {} seems to be truncated", path);
+    }
+
+    fileStream.close();
+  }
+
+  /// The points are streamed `SLICE_SIZE` at a time. The bricks and
+  /// voxels of each slice are computed in parallel chunks, which count
+  /// their points per shard, and then scattered into shard order at the
+  /// offsets given by the prefix sum of those counts. Each shard then
+  /// allocates and increments its bricks from a single task, so the hash
+  /// maps need no locks
+  template<int N>
+  void SparseGridFile::convert(las::LASFile<N> & lasFile,
+                               uint32_t sizeX,
+                               uint32_t sizeY,
+                               uint32_t sizeZ) {
+    // Only the headers are needed, the points are streamed
+    if (!lasFile.isValid()) {
+      lasFile.loadHeaders();
+
+      if (!lasFile.isValid()) {
+        throw clest::Exception::build("Could not load LAS file:\n{}",
+                                      lasFile.filePath);
+      }
+    }
+
+    prepare(lasFile.publicHeader, sizeX, sizeY, sizeZ);
+
+    constexpr uint64_t CHUNK_SIZE = SLICE_SIZE / SLICE_CHUNKS;
+    const uint64_t sliceSize =
+      std::min<uint64_t>(SLICE_SIZE, lasFile.pointDataCount());
+    std::vector<uint64_t> keys(sliceSize);
+    std::vector<uint16_t> voxels(sliceSize);
+    std::vector<uint64_t> sortedKeys(sliceSize);
+    std::vector<uint16_t> sortedVoxels(sliceSize);
+    std::vector<uint64_t> offsets(SLICE_CHUNKS * SHARD_COUNT);
+    std::vector<uint64_t> shardStarts(SHARD_COUNT + 1);
+
+    las::forEachBlock(lasFile, [&](const las::PointData<N> * block,
+                                   uint64_t blockSize,
+                                   uint64_t) {
+      for (uint64_t slice = 0; slice < blockSize; slice += SLICE_SIZE) {
+        const las::PointData<N> * points = block + slice;
+        const uint64_t size = std::min(SLICE_SIZE, blockSize - slice);
+        const uint64_t chunks = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+        std::fill(offsets.begin(), offsets.begin() + chunks * SHARD_COUNT, 0);
+        las::parallelFor(chunks, [&](uint64_t chunk) {
+          const uint64_t end = std::min(size, (chunk + 1) * CHUNK_SIZE);
+          for (uint64_t i = chunk * CHUNK_SIZE; i < end; ++i) {
+            const uint32_t x = voxelAlong(0, points[i].x);
+            const uint32_t y = voxelAlong(1, points[i].y);
+            const uint32_t z = voxelAlong(2, points[i].z);
+            keys[i] = brickKey(x >> BRICK_BITS, y >> BRICK_BITS, z >> BRICK_BITS);
+            voxels[i] = static_cast<uint16_t>(voxelInBrick(x, y, z));
+            offsets[chunk * SHARD_COUNT + shardOf(keys[i])]++;
+          }
+        });
+
+        uint64_t total = 0;
+        for (uint64_t shard = 0; shard < SHARD_COUNT; ++shard) {
+          shardStarts[shard] = total;
+          for (uint64_t chunk = 0; chunk < chunks; ++chunk) {
+            uint64_t shardCount = offsets[chunk * SHARD_COUNT + shard];
+            offsets[chunk * SHARD_COUNT + shard] = total;
+            total += shardCount;
+          }
+        }
+        shardStarts[SHARD_COUNT] = total;
+
+        las::parallelFor(chunks, [&](uint64_t chunk) {
+          const uint64_t end = std::min(size, (chunk + 1) * CHUNK_SIZE);
+          for (uint64_t i = chunk * CHUNK_SIZE; i < end; ++i) {
+            uint64_t & target = offsets[chunk * SHARD_COUNT + shardOf(keys[i])];
+            sortedKeys[target] = keys[i];
+            sortedVoxels[target] = voxels[i];
+            target++;
+          }
+        });
+
+        las::parallelFor(SHARD_COUNT, [&](uint64_t index) {
+          Shard & shard = mShards[index];
+
+          // Consecutive points tend to fall in the same brick
+          uint64_t lastKey = ~0ull;
+          uint32_t brick = 0;
+          for (uint64_t i = shardStarts[index]; i < shardStarts[index + 1]; ++i) {
+            if (sortedKeys[i] != lastKey) {
+              lastKey = sortedKeys[i];
+              brick = shard.allocate(lastKey);
+            }
+
+            uint16_t & value = shard.bricks[brick][sortedVoxels[i]];
+            if (value < 0xFFFF) {
+              value++;
+            }
+          }
+        });
+      }
+    }, SLICE_SIZE);
+
+    mHeader.maxValue = las::parallelReduce(
+      SHARD_COUNT,
+      uint16_t(0),
+      [&](uint16_t & max, uint64_t index) {
+        for (const Brick & brick : mShards[index].bricks) {
+          max = std::max(max, *std::max_element(brick.begin(), brick.end()));
+        }
+      },
+      [](uint16_t & max, const uint16_t & other) {
+        max = std::max(max, other);
+      });
+  }
+
+  void SparseGridFile::prepare(const las::PublicHeader & header,
+                               uint32_t sizeX,
+                               uint32_t sizeY,
+                               uint32_t sizeZ) {
+    // Check validity of the parameters
+    if (sizeX == 0 || sizeY == 0 || sizeZ == 0
+        || sizeX > MAX_SIZE || sizeY > MAX_SIZE || sizeZ > MAX_SIZE) {
+      throw clest::Exception::build(
+        "The size [{}, {}, {}] is invalid and must be from 1 to {}",
+        sizeX,
+        sizeY,
+        sizeZ,
+        MAX_SIZE);
+    }
+
+    mHeader.sizeX = sizeX;
+    mHeader.sizeY = sizeY;
+    mHeader.sizeZ = sizeZ;
+
+    auto deltaAxis = std::max(header.maxX - header.minX,
+                              std::max(header.maxY - header.minY,
+                                       header.maxZ - header.minZ));
+
+    mAxes = voxelAxes(header, sizeX, sizeY, sizeZ);
+
+    mHeader.xFactor =
+      (header.maxX - header.minX) * header.xScaleFactor / deltaAxis;
+    mHeader.yFactor =
+      (header.maxY - header.minY) * header.yScaleFactor / deltaAxis;
+    mHeader.zFactor =
+      (header.maxZ - header.minZ) * header.zScaleFactor / deltaAxis;
+
+    mShards = std::vector<Shard>(SHARD_COUNT);
+    mHeader.maxValue = 0;
+  }
+
+  void SparseGridFile::add(uint32_t x, uint32_t y, uint32_t z) {
+    const uint32_t voxel[3] = { voxelAlong(0, x),
+                                voxelAlong(1, y),
+                                voxelAlong(2, z) };
+    const uint64_t key = brickKey(voxel[0] >> BRICK_BITS,
+                                  voxel[1] >> BRICK_BITS,
+                                  voxel[2] >> BRICK_BITS);
+
+    Shard & shard = mShards[shardOf(key)];
+    uint16_t & value = shard.bricks[shard.allocate(key)]
+      [voxelInBrick(voxel[0], voxel[1], voxel[2])];
+    if (value < 0xFFFF) {
+      value++;
+    }
+    if (value > mHeader.maxValue) {
+      mHeader.maxValue = value;
+    }
+  }
+
+  uint16_t SparseGridFile::value(uint32_t x, uint32_t y, uint32_t z) const {
+    const uint16_t * voxels =
+      brick(x >> BRICK_BITS, y >> BRICK_BITS, z >> BRICK_BITS);
+    return voxels ? voxels[voxelInBrick(x, y, z)] : 0;
+  }
+
+  const uint16_t * SparseGridFile::brick(uint32_t brickX,
+                                         uint32_t brickY,
+                                         uint32_t brickZ) const {
+    const uint64_t key = brickKey(brickX, brickY, brickZ);
+    const Shard & shard = mShards[shardOf(key)];
+    auto entry = shard.index.find(key);
+    return entry == shard.index.end() ?
+      nullptr : shard.bricks[entry->second].data();
+  }
+
+  uint64_t SparseGridFile::brickCount() const {
+    uint64_t count = 0;
+    for (const Shard & shard : mShards) {
+      count += shard.bricks.size();
+    }
+    return count;
+  }
+
+  uint32_t SparseGridFile::voxelAlong(int axis, uint32_t value) const {
+    return mAxes[axis].voxelOf(value);
+  }
+
+#define __DECLARE_TEMPLATES(index)\
+  template void SparseGridFile::convert(las::LASFile<index> & lasFile,\
+                                        uint32_t sizeX,\
+                                        uint32_t sizeY,\
+                                        uint32_t sizeZ);
+
+  __DECLARE_TEMPLATES(-1)
+  __DECLARE_TEMPLATES(0)
+  __DECLARE_TEMPLATES(1)
+  __DECLARE_TEMPLATES(2)
+  __DECLARE_TEMPLATES(3)
+
+#undef __DECLARE_TEMPLATES
+
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "las_file.hpp"
+#include "voxel_axis.hpp"
+
+namespace grid {
+
+  /// Sparse counterpart of `GridFile` for high resolutions
+  ///
+  /// Only the bricks of `BRICK_SIZE`^3 voxels that hold points are
+  /// allocated, so memory follows the occupancy rather than the size of
+  /// the grid. The bricks are spread over `SHARD_COUNT` hash maps by their
+  /// key, which lets voxelization fill every shard from its own task.
+  /// Each axis may have up to `MAX_SIZE` voxels
+  class SparseGridFile {
+  public:
+    static constexpr uint32_t BRICK_BITS = 3;
+    static constexpr uint32_t BRICK_SIZE = 1 << BRICK_BITS;
+    static constexpr uint32_t BRICK_VOXELS =
+      BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+    static constexpr uint32_t SHARD_COUNT = 256;
+    static constexpr uint32_t MAX_SIZE = 1 << 21;
+
+    /// Voxel values of a brick, Z first like the dense grid
+    using Brick = std::array<uint16_t, BRICK_VOXELS>;
+
+    SparseGridFile() = default;
+    SparseGridFile(const std::string & path) {
+      load(path);
+    }
+    template<int N>
+    SparseGridFile(las::LASFile<N> & lasFile,
+                   uint32_t sizeX,
+                   uint32_t sizeY,
+                   uint32_t sizeZ) {
+      convert(lasFile, sizeX, sizeY, sizeZ);
+    }
+
+    void save(std::string path) const;
+    void load(const std::string & path);
+
+    /// Streams the points of `lasFile` into the grid, with the same
+    /// mapping as `GridFile::convert`
+    template<int N>
+    void convert(las::LASFile<N> & lasFile,
+                 uint32_t sizeX,
+                 uint32_t sizeY,
+                 uint32_t sizeZ);
+
+    /// Clears the grid and maps it over the bounds of `header`, so that
+    /// points can be added one at a time with `add`
+    void prepare(const las::PublicHeader & header,
+                 uint32_t sizeX,
+                 uint32_t sizeY,
+                 uint32_t sizeZ);
+
+    /// Increments the voxel of a point given in the quantized coordinates
+    /// of the header passed to `prepare`. Points outside of the header
+    /// bounds are clamped to the border voxels
+    void add(uint32_t x, uint32_t y, uint32_t z);
+
+    /// Value of a voxel, zero if its brick is not allocated
+    uint16_t value(uint32_t x, uint32_t y, uint32_t z) const;
+
+    /// Voxels of the brick at the given brick coordinates, indexed by
+    /// `voxelInBrick`, or null if it is not allocated
+    const uint16_t * brick(uint32_t brickX,
+                           uint32_t brickY,
+                           uint32_t brickZ) const;
+
+    /// Calls `func(brickX, brickY, brickZ, brick)` for every allocated brick
+    template <typename F>
+    void forEachBrick(const F & func) const {
+      for (const Shard & shard : mShards) {
+        for (const auto & entry : shard.index) {
+          func(static_cast<uint32_t>(entry.first >> 42),
+               static_cast<uint32_t>((entry.first >> 21) & KEY_MASK),
+               static_cast<uint32_t>(entry.first & KEY_MASK),
+               shard.bricks[entry.second]);
+        }
+      }
+    }
+
+    uint64_t brickCount() const;
+
+    uint32_t sizeX() const { return mHeader.sizeX; }
+    uint32_t sizeY() const { return mHeader.sizeY; }
+    uint32_t sizeZ() const { return mHeader.sizeZ; }
+    uint16_t maxValue() const { return mHeader.maxValue; }
+
+    static uint64_t brickKey(uint32_t brickX, uint32_t brickY, uint32_t brickZ) {
+      return (static_cast<uint64_t>(brickX) << 42)
+        | (static_cast<uint64_t>(brickY) << 21)
+        | brickZ;
+    }
+
+    static uint32_t voxelInBrick(uint32_t x, uint32_t y, uint32_t z) {
+      constexpr uint32_t mask = BRICK_SIZE - 1;
+      return ((x & mask) << (2 * BRICK_BITS))
+        | ((y & mask) << BRICK_BITS)
+        | (z & mask);
+    }
+
+  private:
+    static constexpr uint64_t KEY_MASK = (1ull << 21) - 1;
+
+    /// Bricks of the keys that hash to the shard
+    struct Shard {
+      std::unordered_map<uint64_t, uint32_t> index;
+      std::vector<Brick> bricks;
+
+      /// Index of the brick of `key`, which is allocated if needed
+      uint32_t allocate(uint64_t key);
+    };
+
+    static uint32_t shardOf(uint64_t key) {
+      return static_cast<uint32_t>((key * 0x9E3779B97F4A7C15ull) >> 56);
+    }
+
+    /// Voxel along `axis` of a quantized coordinate, clamped to the
+    /// border voxels
+    uint32_t voxelAlong(int axis, uint32_t value) const;
+
+#pragma pack(push, 1)
+    struct SparseGridHeader {
+      char signature[4] = { 'C', 'L', 'S', 'G' };
+      uint32_t sizeX;
+      uint32_t sizeY;
+      uint32_t sizeZ;
+      double xFactor = 1;
+      double yFactor = 1;
+      double zFactor = 1;
+      uint16_t maxValue;
+      uint64_t brickCount;
+    };
+#pragma pack(pop)
+
+    /// Maps quantized coordinates to voxels; set by `prepare`
+    std::array<VoxelAxis, 3> mAxes;
+
+    std::vector<Shard> mShards = std::vector<Shard>(SHARD_COUNT);
+    SparseGridHeader mHeader;
+  };
+
+}
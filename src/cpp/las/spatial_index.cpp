@@ -0,0 +1,296 @@
+#include "spatial_index.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+#include <clest/ostream.hpp>
+
+#ifdef _CMAKE_TBB_FOUND
+#include <tbb/parallel_invoke.h>
+#endif
+
+namespace {
+
+  /// Ranges up to this size are leaves, which are scanned linearly
+  constexpr uint32_t LEAF_SIZE = 8;
+
+  /// Ranges above this size build their halves in parallel
+  constexpr uint32_t PARALLEL_SIZE = 0x10000;
+
+  /// Enough for the depth of a tree over 2^32 points
+  constexpr int STACK_SIZE = 64;
+
+  /// A pending range of the traversal, with a lower bound on the
+  /// squared distance from the query to any of its points
+  struct Range {
+    uint32_t begin;
+    uint32_t end;
+    double bound;
+  };
+}
+
+namespace las {
+
+  SpatialIndex::SpatialIndex(const uint32_t * x,
+                             const uint32_t * y,
+                             const uint32_t * z,
+                             uint64_t count,
+                             double xScale,
+                             double yScale,
+                             double zScale) :
+    mScale{ xScale, yScale, zScale } {
+    if (count >= INVALID) {
+      throw clest::Exception::build(
+        "Cannot index {} points; the limit is {}", count, INVALID - 1);
+    }
+
+    mIndex.resize(count);
+    build(x, y, z);
+  }
+
+  template <int N>
+  SpatialIndex::SpatialIndex(const std::vector<PointData<N>> & points,
+                             double xScale,
+                             double yScale,
+                             double zScale) :
+    mScale{ xScale, yScale, zScale } {
+    if (points.size() >= INVALID) {
+      throw clest::Exception::build(
+        "Cannot index {} points; the limit is {}", points.size(), INVALID - 1);
+    }
+
+    // The coordinates are packed with the rest of the record, so take
+    // a SoA copy first
+    std::vector<uint32_t> x(points.size());
+    std::vector<uint32_t> y(points.size());
+    std::vector<uint32_t> z(points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+      x[i] = points[i].x;
+      y[i] = points[i].y;
+      z[i] = points[i].z;
+    }
+
+    mIndex.resize(points.size());
+    build(x.data(), y.data(), z.data());
+  }
+
+  /// Builds the tree into `mIndex` and `mAxis`, then gathers the
+  /// coordinates in tree order. `mIndex` must already be sized
+  void SpatialIndex::build(const uint32_t * x,
+                           const uint32_t * y,
+                           const uint32_t * z) {
+    const uint32_t count = static_cast<uint32_t>(mIndex.size());
+    std::iota(mIndex.begin(), mIndex.end(), 0);
+    mAxis.assign(count, 0);
+
+    const uint32_t * const coordinates[3] = { x, y, z };
+    buildRange(coordinates, 0, count);
+
+    mX.resize(count);
+    mY.resize(count);
+    mZ.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+      mX[i] = x[mIndex[i]];
+      mY[i] = y[mIndex[i]];
+      mZ[i] = z[mIndex[i]];
+    }
+  }
+
+  /// Splits the range at its median along the axis of largest extent
+  /// The halves are disjoint, so they are built concurrently
+  void SpatialIndex::buildRange(const uint32_t * const coordinates[3],
+                                uint32_t begin,
+                                uint32_t end) {
+    if (end - begin <= LEAF_SIZE) {
+      return;
+    }
+
+    uint32_t min[3] = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF };
+    uint32_t max[3] = { 0, 0, 0 };
+    for (uint32_t i = begin; i < end; ++i) {
+      for (int a = 0; a < 3; ++a) {
+        uint32_t value = coordinates[a][mIndex[i]];
+        min[a] = std::min(min[a], value);
+        max[a] = std::max(max[a], value);
+      }
+    }
+
+    uint8_t axis = 0;
+    double extent = -1;
+    for (uint8_t a = 0; a < 3; ++a) {
+      double current = static_cast<double>(max[a] - min[a]) * mScale[a];
+      if (current > extent) {
+        extent = current;
+        axis = a;
+      }
+    }
+
+    const uint32_t mid = begin + (end - begin) / 2;
+    const uint32_t * values = coordinates[axis];
+    std::nth_element(mIndex.begin() + begin,
+                     mIndex.begin() + mid,
+                     mIndex.begin() + end,
+                     [values](uint32_t a, uint32_t b) {
+      return values[a] < values[b];
+    });
+    mAxis[mid] = axis;
+
+#ifdef _CMAKE_TBB_FOUND
+    if (end - begin > PARALLEL_SIZE) {
+      tbb::parallel_invoke(
+        [&] { buildRange(coordinates, begin, mid); },
+        [&] { buildRange(coordinates, mid + 1, end); });
+      return;
+    }
+#endif
+    buildRange(coordinates, begin, mid);
+    buildRange(coordinates, mid + 1, end);
+  }
+
+  void SpatialIndex::knn(uint32_t x,
+                         uint32_t y,
+                         uint32_t z,
+                         unsigned int k,
+                         std::vector<Neighbor> & result) const {
+    result.clear();
+    if (k == 0 || mIndex.empty()) {
+      return;
+    }
+
+    const double query[3] = { static_cast<double>(x),
+                              static_cast<double>(y),
+                              static_cast<double>(z) };
+    const uint32_t * const coordinates[3] = { mX.data(), mY.data(), mZ.data() };
+
+    // `result` is kept as a max heap of the best `k` so far
+    auto consider = [&](uint32_t i) {
+      double dx = (query[0] - mX[i]) * mScale[0];
+      double dy = (query[1] - mY[i]) * mScale[1];
+      double dz = (query[2] - mZ[i]) * mScale[2];
+      double distance2 = dx * dx + dy * dy + dz * dz;
+
+      if (result.size() < k) {
+        result.push_back({ mIndex[i], distance2 });
+        std::push_heap(result.begin(), result.end());
+      } else if (distance2 < result.front().distance2) {
+        std::pop_heap(result.begin(), result.end());
+        result.back() = { mIndex[i], distance2 };
+        std::push_heap(result.begin(), result.end());
+      }
+    };
+
+    Range stack[STACK_SIZE];
+    int top = 0;
+    stack[top++] = { 0, static_cast<uint32_t>(mIndex.size()), 0 };
+
+    while (top > 0) {
+      const Range range = stack[--top];
+      if (result.size() == k && range.bound > result.front().distance2) {
+        continue;
+      }
+
+      if (range.end - range.begin <= LEAF_SIZE) {
+        for (uint32_t i = range.begin; i < range.end; ++i) {
+          consider(i);
+        }
+        continue;
+      }
+
+      const uint32_t mid = range.begin + (range.end - range.begin) / 2;
+      const uint8_t axis = mAxis[mid];
+      consider(mid);
+
+      // Visit the side of the query first; the other side is only
+      // reached if the splitting plane is closer than the current worst
+      const double difference =
+        (query[axis] - coordinates[axis][mid]) * mScale[axis];
+      const double bound = std::max(range.bound, difference * difference);
+      if (difference < 0) {
+        stack[top++] = { mid + 1, range.end, bound };
+        stack[top++] = { range.begin, mid, range.bound };
+      } else {
+        stack[top++] = { range.begin, mid, bound };
+        stack[top++] = { mid + 1, range.end, range.bound };
+      }
+    }
+
+    std::sort_heap(result.begin(), result.end());
+  }
+
+  void SpatialIndex::radius(uint32_t x,
+                            uint32_t y,
+                            uint32_t z,
+                            double radius,
+                            std::vector<Neighbor> & result) const {
+    result.clear();
+    if (mIndex.empty() || radius < 0) {
+      return;
+    }
+
+    const double radius2 = radius * radius;
+    const double query[3] = { static_cast<double>(x),
+                              static_cast<double>(y),
+                              static_cast<double>(z) };
+    const uint32_t * const coordinates[3] = { mX.data(), mY.data(), mZ.data() };
+
+    auto consider = [&](uint32_t i) {
+      double dx = (query[0] - mX[i]) * mScale[0];
+      double dy = (query[1] - mY[i]) * mScale[1];
+      double dz = (query[2] - mZ[i]) * mScale[2];
+      double distance2 = dx * dx + dy * dy + dz * dz;
+
+      if (distance2 <= radius2) {
+        result.push_back({ mIndex[i], distance2 });
+      }
+    };
+
+    Range stack[STACK_SIZE];
+    int top = 0;
+    stack[top++] = { 0, static_cast<uint32_t>(mIndex.size()), 0 };
+
+    while (top > 0) {
+      const Range range = stack[--top];
+      if (range.bound > radius2) {
+        continue;
+      }
+
+      if (range.end - range.begin <= LEAF_SIZE) {
+        for (uint32_t i = range.begin; i < range.end; ++i) {
+          consider(i);
+        }
+        continue;
+      }
+
+      const uint32_t mid = range.begin + (range.end - range.begin) / 2;
+      const uint8_t axis = mAxis[mid];
+      consider(mid);
+
+      const double difference =
+        (query[axis] - coordinates[axis][mid]) * mScale[axis];
+      const double bound = std::max(range.bound, difference * difference);
+      if (difference < 0) {
+        stack[top++] = { mid + 1, range.end, bound };
+        stack[top++] = { range.begin, mid, range.bound };
+      } else {
+        stack[top++] = { range.begin, mid, bound };
+        stack[top++] = { mid + 1, range.end, range.bound };
+      }
+    }
+  }
+
+#define __DECLARE_TEMPLATES(index)\
+  template SpatialIndex::SpatialIndex(\
+    const std::vector<PointData<index>> & points,\
+    double xScale,\
+    double yScale,\
+    double zScale);
+
+  __DECLARE_TEMPLATES(-1)
+  __DECLARE_TEMPLATES(0)
+  __DECLARE_TEMPLATES(1)
+  __DECLARE_TEMPLATES(2)
+  __DECLARE_TEMPLATES(3)
+#undef __DECLARE_TEMPLATES
+
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "point_data.hpp"
+
+#ifdef _CMAKE_TBB_FOUND
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#endif
+
+namespace las {
+
+  /// Neighbor search over quantized LAS coordinates
+  ///
+  /// An implicit kd-tree: the points are reordered so that every range
+  /// [begin, end) of the tree holds its splitting point at the middle,
+  /// with the lower half before it and the upper half after it. Only the
+  /// split axis of each node is stored, so the index takes 17 bytes per
+  /// point (the reordered `uint32_t` coordinates, the original index and
+  /// the axis), instead of a 24 bytes `Point_3` copy plus a tree
+  ///
+  /// Distances are measured after applying the per axis scales, so an
+  /// index built with the header scale factors works in real units
+  class SpatialIndex {
+  public:
+    static constexpr uint32_t INVALID = 0xFFFFFFFF;
+
+    struct Neighbor {
+      uint32_t index;
+      double distance2;
+
+      bool operator<(const Neighbor & other) const {
+        return distance2 < other.distance2;
+      }
+    };
+
+    SpatialIndex() = default;
+
+    /// Indexes `count` points given as separate coordinate arrays
+    SpatialIndex(const uint32_t * x,
+                 const uint32_t * y,
+                 const uint32_t * z,
+                 uint64_t count,
+                 double xScale = 1,
+                 double yScale = 1,
+                 double zScale = 1);
+
+    template <int N>
+    SpatialIndex(const std::vector<PointData<N>> & points,
+                 double xScale = 1,
+                 double yScale = 1,
+                 double zScale = 1);
+
+    uint64_t size() const { return mIndex.size(); }
+
+    /// Finds the `k` nearest points, sorted by increasing distance
+    /// A query on an indexed point finds the point itself first
+    void knn(uint32_t x,
+             uint32_t y,
+             uint32_t z,
+             unsigned int k,
+             std::vector<Neighbor> & result) const;
+
+    /// Finds the points within `radius`, in no particular order
+    void radius(uint32_t x,
+                uint32_t y,
+                uint32_t z,
+                double radius,
+                std::vector<Neighbor> & result) const;
+
+    /// Runs the kNN query of each of the `count` points of `qx/y/z`
+    /// in parallel, calling `visit(query, neighbors)` with the query
+    /// position and a `std::vector<Neighbor>` sorted by distance
+    template <typename F>
+    void knnBatch(const uint32_t * qx,
+                  const uint32_t * qy,
+                  const uint32_t * qz,
+                  uint64_t count,
+                  unsigned int k,
+                  const F & visit) const {
+      _forEach(count, [&](uint64_t i, std::vector<Neighbor> & neighbors) {
+        knn(qx[i], qy[i], qz[i], k, neighbors);
+        visit(i, neighbors);
+      });
+    }
+
+    /// Radius counterpart of `knnBatch`
+    template <typename F>
+    void radiusBatch(const uint32_t * qx,
+                     const uint32_t * qy,
+                     const uint32_t * qz,
+                     uint64_t count,
+                     double radius,
+                     const F & visit) const {
+      _forEach(count, [&](uint64_t i, std::vector<Neighbor> & neighbors) {
+        this->radius(qx[i], qy[i], qz[i], radius, neighbors);
+        visit(i, neighbors);
+      });
+    }
+
+    /// Runs the kNN query of every indexed point in parallel
+    ///
+    /// The queries run in tree order, so consecutive queries share most
+    /// of their traversal, but `visit` receives the original index
+    template <typename F>
+    void knnAll(unsigned int k, const F & visit) const {
+      _forEach(size(), [&](uint64_t i, std::vector<Neighbor> & neighbors) {
+        knn(mX[i], mY[i], mZ[i], k, neighbors);
+        visit(static_cast<uint64_t>(mIndex[i]), neighbors);
+      });
+    }
+
+    /// Radius counterpart of `knnAll`
+    template <typename F>
+    void radiusAll(double radius, const F & visit) const {
+      _forEach(size(), [&](uint64_t i, std::vector<Neighbor> & neighbors) {
+        this->radius(mX[i], mY[i], mZ[i], radius, neighbors);
+        visit(static_cast<uint64_t>(mIndex[i]), neighbors);
+      });
+    }
+
+  private:
+    /// Calls `func(i, scratch)` for every `i` below `count`, with a
+    /// result vector that is reused within each parallel range
+    template <typename F>
+    static void _forEach(uint64_t count, const F & func) {
+#ifdef _CMAKE_TBB_FOUND
+      tbb::blocked_range<uint64_t> block(0, count);
+      tbb::parallel_for(block, [&](const tbb::blocked_range<uint64_t> & range) {
+        std::vector<Neighbor> neighbors;
+        for (uint64_t i = range.begin(); i != range.end(); ++i) {
+          func(i, neighbors);
+        }
+      });
+#else
+      std::vector<Neighbor> neighbors;
+      for (uint64_t i = 0; i < count; ++i) {
+        func(i, neighbors);
+      }
+#endif
+    }
+
+    void build(const uint32_t * x, const uint32_t * y, const uint32_t * z);
+    void buildRange(const uint32_t * const coordinates[3],
+                    uint32_t begin,
+                    uint32_t end);
+
+    double mScale[3] = { 1, 1, 1 };
+    std::vector<uint32_t> mX;
+    std::vector<uint32_t> mY;
+    std::vector<uint32_t> mZ;
+    std::vector<uint32_t> mIndex;
+    std::vector<uint8_t> mAxis;
+  };
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "public_header.hpp"
+
+namespace grid {
+
+  /// Maps the quantized coordinates of one LAS axis to the voxels of a
+  /// grid spanning the header bounds along it. Coordinates outside of the
+  /// bounds are clamped to the border voxels
+  struct VoxelAxis {
+    double step = 1;
+    double offset = 0;
+    uint32_t size = 1;
+
+    VoxelAxis() = default;
+
+    VoxelAxis(double min, double max, double scale, double lasOffset,
+              uint32_t voxels) :
+      step((max - min) / (voxels * scale)),
+      offset((min - lasOffset) / scale),
+      size(voxels) {}
+
+    uint32_t voxelOf(uint32_t value) const {
+      double local = (value - offset) / step;
+
+      // Also catches the NaN of a flat axis
+      local = local >= 0 ? local : 0;
+      return local >= size ? size - 1 : static_cast<uint32_t>(local);
+    }
+
+    /// Lowest quantized coordinate mapped to `voxel` or higher, or 2^32
+    /// if no coordinate is. The mapping is monotonic, so it is found by
+    /// bisection
+    uint64_t threshold(uint32_t voxel) const {
+      uint64_t low = 0;
+      uint64_t high = 0x100000000;
+      while (low < high) {
+        uint64_t middle = (low + high) / 2;
+        if (voxelOf(static_cast<uint32_t>(middle)) >= voxel) {
+          high = middle;
+        } else {
+          low = middle + 1;
+        }
+      }
+      return low;
+    }
+  };
+
+  /// Mappings of the X, Y and Z axes of `header` to `sizeX`, `sizeY` and
+  /// `sizeZ` voxels
+  inline std::array<VoxelAxis, 3> voxelAxes(const las::PublicHeader & header,
+                                            uint32_t sizeX,
+                                            uint32_t sizeY,
+                                            uint32_t sizeZ) {
+    return { { VoxelAxis(header.minX, header.maxX,
+                         header.xScaleFactor, header.xOffset, sizeX),
+               VoxelAxis(header.minY, header.maxY,
+                         header.yScaleFactor, header.yOffset, sizeY),
+               VoxelAxis(header.minZ, header.maxZ,
+                         header.zScaleFactor, header.zOffset, sizeZ) } };
+  }
+}
@@ -0,0 +1,684 @@
+#include "wlop.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <random>
+
+#include <clest/ostream.hpp>
+
+#include "parallel.hpp"
+#include "spatial_index.hpp"
+
+namespace {
+
+  /// Number of independent accumulators used by the neighbor loops
+  /// Each lane only depends on itself, so the compiler is free to map
+  /// the lanes into vector registers without reassociating the sums
+  constexpr int LANES = 8;
+
+  /// Approximates `exp(x)` for `x <= 0` by splitting `x * log2(e)` into
+  /// integer and fractional parts, evaluating `2^fraction` with a
+  /// polynomial and building `2^integer` directly in the exponent bits
+  ///
+  /// The relative error is below 1e-6 and the function is branchless,
+  /// so it vectorizes inside the neighbor loops
+  inline float _fastExp(float x) {
+    x = x < -87.0f ? -87.0f : x;
+    float t = x * 1.44269504f;
+
+    // Floor without calling `std::floor`, which does not vectorize
+    // on every target
+    int32_t integer = static_cast<int32_t>(t);
+    integer -= t < static_cast<float>(integer) ? 1 : 0;
+    float fraction = t - static_cast<float>(integer);
+
+    float power = 1.8775767e-3f;
+    power = power * fraction + 8.9893397e-3f;
+    power = power * fraction + 5.5826318e-2f;
+    power = power * fraction + 2.4015361e-1f;
+    power = power * fraction + 6.9315308e-1f;
+    power = power * fraction + 9.9999994e-1f;
+
+    int32_t bits = (integer + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(float));
+    return power * scale;
+  }
+
+  /// Fixed radius neighbor index over a uniform grid
+  ///
+  /// The cell size equals the query radius and the cells are hashed
+  /// into a power of two table of buckets. The points are placed with
+  /// a counting sort into contiguous SoA arrays, so a query consists of
+  /// at most 27 contiguous spans
+  class GridIndex {
+  public:
+    explicit GridIndex(float cellSize) :
+      mCellSize(cellSize),
+      mInverseCellSize(1.0f / cellSize) {}
+
+    /// Sorts the points of `cloud` into the grid
+    /// The sorted coordinates are available through `x()`, `y()`, `z()`
+    void build(const las::wlop::FloatCloud & cloud) {
+      const size_t size = cloud.size();
+
+      if (size > 0xFFFFFFFF) {
+        throw clest::Exception::build(
+          "Cannot index {} points; the limit is {}", size, 0xFFFFFFFF);
+      }
+
+      // Counted in 64 bits, since 2^32 buckets overflow the mask type
+      uint64_t mask = 1;
+      while (mask < size) { mask <<= 1; }
+      mMask = static_cast<uint32_t>(mask - 1);
+
+      mMinX = size > 0 ? *std::min_element(cloud.x.begin(), cloud.x.end()) : 0;
+      mMinY = size > 0 ? *std::min_element(cloud.y.begin(), cloud.y.end()) : 0;
+      mMinZ = size > 0 ? *std::min_element(cloud.z.begin(), cloud.z.end()) : 0;
+
+      // Counting sort: histogram, exclusive prefix sum, scatter
+      std::vector<uint32_t> buckets(size);
+      las::parallelFor(size, [&](size_t i) {
+        buckets[i] = bucket(cloud.x[i], cloud.y[i], cloud.z[i]);
+      });
+
+      mOffsets.assign(static_cast<size_t>(mMask) + 2, 0);
+      for (size_t i = 0; i < size; ++i) {
+        mOffsets[buckets[i] + 1]++;
+      }
+      std::partial_sum(mOffsets.begin(), mOffsets.end(), mOffsets.begin());
+
+      mX.resize(size);
+      mY.resize(size);
+      mZ.resize(size);
+      mOrder.resize(size);
+      std::vector<uint32_t> cursor(mOffsets.begin(), mOffsets.end() - 1);
+      for (size_t i = 0; i < size; ++i) {
+        uint32_t position = cursor[buckets[i]]++;
+        mX[position] = cloud.x[i];
+        mY[position] = cloud.y[i];
+        mZ[position] = cloud.z[i];
+        mOrder[position] = static_cast<uint32_t>(i);
+      }
+    }
+
+    size_t size() const { return mX.size(); }
+    const std::vector<float> & x() const { return mX; }
+    const std::vector<float> & y() const { return mY; }
+    const std::vector<float> & z() const { return mZ; }
+
+    /// Position in the indexed cloud of each sorted point
+    const std::vector<uint32_t> & order() const { return mOrder; }
+
+    /// Calls `func(begin, end)` for each span of sorted positions that may
+    /// hold points within one cell of the query. Spans are not filtered by
+    /// distance and may contain points from colliding cells
+    template <typename F>
+    void forEachSpan(float x, float y, float z, const F & func) const {
+      const int64_t cx = cell(x, mMinX);
+      const int64_t cy = cell(y, mMinY);
+      const int64_t cz = cell(z, mMinZ);
+
+      // Neighboring cells may collide into the same bucket; only visit once
+      uint32_t visited[27];
+      int visitedCount = 0;
+
+      for (int64_t i = cx - 1; i <= cx + 1; ++i) {
+        for (int64_t j = cy - 1; j <= cy + 1; ++j) {
+          for (int64_t k = cz - 1; k <= cz + 1; ++k) {
+            const uint32_t current = hash(i, j, k);
+            if (std::find(visited, visited + visitedCount, current)
+                != visited + visitedCount) {
+              continue;
+            }
+            visited[visitedCount++] = current;
+
+            if (mOffsets[current] != mOffsets[current + 1]) {
+              func(mOffsets[current], mOffsets[current + 1]);
+            }
+          }
+        }
+      }
+    }
+
+  private:
+    int64_t cell(float value, float min) const {
+      return static_cast<int64_t>(std::floor((value - min) * mInverseCellSize));
+    }
+
+    uint32_t hash(int64_t x, int64_t y, int64_t z) const {
+      return static_cast<uint32_t>(
+        (static_cast<uint64_t>(x) * 73856093u)
+        ^ (static_cast<uint64_t>(y) * 19349663u)
+        ^ (static_cast<uint64_t>(z) * 83492791u)) & mMask;
+    }
+
+    uint32_t bucket(float x, float y, float z) const {
+      return hash(cell(x, mMinX), cell(y, mMinY), cell(z, mMinZ));
+    }
+
+    const float mCellSize;
+    const float mInverseCellSize;
+    float mMinX = 0;
+    float mMinY = 0;
+    float mMinZ = 0;
+    uint32_t mMask = 0;
+    std::vector<uint32_t> mOffsets;
+    std::vector<float> mX;
+    std::vector<float> mY;
+    std::vector<float> mZ;
+    std::vector<uint32_t> mOrder;
+  };
+
+  /// Shared constants of the neighbor loops
+  struct Kernel {
+    float radius2;
+    float exponent;
+
+    explicit Kernel(float radius) :
+      radius2(radius * radius),
+      exponent(-4.0f / (radius * radius)) {}
+  };
+
+  /// Sum of `exp(-4 * d^2 / r^2)` over the span, skipping
+  /// neighbors closer than `sqrt(minimum2)`
+  inline float _densitySum(const float * x,
+                           const float * y,
+                           const float * z,
+                           size_t count,
+                           float qx,
+                           float qy,
+                           float qz,
+                           const Kernel & kernel,
+                           float minimum2) {
+    float sum[LANES] = {};
+    size_t i = 0;
+    for (; i + LANES <= count; i += LANES) {
+      for (int l = 0; l < LANES; ++l) {
+        float dx = x[i + l] - qx;
+        float dy = y[i + l] - qy;
+        float dz = z[i + l] - qz;
+        float d2 = dx * dx + dy * dy + dz * dz;
+        float inside = d2 <= kernel.radius2 && d2 >= minimum2 ? 1.0f : 0.0f;
+        sum[l] += inside * _fastExp(d2 * kernel.exponent);
+      }
+    }
+    for (; i < count; ++i) {
+      float dx = x[i] - qx;
+      float dy = y[i] - qy;
+      float dz = z[i] - qz;
+      float d2 = dx * dx + dy * dy + dz * dz;
+      if (d2 <= kernel.radius2 && d2 >= minimum2) {
+        sum[0] += _fastExp(d2 * kernel.exponent);
+      }
+    }
+    return std::accumulate(sum, sum + LANES, 0.0f);
+  }
+
+  /// Accumulator for the average (theta) and repulsion (alpha/beta) terms
+  /// Offsets are stored relative to the query point
+  struct Term {
+    float weight = 0;
+    float x = 0;
+    float y = 0;
+    float z = 0;
+    uint32_t count = 0;
+  };
+
+  /// Accumulates the average term over a span of original points
+  /// `density` is aligned with the span and is ignored if null
+  template <bool Weighted>
+  inline void _averageTerm(const float * x,
+                           const float * y,
+                           const float * z,
+                           const float * density,
+                           size_t count,
+                           float qx,
+                           float qy,
+                           float qz,
+                           const Kernel & kernel,
+                           Term & term) {
+    float weight[LANES] = {};
+    float sumX[LANES] = {};
+    float sumY[LANES] = {};
+    float sumZ[LANES] = {};
+    float inRange[LANES] = {};
+
+    size_t i = 0;
+    for (; i + LANES <= count; i += LANES) {
+      for (int l = 0; l < LANES; ++l) {
+        float dx = x[i + l] - qx;
+        float dy = y[i + l] - qy;
+        float dz = z[i + l] - qz;
+        float d2 = dx * dx + dy * dy + dz * dz;
+        float inside = d2 <= kernel.radius2 ? 1.0f : 0.0f;
+        float valid = d2 >= 1e-10f ? inside : 0.0f;
+        float w = valid * _fastExp(d2 * kernel.exponent);
+        if (Weighted) { w *= density[i + l]; }
+        inRange[l] += inside;
+        weight[l] += w;
+        sumX[l] += w * dx;
+        sumY[l] += w * dy;
+        sumZ[l] += w * dz;
+      }
+    }
+    for (; i < count; ++i) {
+      float dx = x[i] - qx;
+      float dy = y[i] - qy;
+      float dz = z[i] - qz;
+      float d2 = dx * dx + dy * dy + dz * dz;
+      if (d2 > kernel.radius2) { continue; }
+      inRange[0] += 1.0f;
+      if (d2 < 1e-10f) { continue; }
+      float w = _fastExp(d2 * kernel.exponent);
+      if (Weighted) { w *= density[i]; }
+      weight[0] += w;
+      sumX[0] += w * dx;
+      sumY[0] += w * dy;
+      sumZ[0] += w * dz;
+    }
+
+    term.weight += std::accumulate(weight, weight + LANES, 0.0f);
+    term.x += std::accumulate(sumX, sumX + LANES, 0.0f);
+    term.y += std::accumulate(sumY, sumY + LANES, 0.0f);
+    term.z += std::accumulate(sumZ, sumZ + LANES, 0.0f);
+    term.count += static_cast<uint32_t>(
+      std::accumulate(inRange, inRange + LANES, 0.0f));
+  }
+
+  /// Accumulates the repulsion term over a span of sample points
+  /// The L1 repulsion weight is `exp(-4 * d^2 / r^2) / d^2`, scaled
+  /// by the sample density
+  inline void _repulsionTerm(const float * x,
+                             const float * y,
+                             const float * z,
+                             const float * density,
+                             size_t count,
+                             float qx,
+                             float qy,
+                             float qz,
+                             const Kernel & kernel,
+                             Term & term) {
+    float weight[LANES] = {};
+    float sumX[LANES] = {};
+    float sumY[LANES] = {};
+    float sumZ[LANES] = {};
+    float inRange[LANES] = {};
+
+    size_t i = 0;
+    for (; i + LANES <= count; i += LANES) {
+      for (int l = 0; l < LANES; ++l) {
+        float dx = qx - x[i + l];
+        float dy = qy - y[i + l];
+        float dz = qz - z[i + l];
+        float d2 = dx * dx + dy * dy + dz * dz;
+        float inside = d2 <= kernel.radius2 ? 1.0f : 0.0f;
+        float valid = d2 >= 1e-10f ? inside : 0.0f;
+        float safe = d2 >= 1e-10f ? d2 : 1.0f;
+        float w = valid * _fastExp(d2 * kernel.exponent) / safe
+          * density[i + l];
+        inRange[l] += inside;
+        weight[l] += w;
+        sumX[l] += w * dx;
+        sumY[l] += w * dy;
+        sumZ[l] += w * dz;
+      }
+    }
+    for (; i < count; ++i) {
+      float dx = qx - x[i];
+      float dy = qy - y[i];
+      float dz = qz - z[i];
+      float d2 = dx * dx + dy * dy + dz * dz;
+      if (d2 > kernel.radius2) { continue; }
+      inRange[0] += 1.0f;
+      if (d2 < 1e-10f) { continue; }
+      float w = _fastExp(d2 * kernel.exponent) / d2 * density[i];
+      weight[0] += w;
+      sumX[0] += w * dx;
+      sumY[0] += w * dy;
+      sumZ[0] += w * dz;
+    }
+
+    term.weight += std::accumulate(weight, weight + LANES, 0.0f);
+    term.x += std::accumulate(sumX, sumX + LANES, 0.0f);
+    term.y += std::accumulate(sumY, sumY + LANES, 0.0f);
+    term.z += std::accumulate(sumZ, sumZ + LANES, 0.0f);
+    term.count += static_cast<uint32_t>(
+      std::accumulate(inRange, inRange + LANES, 0.0f));
+  }
+}
+
+namespace las {
+  namespace wlop {
+
+    std::vector<double> pointSpacings(const SpatialIndex & index) {
+      constexpr unsigned int NEIGHBORS = 6;
+
+      std::vector<double> spacings(index.size());
+      index.knnAll(NEIGHBORS + 1, [&](uint64_t i, const auto & neighbors) {
+        double sum = 0;
+        for (auto & neighbor : neighbors) {
+          sum += std::sqrt(neighbor.distance2);
+        }
+        spacings[i] = sum / neighbors.size();
+      });
+
+      return spacings;
+    }
+
+    double averageSpacing(const SpatialIndex & index) {
+      if (index.size() == 0) {
+        return 0;
+      }
+
+      std::vector<double> spacings = pointSpacings(index);
+      return std::accumulate(spacings.begin(), spacings.end(), 0.0)
+        / spacings.size();
+    }
+
+    /// The cloud is quantized over its largest extent, in steps far below
+    /// the float precision, to be indexed by a `SpatialIndex`
+    float estimateRadius(const FloatCloud & cloud) {
+      const size_t size = cloud.size();
+
+      if (size == 0) {
+        return 0;
+      }
+
+      const float minimum[3] = {
+        *std::min_element(cloud.x.begin(), cloud.x.end()),
+        *std::min_element(cloud.y.begin(), cloud.y.end()),
+        *std::min_element(cloud.z.begin(), cloud.z.end())
+      };
+      const float extent = std::max(
+        *std::max_element(cloud.x.begin(), cloud.x.end()) - minimum[0],
+        std::max(*std::max_element(cloud.y.begin(), cloud.y.end()) - minimum[1],
+                 *std::max_element(cloud.z.begin(), cloud.z.end()) - minimum[2]));
+
+      // All the points are the same
+      if (!(extent > 0)) {
+        return 0;
+      }
+
+      const double scale = extent / 4294967295.0;
+      auto quantize = [&](const std::vector<float> & values, float minimum) {
+        std::vector<uint32_t> quantized(size);
+        parallelFor(size, [&](size_t i) {
+          quantized[i] = static_cast<uint32_t>(std::min(
+            4294967295.0, std::round((values[i] - minimum) / scale)));
+        });
+        return quantized;
+      };
+      std::vector<uint32_t> x = quantize(cloud.x, minimum[0]);
+      std::vector<uint32_t> y = quantize(cloud.y, minimum[1]);
+      std::vector<uint32_t> z = quantize(cloud.z, minimum[2]);
+
+      SpatialIndex index(x.data(), y.data(), z.data(), size,
+                         scale, scale, scale);
+      return static_cast<float>(RADIUS_SPACINGS * averageSpacing(index));
+    }
+
+    /// The picks come from a fixed seed, so every backend starts from the
+    /// same samples for the same input
+    FloatCloud pickSamples(const FloatCloud & original,
+                           const double percentage) {
+      if (!(percentage > 0.0 && percentage <= 100.0)) {
+        throw clest::Exception("Percentage has to be from 0% to 100%");
+      }
+
+      FloatCloud samples;
+      samples.originX = original.originX;
+      samples.originY = original.originY;
+      samples.originZ = original.originZ;
+
+      size_t sampleCount = static_cast<size_t>(
+        original.size() * percentage / 100.0);
+      std::vector<uint32_t> picks(original.size());
+      std::iota(picks.begin(), picks.end(), 0);
+      std::shuffle(picks.begin(), picks.end(), std::mt19937(5489u));
+      picks.resize(sampleCount);
+
+      samples.resize(sampleCount);
+      for (size_t i = 0; i < sampleCount; ++i) {
+        samples.x[i] = original.x[picks[i]];
+        samples.y[i] = original.y[picks[i]];
+        samples.z[i] = original.z[picks[i]];
+      }
+
+      return samples;
+    }
+
+    /// Runs the WLOP iterations
+    ///
+    /// Every iteration sorts the samples into a grid, so all the per sample
+    /// loops run in grid order and their neighbor spans stay in cache
+    ///
+    /// With a positive `epsilon`, samples that moved less than `epsilon`
+    /// are frozen; the next iteration only recomputes the samples that
+    /// moved and their neighbors, and the loop ends early once no sample
+    /// moves. `iterations` is then only an upper bound
+    FloatCloud simplifyAndRegularize(const FloatCloud & original,
+                                     const double percentage,
+                                     float radius,
+                                     const unsigned int iterations,
+                                     const bool uniform,
+                                     const float epsilon) {
+      // Pick the samples at random, without repetition
+      FloatCloud samples = pickSamples(original, percentage);
+      const size_t sampleCount = samples.size();
+
+      if (sampleCount == 0) {
+        return samples;
+      }
+
+      if (!(radius > 0)) {
+        radius = estimateRadius(original);
+        clest::println("Estimated WLOP radius: {}", radius);
+      }
+      const Kernel kernel(radius);
+
+      GridIndex originalIndex(radius);
+      originalIndex.build(original);
+
+      // Density of the originals, aligned with the sorted positions
+      std::vector<float> originalDensity;
+      if (uniform) {
+        originalDensity.resize(originalIndex.size());
+        const float * x = originalIndex.x().data();
+        const float * y = originalIndex.y().data();
+        const float * z = originalIndex.z().data();
+        parallelFor(originalIndex.size(), [&](size_t i) {
+          float sum = 1.0f;
+          originalIndex.forEachSpan(x[i], y[i], z[i],
+                                    [&](uint32_t begin, uint32_t end) {
+            sum += _densitySum(x + begin, y + begin, z + begin, end - begin,
+                               x[i], y[i], z[i], kernel, 1e-8f);
+          });
+          originalDensity[i] = 1.0f / sum;
+        });
+      }
+
+      GridIndex sampleIndex(radius);
+      std::vector<float> sampleDensity(sampleCount);
+
+      // Active set bookkeeping, aligned with `samples`
+      // A sample is dirty when it moved at least `epsilon` in the previous
+      // iteration, or another sample that did was within its radius before
+      // or after moving. Only dirty samples have their density and
+      // position recomputed, which keeps the other densities exact
+      const bool tracking = epsilon > 0;
+      const float epsilon2 = epsilon * epsilon;
+      std::vector<uint8_t> moved(sampleCount, 1);
+      std::vector<uint8_t> sortedMoved;
+      std::vector<uint8_t> dirty(sampleCount, 1);
+      std::vector<float> sortedDensity;
+
+      // Positions of the moved samples before their last move
+      FloatCloud departed;
+      GridIndex departedIndex(radius);
+
+      for (unsigned int iteration = 0; iteration < iterations; ++iteration) {
+        sampleIndex.build(samples);
+        const float * sx = sampleIndex.x().data();
+        const float * sy = sampleIndex.y().data();
+        const float * sz = sampleIndex.z().data();
+        const uint32_t * order = sampleIndex.order().data();
+
+        // Carry the per sample state into the new sorted order
+        size_t dirtyCount = sampleCount;
+        if (tracking && iteration > 0) {
+          sortedMoved.resize(sampleCount);
+          sortedDensity.resize(sampleCount);
+          parallelFor(sampleCount, [&](size_t i) {
+            sortedMoved[i] = moved[order[i]];
+            sortedDensity[i] = sampleDensity[order[i]];
+          });
+          sampleDensity.swap(sortedDensity);
+
+          parallelFor(sampleCount, [&](size_t i) {
+            bool isDirty = sortedMoved[i] != 0;
+            if (!isDirty) {
+              sampleIndex.forEachSpan(sx[i], sy[i], sz[i],
+                                      [&](uint32_t begin, uint32_t end) {
+                for (uint32_t j = begin; !isDirty && j < end; ++j) {
+                  if (!sortedMoved[j]) { continue; }
+                  float dx = sx[j] - sx[i];
+                  float dy = sy[j] - sy[i];
+                  float dz = sz[j] - sz[i];
+                  isDirty = dx * dx + dy * dy + dz * dz <= kernel.radius2;
+                }
+              });
+            }
+            if (!isDirty) {
+              const float * px = departedIndex.x().data();
+              const float * py = departedIndex.y().data();
+              const float * pz = departedIndex.z().data();
+              departedIndex.forEachSpan(sx[i], sy[i], sz[i],
+                                        [&](uint32_t begin, uint32_t end) {
+                for (uint32_t j = begin; !isDirty && j < end; ++j) {
+                  float dx = px[j] - sx[i];
+                  float dy = py[j] - sy[i];
+                  float dz = pz[j] - sz[i];
+                  isDirty = dx * dx + dy * dy + dz * dz <= kernel.radius2;
+                }
+              });
+            }
+            dirty[i] = isDirty ? 1 : 0;
+          });
+          dirtyCount = std::count(dirty.begin(), dirty.end(), 1);
+        }
+
+        parallelFor(sampleCount, [&](size_t i) {
+          if (!dirty[i]) { return; }
+          float sum = 1.0f;
+          sampleIndex.forEachSpan(sx[i], sy[i], sz[i],
+                                  [&](uint32_t begin, uint32_t end) {
+            sum += _densitySum(sx + begin, sy + begin, sz + begin,
+                               end - begin, sx[i], sy[i], sz[i], kernel, 0.0f);
+          });
+          sampleDensity[i] = sum;
+        });
+
+        const float * ox = originalIndex.x().data();
+        const float * oy = originalIndex.y().data();
+        const float * oz = originalIndex.z().data();
+        const float * od = originalDensity.data();
+
+        // The sorted samples are read from the index and the updated
+        // positions are written into `samples`, so there is no aliasing
+        parallelFor(sampleCount, [&](size_t i) {
+          const float qx = sx[i];
+          const float qy = sy[i];
+          const float qz = sz[i];
+
+          if (!dirty[i]) {
+            samples.x[i] = qx;
+            samples.y[i] = qy;
+            samples.z[i] = qz;
+            moved[i] = 0;
+            return;
+          }
+
+          Term average;
+          originalIndex.forEachSpan(qx, qy, qz,
+                                    [&](uint32_t begin, uint32_t end) {
+            if (uniform) {
+              _averageTerm<true>(ox + begin, oy + begin, oz + begin,
+                                 od + begin, end - begin,
+                                 qx, qy, qz, kernel, average);
+            } else {
+              _averageTerm<false>(ox + begin, oy + begin, oz + begin,
+                                  nullptr, end - begin,
+                                  qx, qy, qz, kernel, average);
+            }
+          });
+
+          Term repulsion;
+          sampleIndex.forEachSpan(qx, qy, qz,
+                                  [&](uint32_t begin, uint32_t end) {
+            _repulsionTerm(sx + begin, sy + begin, sz + begin,
+                           sampleDensity.data() + begin, end - begin,
+                           qx, qy, qz, kernel, repulsion);
+          });
+
+          float x = qx;
+          float y = qy;
+          float z = qz;
+
+          if (average.count > 0 && average.weight >= 1e-10f) {
+            x += average.x / average.weight;
+            y += average.y / average.weight;
+            z += average.z / average.weight;
+          }
+
+          if (repulsion.count >= 3 && repulsion.weight >= 1e-10f) {
+            x += 0.45f * repulsion.x / repulsion.weight;
+            y += 0.45f * repulsion.y / repulsion.weight;
+            z += 0.45f * repulsion.z / repulsion.weight;
+          }
+
+          samples.x[i] = x;
+          samples.y[i] = y;
+          samples.z[i] = z;
+
+          float dx = x - qx;
+          float dy = y - qy;
+          float dz = z - qz;
+          moved[i] = dx * dx + dy * dy + dz * dz >= epsilon2 ? 1 : 0;
+        });
+
+        if (!tracking) {
+          clest::println("Float WLOP iteration {}/{}",
+                         iteration + 1, iterations);
+          continue;
+        }
+
+        size_t movedCount = std::count(moved.begin(), moved.end(), 1);
+        clest::println("Float WLOP iteration {}/{}: {} updated, {} moved",
+                       iteration + 1, iterations, dirtyCount, movedCount);
+
+        // The index still holds the positions before this iteration
+        departed.resize(0);
+        for (size_t i = 0; i < sampleCount; ++i) {
+          if (moved[i]) {
+            departed.x.push_back(sx[i]);
+            departed.y.push_back(sy[i]);
+            departed.z.push_back(sz[i]);
+          }
+        }
+        departedIndex.build(departed);
+
+        // Global stopping criterion: every sample is frozen
+        if (movedCount == 0) {
+          clest::println("Float WLOP converged after {} iterations",
+                         iteration + 1);
+          break;
+        }
+      }
+
+      return samples;
+    }
+  }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace las {
+  class SpatialIndex;
+
+  namespace wlop {
+
+    /// Structure of arrays of single precision coordinates
+    ///
+    /// The coordinates are stored relative to `origin`, so that quantized
+    /// LAS data keeps millimetre precision even when the absolute values
+    /// are too large for a `float`
+    struct FloatCloud {
+      double originX = 0;
+      double originY = 0;
+      double originZ = 0;
+
+      std::vector<float> x;
+      std::vector<float> y;
+      std::vector<float> z;
+
+      size_t size() const { return x.size(); }
+
+      void resize(size_t size) {
+        x.resize(size);
+        y.resize(size);
+        z.resize(size);
+      }
+    };
+
+    /// CGAL's WLOP radius, in average spacings
+    constexpr double RADIUS_SPACINGS = 8;
+
+    /// Spacing of every point of `index`, as in CGAL's
+    /// `compute_average_spacing`: its mean distance to its 6 nearest
+    /// neighbors and itself
+    std::vector<double> pointSpacings(const SpatialIndex & index);
+
+    /// Average of the `pointSpacings` of `index`
+    double averageSpacing(const SpatialIndex & index);
+
+    /// Estimates the WLOP radius as 8 times the average 6-NN spacing
+    float estimateRadius(const FloatCloud & cloud);
+
+    /// Picks `percentage`% of `original` at random, without repetition
+    /// The returned cloud shares the origin of `original`
+    FloatCloud pickSamples(const FloatCloud & original,
+                           const double percentage);
+
+    /// Single precision weighted locally optimal projection
+    ///
+    /// Equivalent to CGAL's `wlop_simplify_and_regularize_point_set`, but
+    /// working on `FloatCloud` with a hashed grid neighbor index and
+    /// vectorizable neighbor loops using a fast `exp` approximation
+    ///
+    /// If `radius` is not positive, it is estimated like CGAL does, as 8
+    /// times the average 6-NN spacing of `original`
+    ///
+    /// If `epsilon` is positive, samples that move less than `epsilon` in
+    /// an iteration are frozen until a neighbor moves again, and the
+    /// iterations stop once every sample is frozen
+    ///
+    /// The returned cloud shares the origin of `original`
+    FloatCloud simplifyAndRegularize(const FloatCloud & original,
+                                     const double percentage,
+                                     float radius,
+                                     const unsigned int iterations,
+                                     const bool uniform,
+                                     const float epsilon = 0);
+  }
+}
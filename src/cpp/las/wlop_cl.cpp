@@ -0,0 +1,254 @@
+#include "wlop_cl.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+#include <clest/ostream.hpp>
+
+#include "../cl/cl_runner.hpp"
+
+namespace {
+
+  /// Hashed grid of points held in device memory
+  ///
+  /// Mirrors the host grid index of the `FloatCloud` version: the points
+  /// are placed with a counting sort into `x`, `y`, `z`, and the points of
+  /// bucket `b` are found in the range [offsets[b], offsets[b + 1]).
+  /// The histogram is binned and scattered on the device, only the prefix
+  /// sum over the buckets runs on the host
+  class DeviceGrid {
+  public:
+    DeviceGrid(const cl::Context & context, size_t size) :
+      mSize(size),
+      mMask(_mask(size)),
+      x(context, CL_MEM_READ_WRITE, size * sizeof(cl_float)),
+      y(context, CL_MEM_READ_WRITE, size * sizeof(cl_float)),
+      z(context, CL_MEM_READ_WRITE, size * sizeof(cl_float)),
+      offsets(context, CL_MEM_READ_WRITE, (mMask + 2ull) * sizeof(cl_uint)),
+      mBuckets(context, CL_MEM_READ_WRITE, size * sizeof(cl_uint)),
+      mCursor(context, CL_MEM_READ_WRITE, (mMask + 1ull) * sizeof(cl_uint)),
+      mHistogram(mMask + 1ull),
+      mOffsets(mMask + 2ull) {}
+
+    /// Sorts the points of `sourceX/Y/Z` into the grid
+    template <typename Bin, typename Scatter>
+    void build(cl::CommandQueue & queue,
+               Bin & bin,
+               Scatter & scatter,
+               const cl::Buffer & sourceX,
+               const cl::Buffer & sourceY,
+               const cl::Buffer & sourceZ,
+               const cl_float3 & minimum,
+               const cl_float inverseCellSize) {
+      const cl::EnqueueArgs args(queue, cl::NDRange(mSize));
+
+      // The cursor doubles as the histogram while binning
+      std::fill(mHistogram.begin(), mHistogram.end(), 0);
+      cl::copy(queue, mHistogram.begin(), mHistogram.end(), mCursor);
+      bin(args,
+          sourceX, sourceY, sourceZ,
+          mBuckets, mCursor,
+          minimum, inverseCellSize, mMask, static_cast<cl_uint>(mSize));
+      cl::copy(queue, mCursor, mHistogram.begin(), mHistogram.end());
+
+      mOffsets[0] = 0;
+      std::partial_sum(mHistogram.begin(),
+                       mHistogram.end(),
+                       mOffsets.begin() + 1);
+      cl::copy(queue, mOffsets.begin(), mOffsets.end(), offsets);
+      cl::copy(queue, mOffsets.begin(), mOffsets.end() - 1, mCursor);
+
+      scatter(args,
+              sourceX, sourceY, sourceZ,
+              mBuckets, mCursor,
+              x, y, z,
+              static_cast<cl_uint>(mSize));
+    }
+
+    size_t size() const { return mSize; }
+    cl_uint mask() const { return mMask; }
+
+  private:
+    static cl_uint _mask(size_t size) {
+      size_t mask = 1;
+      while (mask < size) { mask <<= 1; }
+      return static_cast<cl_uint>(mask - 1);
+    }
+
+    const size_t mSize;
+    const cl_uint mMask;
+
+  public:
+    cl::Buffer x;
+    cl::Buffer y;
+    cl::Buffer z;
+    cl::Buffer offsets;
+
+  private:
+    cl::Buffer mBuckets;
+    cl::Buffer mCursor;
+    std::vector<cl_uint> mHistogram;
+    std::vector<cl_uint> mOffsets;
+  };
+
+  /// Creates a device buffer holding a copy of `values`
+  cl::Buffer _upload(const cl::Context & context,
+                     cl::CommandQueue & queue,
+                     const std::vector<float> & values) {
+    cl::Buffer buffer(context,
+                      CL_MEM_READ_WRITE,
+                      values.size() * sizeof(cl_float));
+    cl::copy(queue, values.begin(), values.end(), buffer);
+    return buffer;
+  }
+}
+
+namespace las {
+  namespace wlop {
+
+    /// Every iteration bins the samples, computes their densities and
+    /// writes the updated positions back into the unsorted sample buffers,
+    /// which are binned again by the next iteration
+    ///
+    /// The originals and the samples share the binning origin, so both
+    /// grids use the same cells
+    FloatCloud simplifyAndRegularize(clest::ClRunner & runner,
+                                     const FloatCloud & original,
+                                     const double percentage,
+                                     float radius,
+                                     const unsigned int iterations,
+                                     const bool uniform) {
+      // Pick the samples at random, without repetition
+      FloatCloud samples = pickSamples(original, percentage);
+      const size_t sampleCount = samples.size();
+      const size_t originalCount = original.size();
+
+      if (sampleCount == 0) {
+        return samples;
+      }
+
+      if (originalCount > 0xFFFFFFFF) {
+        throw clest::Exception::build(
+          "Cannot index {} points; the limit is {}", originalCount, 0xFFFFFFFF);
+      }
+
+      if (!(radius > 0)) {
+        radius = estimateRadius(original);
+        clest::println("Estimated WLOP radius: {}", radius);
+      }
+      const cl_float radius2 = radius * radius;
+      const cl_float exponent = -4.0f / radius2;
+      const cl_float inverseCellSize = 1.0f / radius;
+
+      if (!runner.hasProgram("lop")) {
+        runner.loadProgram("lop", "opencl/lop.cl");
+      }
+
+      try {
+        auto bin = runner.makeKernel<cl::Buffer, cl::Buffer, cl::Buffer,
+                                     cl::Buffer, cl::Buffer,
+                                     cl_float3, cl_float, cl_uint, cl_uint>(
+          "lop", "lopBin");
+        auto scatter = runner.makeKernel<cl::Buffer, cl::Buffer, cl::Buffer,
+                                         cl::Buffer, cl::Buffer,
+                                         cl::Buffer, cl::Buffer, cl::Buffer,
+                                         cl_uint>(
+          "lop", "lopScatter");
+        auto density = runner.makeKernel<cl::Buffer, cl::Buffer, cl::Buffer,
+                                         cl::Buffer, cl::Buffer,
+                                         cl_float3, cl_float, cl_uint,
+                                         cl_float, cl_float, cl_float,
+                                         cl_int, cl_uint>(
+          "lop", "lopDensity");
+        auto update = runner.makeKernel<cl::Buffer, cl::Buffer, cl::Buffer,
+                                        cl::Buffer, cl::Buffer,
+                                        cl::Buffer, cl::Buffer, cl::Buffer,
+                                        cl::Buffer, cl::Buffer,
+                                        cl::Buffer, cl::Buffer, cl::Buffer,
+                                        cl_float3, cl_float, cl_uint, cl_uint,
+                                        cl_float, cl_float, cl_int, cl_uint>(
+          "lop", "lopUpdate");
+
+        const cl::Context & context = runner.context();
+        cl::CommandQueue & queue = runner.queue();
+
+        cl_float3 minimum;
+        minimum.s[0] = *std::min_element(original.x.begin(), original.x.end());
+        minimum.s[1] = *std::min_element(original.y.begin(), original.y.end());
+        minimum.s[2] = *std::min_element(original.z.begin(), original.z.end());
+        minimum.s[3] = 0;
+
+        DeviceGrid originalGrid(context, originalCount);
+        {
+          cl::Buffer x = _upload(context, queue, original.x);
+          cl::Buffer y = _upload(context, queue, original.y);
+          cl::Buffer z = _upload(context, queue, original.z);
+          originalGrid.build(queue, bin, scatter,
+                             x, y, z, minimum, inverseCellSize);
+          queue.finish();
+        }
+
+        // Density of the originals, aligned with the sorted positions
+        cl::Buffer originalDensity(context,
+                                   CL_MEM_READ_WRITE,
+                                   (uniform ? originalCount : 1)
+                                   * sizeof(cl_float));
+        if (uniform) {
+          density(cl::EnqueueArgs(queue, cl::NDRange(originalCount)),
+                  originalGrid.x, originalGrid.y, originalGrid.z,
+                  originalGrid.offsets, originalDensity,
+                  minimum, inverseCellSize, originalGrid.mask(),
+                  radius2, exponent, 1e-8f, 1,
+                  static_cast<cl_uint>(originalCount));
+        }
+
+        cl::Buffer sampleX = _upload(context, queue, samples.x);
+        cl::Buffer sampleY = _upload(context, queue, samples.y);
+        cl::Buffer sampleZ = _upload(context, queue, samples.z);
+        cl::Buffer sampleDensity(context,
+                                 CL_MEM_READ_WRITE,
+                                 sampleCount * sizeof(cl_float));
+        DeviceGrid sampleGrid(context, sampleCount);
+
+        const cl::EnqueueArgs args(queue, cl::NDRange(sampleCount));
+        for (unsigned int iteration = 0; iteration < iterations; ++iteration) {
+          sampleGrid.build(queue, bin, scatter,
+                           sampleX, sampleY, sampleZ,
+                           minimum, inverseCellSize);
+
+          density(args,
+                  sampleGrid.x, sampleGrid.y, sampleGrid.z,
+                  sampleGrid.offsets, sampleDensity,
+                  minimum, inverseCellSize, sampleGrid.mask(),
+                  radius2, exponent, 0.0f, 0,
+                  static_cast<cl_uint>(sampleCount));
+
+          update(args,
+                 sampleGrid.x, sampleGrid.y, sampleGrid.z,
+                 sampleGrid.offsets, sampleDensity,
+                 originalGrid.x, originalGrid.y, originalGrid.z,
+                 originalGrid.offsets, originalDensity,
+                 sampleX, sampleY, sampleZ,
+                 minimum, inverseCellSize,
+                 sampleGrid.mask(), originalGrid.mask(),
+                 radius2, exponent, uniform ? 1 : 0,
+                 static_cast<cl_uint>(sampleCount));
+
+          queue.finish();
+          clest::println("OpenCL WLOP iteration {}/{}",
+                         iteration + 1, iterations);
+        }
+
+        cl::copy(queue, sampleX, samples.x.begin(), samples.x.end());
+        cl::copy(queue, sampleY, samples.y.begin(), samples.y.end());
+        cl::copy(queue, sampleZ, samples.z.begin(), samples.z.end());
+      } catch (cl::Error & err) {
+        throw clest::Exception::build("OpenCL error: {} ({})",
+                                      err.what(),
+                                      err.err());
+      }
+
+      return samples;
+    }
+  }
+}
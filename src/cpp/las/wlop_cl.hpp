@@ -0,0 +1,32 @@
+#pragma once
+
+#include "wlop.hpp"
+
+namespace clest {
+  class ClRunner;
+}
+
+namespace las {
+  namespace wlop {
+
+    /// OpenCL weighted locally optimal projection
+    ///
+    /// Runs the same iterations as the `FloatCloud` version with the
+    /// kernels of "opencl/lop.cl", which is loaded into `runner` as the
+    /// "lop" program if it is not loaded yet. The binning, the densities
+    /// and the updates all run on the device, and the points only travel
+    /// back to the host once the iterations are done
+    ///
+    /// Only single precision is required, so any device works, including
+    /// CPU runtimes such as POCL
+    ///
+    /// If `radius` is not positive, it is estimated like CGAL does, as 8
+    /// times the average 6-NN spacing of `original`
+    FloatCloud simplifyAndRegularize(clest::ClRunner & runner,
+                                     const FloatCloud & original,
+                                     const double percentage,
+                                     float radius,
+                                     const unsigned int iterations,
+                                     const bool uniform);
+  }
+}
@@ -21,8 +21,6 @@
 #ifndef CLEST_WLOP_SIMPLIFY_VERBOSE_HPP
 #define CLEST_WLOP_SIMPLIFY_VERBOSE_HPP
 
-#include <CGAL/Search_traits_3.h>
-#include <CGAL/Orthogonal_k_neighbor_search.h>
 #include <CGAL/property_map.h>
 #include <CGAL/point_set_processing_assertions.h>
 #include <CGAL/Memory_sizer.h>
@@ -33,6 +31,8 @@
 #include <algorithm>
 #include <cmath>
 #include <ctime>
+#include <atomic>
+#include <mutex>
 
 #ifdef CGAL_LINKED_WITH_TBB
 #include <tbb/parallel_for.h>
@@ -40,8 +40,6 @@
 #endif // CGAL_LINKED_WITH_TBB
 
 #include <CGAL/Simple_cartesian.h>
-#include <CGAL/Fuzzy_sphere.h>
-#include <CGAL/Search_traits_3.h>
 #include <CGAL/Bbox_3.h>
 
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -62,43 +60,176 @@ namespace CGAL {
 		}
 	}
 
+	// Thread safe progress printer for the per point passes
+	// Workers report finished points in batches and a line is only
+	// printed when a new percent is reached, so at most 100 lines are
+	// printed regardless of the number of points or threads
+	class Progress_reporter {
+	public:
+		Progress_reporter(const char * label, std::size_t total)
+			: m_label(label), m_total(total > 0 ? total : 1), m_done(0), m_next(1),
+			m_last(boost::posix_time::second_clock::local_time()) {}
+
+		void step(std::size_t count) {
+			std::size_t done = m_done.fetch_add(count) + count;
+			std::size_t percent = done * 100 / m_total;
+			std::size_t next = m_next.load();
+			while (percent >= next) {
+				if (m_next.compare_exchange_weak(next, percent + 1)) {
+					std::lock_guard<std::mutex> lock(m_mutex);
+					boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+					fmt::print("{} [{}%] [{} :: {}]\n", m_label, percent, boost::posix_time::to_simple_string(now), boost::posix_time::to_simple_string(now - m_last));
+					m_last = now;
+					break;
+				}
+			}
+		}
+
+	private:
+		const char * m_label;
+		const std::size_t m_total;
+		std::atomic<std::size_t> m_done;
+		std::atomic<std::size_t> m_next;
+		std::mutex m_mutex;
+		boost::posix_time::ptime m_last;
+	};
+
 namespace simplify_and_regularize_internal{
 
-// Item in the Kd-tree: position (Point_3) + index
+// Neighbor index over a uniform grid with cell size equal to the query
+// radius. The cells are hashed into a table of buckets and the points are
+// placed with a counting sort, so the index is cheap enough to rebuild on
+// every iteration. A radius query visits the buckets of the 27 cells
+// surrounding the query, each being a contiguous span of the sorted arrays
 template <typename Kernel>
-class Kd_tree_element : public Kernel::Point_3
+class Grid_neighbor_index
 {
 public:
-	unsigned int index;
-
-	// basic geometric types
-	typedef typename CGAL::Origin Origin;
-	typedef typename Kernel::Point_3 Base;
+	typedef typename Kernel::Point_3 Point;
+	typedef typename Kernel::FT FT;
 
-	Kd_tree_element(const Origin& o = ORIGIN, unsigned int id=0)
-		: Base(o), index(id)
-	{}
-	Kd_tree_element(const Base& p, unsigned int id=0)
-		: Base(p), index(id)
+	explicit Grid_neighbor_index(const FT cell_size)
+		: m_cell_size(cell_size), m_inverse_cell_size(FT(1.0) / cell_size)
 	{}
-	Kd_tree_element(const Kd_tree_element& other)
-		: Base(other), index(other.index)
-	{}
-};
 
-// Helper class for the Kd-tree
-template <typename Kernel>
-class Kd_tree_gt : public Kernel
-{
-public:
-	typedef Kd_tree_element<Kernel> Point_3;
-};
+	void build(const std::vector<Point>& points)
+	{
+		const std::size_t size = points.size();
 
-template <typename Kernel>
-class Kd_tree_traits : public CGAL::Search_traits_3<Kd_tree_gt<Kernel> >
-{
-public:
-	typedef typename Kernel::Point_3 PointType;
+		// Power of two table with at least two buckets per point
+		m_mask = 1;
+		while (m_mask < 2 * size) { m_mask <<= 1; }
+		m_mask--;
+
+		m_min_x = m_min_y = m_min_z = FT(0.0);
+		if (size > 0)
+		{
+			m_min_x = points[0].x();
+			m_min_y = points[0].y();
+			m_min_z = points[0].z();
+			for (std::size_t i = 1; i < size; ++i)
+			{
+				if (points[i].x() < m_min_x) { m_min_x = points[i].x(); }
+				if (points[i].y() < m_min_y) { m_min_y = points[i].y(); }
+				if (points[i].z() < m_min_z) { m_min_z = points[i].z(); }
+			}
+		}
+
+		// Counting sort: histogram, exclusive prefix sum, scatter
+		std::vector<std::size_t> buckets(size);
+		m_offsets.assign(m_mask + 2, 0);
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			buckets[i] = bucket_of(points[i]);
+			m_offsets[buckets[i] + 1]++;
+		}
+		for (std::size_t b = 1; b < m_offsets.size(); ++b)
+		{
+			m_offsets[b] += m_offsets[b - 1];
+		}
+
+		m_points.resize(size);
+		m_indices.resize(size);
+		std::vector<std::size_t> cursor(m_offsets.begin(), m_offsets.end() - 1);
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			std::size_t position = cursor[buckets[i]]++;
+			m_points[position] = points[i];
+			m_indices[position] = static_cast<unsigned int>(i);
+		}
+	}
+
+	/// Calls `visit(point, index, squared_distance)` for every indexed point
+	/// within `radius` of `query`. `radius` must not exceed the cell size
+	template <typename Visitor>
+	void for_each_in_radius(const Point& query,
+													const FT radius,
+													Visitor visit) const
+	{
+		CGAL_point_set_processing_precondition(radius <= m_cell_size);
+		const FT radius2 = radius * radius;
+
+		const long long cx = cell_of(query.x(), m_min_x);
+		const long long cy = cell_of(query.y(), m_min_y);
+		const long long cz = cell_of(query.z(), m_min_z);
+
+		// Neighboring cells may collide into the same bucket; only visit once
+		std::size_t visited[27];
+		int visited_count = 0;
+
+		for (long long x = cx - 1; x <= cx + 1; ++x)
+		for (long long y = cy - 1; y <= cy + 1; ++y)
+		for (long long z = cz - 1; z <= cz + 1; ++z)
+		{
+			const std::size_t bucket = hash(x, y, z);
+			if (std::find(visited, visited + visited_count, bucket)
+					!= visited + visited_count)
+			{
+				continue;
+			}
+			visited[visited_count++] = bucket;
+
+			const std::size_t end = m_offsets[bucket + 1];
+			for (std::size_t i = m_offsets[bucket]; i < end; ++i)
+			{
+				const FT dist2 = CGAL::squared_distance(query, m_points[i]);
+				if (dist2 <= radius2)
+				{
+					visit(m_points[i], m_indices[i], dist2);
+				}
+			}
+		}
+	}
+
+private:
+	long long cell_of(const FT value, const FT min) const
+	{
+		return static_cast<long long>(std::floor((value - min) * m_inverse_cell_size));
+	}
+
+	std::size_t hash(const long long x, const long long y, const long long z) const
+	{
+		return ((static_cast<std::size_t>(x) * 73856093u)
+			^ (static_cast<std::size_t>(y) * 19349663u)
+			^ (static_cast<std::size_t>(z) * 83492791u)) & m_mask;
+	}
+
+	std::size_t bucket_of(const Point& p) const
+	{
+		return hash(cell_of(p.x(), m_min_x),
+								cell_of(p.y(), m_min_y),
+								cell_of(p.z(), m_min_z));
+	}
+
+	FT m_cell_size;
+	FT m_inverse_cell_size;
+	FT m_min_x;
+	FT m_min_y;
+	FT m_min_z;
+	std::size_t m_mask;
+	std::vector<std::size_t> m_offsets;
+	std::vector<Point> m_points;
+	std::vector<unsigned int> m_indices;
 };
 
 /// Compute average and repulsion term, then 
@@ -107,18 +238,18 @@ public:
 /// \pre `radius > 0`
 ///
 /// @tparam Kernel Geometric traits class.
-/// @tparam Tree Kd-tree.
+/// @tparam Index Grid neighbor index.
 ///
 /// @return average term vector
 template <typename Kernel,
-					typename Tree,
+					typename Index,
 					typename RandomAccessIterator>
 typename Kernel::Point_3
 compute_update_sample_point(
 	const typename Kernel::Point_3& query, ///< 3D point to project
-	const Tree& original_kd_tree,          ///< original Kd-tree
-	const Tree& sample_kd_tree,            ///< sample Kd-tree
-	const typename Kernel::FT radius,      ///< neighborhood radius square
+	const Index& original_index,           ///< original neighbor index
+	const Index& sample_index,             ///< sample neighbor index
+	const typename Kernel::FT radius,      ///< neighborhood radius
 	const std::vector<typename Kernel::FT>& original_densities, ///<  
 	const std::vector<typename Kernel::FT>& sample_densities ///< 
 )
@@ -132,45 +263,30 @@ compute_update_sample_point(
 	typedef typename Kernel::Vector_3 Vector;
 	typedef typename Kernel::FT FT;
 
-	//types for range search
-	typedef simplify_and_regularize_internal::Kd_tree_element<Kernel> Kd_tree_point;
-	typedef simplify_and_regularize_internal::Kd_tree_traits<Kernel> Traits;
-	typedef CGAL::Fuzzy_sphere<Traits> Fuzzy_sphere;
-
-	//range search for original neighborhood
-	Fuzzy_sphere fs(query, radius, 0.0);
-	std::vector<Kd_tree_point> neighbor_original_points;
-	original_kd_tree.search(std::back_inserter(neighbor_original_points), fs);
-
-	//Compute average term
+	//Compute average term over the original neighborhood
 	FT radius2 = radius * radius;
 	Vector average = CGAL::NULL_VECTOR; 
-	FT weight = (FT)0.0, average_weight_sum = (FT)0.0;
+	FT average_weight_sum = (FT)0.0;
 	FT iradius16 = -(FT)4.0 / radius2;
+	std::size_t original_neighbor_count = 0;
 
-	typename std::vector<Kd_tree_point>::iterator iter;
-	iter = neighbor_original_points.begin();
-	for (; iter != neighbor_original_points.end(); ++iter)
+	original_index.for_each_in_radius(query, radius,
+		[&](const Point& np, unsigned int index, FT dist2)
 	{
-		const Point& np = *iter;
-
-		Kd_tree_point& kp = *iter;
-		int original_index = kp.index;
+		original_neighbor_count++;
+		if (dist2 < 1e-10) return;
 
-		FT dist2 = CGAL::squared_distance(query, np);
-		if (dist2 < 1e-10) continue;
-
-		weight = exp(dist2 * iradius16);
+		FT weight = exp(dist2 * iradius16);
 
 		if (!is_original_densities_empty)
 		{
-			weight *= original_densities[original_index];
+			weight *= original_densities[index];
 		}
 		average_weight_sum += weight;
 		average = average + (np - CGAL::ORIGIN) * weight;
-	}
+	});
 
-	if (neighbor_original_points.empty() || average_weight_sum < FT(1e-10))
+	if (original_neighbor_count == 0 || average_weight_sum < FT(1e-10))
 	{
 		average = query - CGAL::ORIGIN;
 	}
@@ -178,45 +294,33 @@ compute_update_sample_point(
 	{
 		average = average / average_weight_sum; 
 	}
-	neighbor_original_points.clear();
-	
-
-	//Compute repulsion term
 
-	Fuzzy_sphere fs2(query, radius, 0.0);
-	std::vector<Kd_tree_point> neighbor_sample_points;
-	sample_kd_tree.search(std::back_inserter(neighbor_sample_points), fs2);
-
-	weight = (FT)0.0;
+	//Compute repulsion term over the sample neighborhood
 	FT repulsion_weight_sum = (FT)0.0;
 	Vector repulsion = CGAL::NULL_VECTOR; 
+	std::size_t sample_neighbor_count = 0;
 
-	iter = neighbor_sample_points.begin();
-	for(; iter != neighbor_sample_points.end(); ++iter)
+	sample_index.for_each_in_radius(query, radius,
+		[&](const Point& np, unsigned int index, FT dist2)
 	{
-		const Point& np = *iter;
-
-		Kd_tree_point& kp = *iter;
-		int sample_index = kp.index;
-
-		FT dist2 = CGAL::squared_distance(query, np);
-		if (dist2 < 1e-10) continue;
+		sample_neighbor_count++;
+		if (dist2 < 1e-10) return;
 		FT dist = std::sqrt(dist2);
 		
-		weight = std::exp(dist2 * iradius16) * std::pow(FT(1.0) / dist, 2); // L1
+		FT weight = std::exp(dist2 * iradius16) * std::pow(FT(1.0) / dist, 2); // L1
 	 
 		if (!is_sample_densities_empty)
 		{
-			weight *= sample_densities[sample_index];
+			weight *= sample_densities[index];
 		}
 
 		Vector diff = query - np;
 
 		repulsion_weight_sum += weight;
 		repulsion = repulsion + diff * weight;
-	}
+	});
 
-	if (neighbor_sample_points.size() < 3 || repulsion_weight_sum < FT(1e-10))
+	if (sample_neighbor_count < 3 || repulsion_weight_sum < FT(1e-10))
 	{
 		repulsion = CGAL::NULL_VECTOR;
 	}
@@ -224,7 +328,6 @@ compute_update_sample_point(
 	{
 		repulsion = repulsion / repulsion_weight_sum; 
 	}
-	neighbor_sample_points.clear();
 
 	// Compute update sample point
 	Point update_sample = CGAL::ORIGIN + average + FT(0.45) * repulsion;
@@ -238,15 +341,15 @@ compute_update_sample_point(
 /// \pre `k >= 2`, radius > 0
 ///
 /// @tparam Kernel Geometric traits class.
-/// @tparam Tree Kd-tree.
+/// @tparam Index Grid neighbor index.
 ///
 /// @return computed point
-template <typename Kernel, typename Tree>
+template <typename Kernel, typename Index>
 typename Kernel::FT
 compute_density_weight_for_original_point(
 	const typename Kernel::Point_3& query, ///< 3D point to project
-	Tree& original_kd_tree,                       ///< Kd-tree
-	const typename Kernel::FT radius       ///< neighbor radius square
+	const Index& original_index,           ///< neighbor index
+	const typename Kernel::FT radius       ///< neighbor radius
 )
 {
 	CGAL_point_set_processing_precondition(radius > 0);
@@ -254,35 +357,18 @@ compute_density_weight_for_original_point(
 	// basic geometric types
 	typedef typename Kernel::Point_3                         Point;
 	typedef typename Kernel::FT                              FT;
-																													
-	//types for range search
-	typedef simplify_and_regularize_internal::Kd_tree_element<Kernel> Kd_tree_point;
-	typedef simplify_and_regularize_internal::Kd_tree_traits<Kernel> Traits;
-	typedef CGAL::Fuzzy_sphere<Traits> Fuzzy_sphere;
-
-	//range search for original neighborhood
-	Fuzzy_sphere fs(query, radius, 0.0);
-	std::vector<Kd_tree_point> neighbor_original_points;
-
-	original_kd_tree.search(std::back_inserter(neighbor_original_points), fs);
 
-	//Compute density weight
+	//Compute density weight over the original neighborhood
 	FT radius2 = radius * radius;
 	FT density_weight = (FT)1.0;
 	FT iradius16 = -(FT)4.0 / radius2;
 
-	typename std::vector<Kd_tree_point>::iterator iter;
-	iter = neighbor_original_points.begin();
-
-	for (; iter != neighbor_original_points.end(); iter++)
+	original_index.for_each_in_radius(query, radius,
+		[&](const Point&, unsigned int, FT dist2)
 	{
-		const Point& np = *iter;
-
-		FT dist2 = CGAL::squared_distance(query, np);
-		if (dist2 < 1e-8) continue;
-		
+		if (dist2 < 1e-8) return;
 		density_weight += std::exp(dist2 * iradius16);
-	}
+	});
 
 	// output
 	return FT(1.0) / density_weight;
@@ -295,46 +381,31 @@ compute_density_weight_for_original_point(
 /// \pre `k >= 2`, radius > 0
 ///
 /// @tparam Kernel Geometric traits class.
-/// @tparam Tree Kd-tree.
+/// @tparam Index Grid neighbor index.
 ///
 /// @return computed point
-template <typename Kernel, typename Tree>
+template <typename Kernel, typename Index>
 typename Kernel::FT
 compute_density_weight_for_sample_point(
 	const typename Kernel::Point_3& query, ///< 3D point to project
-	Tree& sample_kd_tree,                ///< Kd-tree
-	const typename Kernel::FT radius       ///< neighbor radius square
+	const Index& sample_index,             ///< neighbor index
+	const typename Kernel::FT radius       ///< neighbor radius
 )
 {
 	// basic geometric types
 	typedef typename Kernel::Point_3                          Point;
 	typedef typename Kernel::FT                               FT;
 
-	//types for range search
-	typedef simplify_and_regularize_internal::Kd_tree_element<Kernel> Kd_tree_point;
-	typedef simplify_and_regularize_internal::Kd_tree_traits<Kernel> Traits;
-	typedef CGAL::Fuzzy_sphere<Traits> Fuzzy_sphere;
-
-	//range search for original neighborhood
-	Fuzzy_sphere fs(query, radius, 0.0);
-	std::vector<Kd_tree_point> neighbor_sample_points;
-	sample_kd_tree.search(std::back_inserter(neighbor_sample_points), fs);
-
-	//Compute density weight
+	//Compute density weight over the sample neighborhood
 	FT radius2 = radius * radius;
 	FT density_weight = (FT)1.0;
 	FT iradius16 = -(FT)4.0 / radius2;
 
-	typename std::vector<Kd_tree_point>::iterator iter;
-	iter = neighbor_sample_points.begin();
-
-	for (; iter != neighbor_sample_points.end(); iter++)
+	sample_index.for_each_in_radius(query, radius,
+		[&](const Point&, unsigned int, FT dist2)
 	{
-		const Point& np = *iter;
-
-		FT dist2 = CGAL::squared_distance(query, np);
 		density_weight += std::exp(dist2 * iradius16);
-	}
+	});
 	
 	return density_weight;
 }
@@ -346,7 +417,7 @@ compute_density_weight_for_sample_point(
 #ifdef CGAL_LINKED_WITH_TBB
 /// \cond SKIP_IN_MANUAL
 /// This is for parallelization of function: compute_denoise_projection()
-template <typename Kernel, typename Tree, typename RandomAccessIterator>
+template <typename Kernel, typename Index, typename RandomAccessIterator>
 class Sample_point_updater 
 {
 	typedef typename Kernel::Point_3   Point;
@@ -354,8 +425,8 @@ class Sample_point_updater
 
 	std::vector<Point> &update_sample_points;
 	std::vector<Point> &sample_points;
-	const Tree &original_kd_tree;            
-	const Tree &sample_kd_tree;              
+	const Index &original_index;            
+	const Index &sample_index;              
 	const typename Kernel::FT radius;  
 	const std::vector<typename Kernel::FT> &original_densities;
 	const std::vector<typename Kernel::FT> &sample_densities; 
@@ -364,15 +435,15 @@ public:
 	Sample_point_updater(
 		std::vector<Point> &out,
 		std::vector<Point> &in,
-		const Tree &_original_kd_tree,            
-		const Tree &_sample_kd_tree,              
+		const Index &_original_index,            
+		const Index &_sample_index,              
 		const typename Kernel::FT _radius,
 		const std::vector<typename Kernel::FT> &_original_densities,
 		const std::vector<typename Kernel::FT> &_sample_densities): 
 	update_sample_points(out), 
 		sample_points(in),
-		original_kd_tree(_original_kd_tree),
-		sample_kd_tree(_sample_kd_tree),
+		original_index(_original_index),
+		sample_index(_sample_index),
 		radius(_radius),
 		original_densities(_original_densities),
 		sample_densities(_sample_densities){} 
@@ -395,16 +466,57 @@ public:
 				}
 			}
 			update_sample_points[i] = simplify_and_regularize_internal::
-				compute_update_sample_point<Kernel, Tree, RandomAccessIterator>(
+				compute_update_sample_point<Kernel, Index, RandomAccessIterator>(
 				sample_points[i], 
-				original_kd_tree,
-				sample_kd_tree,
+				original_index,
+				sample_index,
 				radius, 
 				original_densities,
 				sample_densities);
 		}
 	}
 };
+
+/// This is for parallelization of the density weight passes over the
+/// original points and over the sample points
+template <typename Kernel, typename Index, bool Is_original>
+class Density_weight_computer
+{
+	typedef typename Kernel::Point_3   Point;
+	typedef typename Kernel::FT        FT;
+
+	std::vector<FT> &density_weights;
+	const std::vector<Point> &points;
+	const Index &index;
+	const FT radius;
+	Progress_reporter &progress;
+
+public:
+	Density_weight_computer(
+		std::vector<FT> &out,
+		const std::vector<Point> &in,
+		const Index &_index,
+		const FT _radius,
+		Progress_reporter &_progress):
+	density_weights(out),
+		points(in),
+		index(_index),
+		radius(_radius),
+		progress(_progress){}
+
+	void operator() ( const tbb::blocked_range<size_t>& r ) const
+	{
+		for (size_t i = r.begin(); i != r.end(); ++i)
+		{
+			density_weights[i] = Is_original
+				? simplify_and_regularize_internal::
+					compute_density_weight_for_original_point<Kernel, Index>(points[i], index, radius)
+				: simplify_and_regularize_internal::
+					compute_density_weight_for_sample_point<Kernel, Index>(points[i], index, radius);
+		}
+		progress.step(r.size());
+	}
+};
 /// \endcond  
 #endif // CGAL_LINKED_WITH_TBB
 
@@ -477,11 +589,8 @@ wlop_simplify_and_regularize_point_set(
 	typedef typename Kernel::Point_3   Point;
 	typedef typename Kernel::FT        FT;
 
-	// types for K nearest neighbors search structure
-	typedef simplify_and_regularize_internal::Kd_tree_element<Kernel> Kd_tree_element;
-	typedef simplify_and_regularize_internal::Kd_tree_traits<Kernel> Tree_traits;
-	typedef CGAL::Orthogonal_k_neighbor_search<Tree_traits> Neighbor_search;
-	typedef typename Neighbor_search::Tree Kd_Tree;
+	// types for the fixed radius neighbor search structure
+	typedef simplify_and_regularize_internal::Grid_neighbor_index<Kernel> Grid_index;
 	
 	current[0] = boost::posix_time::second_clock::local_time();
 	last[0] = boost::posix_time::second_clock::local_time();
@@ -549,18 +658,18 @@ wlop_simplify_and_regularize_point_set(
 	}
 	fmt::print("  >> Using radius: {}\n", radius);
 
-	FT radius2 = radius * radius;
 	CGAL_point_set_processing_precondition(radius > 0);
 
-	// Initiate a KD-tree search for original points
+	// Initiate a grid search for original points
 	current[0] = boost::posix_time::second_clock::local_time();
-	fmt::print("Initiate a KD-tree search for original points [{} :: {}]\n", boost::posix_time::to_simple_string(current[0]), boost::posix_time::to_simple_string(current[0]-last[0]));
+	fmt::print("Initiate a grid search for original points [{} :: {}]\n", boost::posix_time::to_simple_string(current[0]), boost::posix_time::to_simple_string(current[0]-last[0]));
 	updateLast(0);
-	std::vector<Kd_tree_element> original_treeElements;
-	for (it = first_original_iter, i=0 ; it != beyond ; ++it, ++i)
-		original_treeElements.push_back( Kd_tree_element(get(point_pmap, *it), i) );
-	Kd_Tree original_kd_tree(original_treeElements.begin(), 
-													 original_treeElements.end());
+	std::vector<Point> original_points;
+	original_points.reserve(number_of_original);
+	for (it = first_original_iter; it != beyond ; ++it)
+		original_points.push_back(get(point_pmap, *it));
+	Grid_index original_index(radius);
+	original_index.build(original_points);
 
 
 	std::vector<Point> update_sample_points(number_of_sample);
@@ -572,29 +681,46 @@ wlop_simplify_and_regularize_point_set(
 	updateLast(0);
 	std::vector<FT> original_density_weights;
 
-	uint64_t counter_ = 1;
 	if (require_uniform_sampling)//default value is false
 	{
-		//todo: this part could also be parallelized if needed
 		current[0] = boost::posix_time::second_clock::local_time();
 		fmt::print("Simplify and regularize [{} :: {}]\n", boost::posix_time::to_simple_string(current[0]), boost::posix_time::to_simple_string(current[0] - last[0]));
 		updateLast(0);
-		for (it = first_original_iter, i = 0; it != beyond ; ++it, ++i)
+		original_density_weights.resize(number_of_original);
+		Progress_reporter progress("- Simplify and regularize", number_of_original);
+#ifdef CGAL_LINKED_WITH_TBB
+		if (boost::is_convertible<Concurrency_tag, Parallel_tag>::value)
+		{
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, number_of_original),
+												Density_weight_computer<Kernel, Grid_index, true>(
+													original_density_weights,
+													original_points,
+													original_index,
+													radius,
+													progress));
+		}else
+#endif
 		{
-			current[1] = boost::posix_time::second_clock::local_time();
-			fmt::print("- Simplify and regularize [{}/{}] [{} :: {}]\n", counter_++, beyond - first_original_iter, boost::posix_time::to_simple_string(current[1]), boost::posix_time::to_simple_string(current[1]-last[1]));
-			updateLast(1);
-			FT density = simplify_and_regularize_internal::
-									 compute_density_weight_for_original_point<Kernel, Kd_Tree>
-																				 (
-																					 get(point_pmap, *it),
-																					 original_kd_tree, 
-																					 radius);
-
-			original_density_weights.push_back(density);
+			for (i = 0; i < number_of_original; ++i)
+			{
+				original_density_weights[i] = simplify_and_regularize_internal::
+										 compute_density_weight_for_original_point<Kernel, Grid_index>
+																					 (
+																						 original_points[i],
+																						 original_index, 
+																						 radius);
+				progress.step(1);
+			}
 		}
 	}
 
+	// The copy is only needed for the density pass
+	original_points = std::vector<Point>();
+
+	// The sample index and densities are rebuilt in place on every iteration
+	Grid_index sample_index(radius);
+	std::vector<FT> sample_density_weights(number_of_sample);
+
 	current[0] = boost::posix_time::second_clock::local_time();
 	fmt::print("Main loop [{} :: {}]\n", boost::posix_time::to_simple_string(current[0]), boost::posix_time::to_simple_string(current[0] - last[0]));
 	updateLast(0);
@@ -603,44 +729,40 @@ wlop_simplify_and_regularize_point_set(
 		current[1] = boost::posix_time::second_clock::local_time();
 		fmt::print("- Main loop [{}/{}] [{} :: {}]\n", iter_n + 1, iter_number, boost::posix_time::to_simple_string(current[1]), boost::posix_time::to_simple_string(current[1]-last[1]));
 		updateLast(1);
-		// Initiate a KD-tree search for sample points
+		// Rebuild the grid search for sample points
 		current[2] = boost::posix_time::second_clock::local_time();
-		fmt::print("--- Initiate a KD-tree search for sample points [{} :: {}]\n", boost::posix_time::to_simple_string(current[2]), boost::posix_time::to_simple_string(current[2]-last[2]));
+		fmt::print("--- Initiate a grid search for sample points [{} :: {}]\n", boost::posix_time::to_simple_string(current[2]), boost::posix_time::to_simple_string(current[2]-last[2]));
 		updateLast(2);
-		std::vector<Kd_tree_element> sample_treeElements;
-		for (i=0 ; i < sample_points.size(); i++)
-		{
-			Point& p0 = sample_points[i];
-			sample_treeElements.push_back(Kd_tree_element(p0,i));
-		}
-		Kd_Tree sample_kd_tree(sample_treeElements.begin(), sample_treeElements.end());
+		sample_index.build(sample_points);
 
 		// Compute sample density weight for sample points
 		current[2] = boost::posix_time::second_clock::local_time();
 		fmt::print("--- Compute sample density weight for sample points [{} :: {}]\n", boost::posix_time::to_simple_string(current[2]), boost::posix_time::to_simple_string(current[2]-last[2]));
 		updateLast(2);
-		std::vector<FT> sample_density_weights;
-
-		current[2] = boost::posix_time::second_clock::local_time();
-		fmt::print("--- Simplify and regularize [{} :: {}]\n", boost::posix_time::to_simple_string(current[2]), boost::posix_time::to_simple_string(current[2]-last[2]));
-		updateLast(2);
-		for (sample_iter = sample_points.begin();
-				 sample_iter != sample_points.end(); ++sample_iter)
+		Progress_reporter progress("----- Simplify and regularize", number_of_sample);
+#ifdef CGAL_LINKED_WITH_TBB
+		if (boost::is_convertible<Concurrency_tag, Parallel_tag>::value)
+		{
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, number_of_sample),
+												Density_weight_computer<Kernel, Grid_index, false>(
+													sample_density_weights,
+													sample_points,
+													sample_index,
+													radius,
+													progress));
+		}else
+#endif
 		{
-			if ((sample_iter - sample_points.begin()) % (sample_points.size() / 100) == 0) {
-				current[3] = boost::posix_time::second_clock::local_time();
-				fmt::print("----- Simplify and regularize [{}%] [{} :: {}]\n", ((sample_iter - sample_points.begin()) + 1) * 100 / sample_points.size(), boost::posix_time::to_simple_string(current[3]), boost::posix_time::to_simple_string(current[3] - last[3]));
-				updateLast(3);
+			for (i = 0; i < number_of_sample; ++i)
+			{
+				sample_density_weights[i] = simplify_and_regularize_internal::
+										 compute_density_weight_for_sample_point<Kernel, Grid_index>
+										 (sample_points[i], 
+											sample_index, 
+											radius);
+				progress.step(1);
 			}
-			FT density = simplify_and_regularize_internal::
-									 compute_density_weight_for_sample_point<Kernel, Kd_Tree>
-									 (*sample_iter, 
-										sample_kd_tree, 
-										radius);
-
-			sample_density_weights.push_back(density);
 		}
-		
 
 		typename std::vector<Point>::iterator update_iter = update_sample_points.begin();
 #ifndef CGAL_LINKED_WITH_TBB
@@ -654,11 +776,11 @@ wlop_simplify_and_regularize_point_set(
 			fmt::print("--- Sample point updater [{} :: {}]\n", boost::posix_time::to_simple_string(current[2]), boost::posix_time::to_simple_string(current[2]-last[2]));
 			updateLast(2);
 			tbb::blocked_range<size_t> block(0, number_of_sample);
-			Sample_point_updater<Kernel, Kd_Tree, RandomAccessIterator> sample_updater(
+			Sample_point_updater<Kernel, Grid_index, RandomAccessIterator> sample_updater(
 													 update_sample_points,
 													 sample_points,          
-													 original_kd_tree,
-													 sample_kd_tree,
+													 original_index,
+													 sample_index,
 													 radius, 
 													 original_density_weights,
 													 sample_density_weights);
@@ -668,18 +790,17 @@ wlop_simplify_and_regularize_point_set(
 #endif
 		{
 			//sequential
-			counter_ = 1;
 			for (sample_iter = sample_points.begin();
 				sample_iter != sample_points.end(); ++sample_iter, ++update_iter)
 			{
 				*update_iter = simplify_and_regularize_internal::
 					compute_update_sample_point<Kernel,
-																			Kd_Tree,
+																			Grid_index,
 																			RandomAccessIterator>
 																			(*sample_iter,
-																			 original_kd_tree,
-																			 sample_kd_tree,
-																			 radius2,
+																			 original_index,
+																			 sample_index,
+																			 radius,
 																			 original_density_weights,
 																			 sample_density_weights);
 			}
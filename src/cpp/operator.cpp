@@ -7,6 +7,10 @@
 
 #include "las/las_file.hpp"
 #include "las/las_operations.hpp"
+#include "las/octree.hpp"
+#include "las/pipeline.hpp"
+#include "las/raster_file.hpp"
+#include "cl/cl_runner.hpp"
 
 #ifdef _WIN32
 // Force high performance GPU
@@ -162,6 +166,526 @@ namespace {
                boost::posix_time::to_simple_string(duration));
   }
 
+  template <int N>
+  void _executeFloatWLOP(const las::LASFile<N> & lasFile,
+                         const double percentage,
+                         const double radius,
+                         const unsigned int iterations,
+                         const bool uniform,
+                         const double epsilon = 0) {
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("Float WLOP Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Percentage to keep: {}%\n"
+               "Radius: {}\n"
+               "Number of iterations: {}\n"
+               "Requires uniform: {}\n"
+               "Convergence epsilon: {}\n\n",
+               lasFile.pointDataCount(),
+               percentage,
+               radius,
+               iterations,
+               uniform,
+               epsilon);
+    las::wlopFloat(lasFile, percentage, radius, iterations, uniform, epsilon);
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("Float WLOP Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("Float WLOP Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
+  /// Runs the OpenCL WLOP on any available device, CPU runtimes included
+  template <int N>
+  void _executeOpenCLWLOP(const las::LASFile<N> & lasFile,
+                          const double percentage,
+                          const double radius,
+                          const unsigned int iterations,
+                          const bool uniform) {
+    clest::ClRunner runner(CL_DEVICE_TYPE_ALL, {});
+
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("OpenCL WLOP Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Percentage to keep: {}%\n"
+               "Radius: {}\n"
+               "Number of iterations: {}\n"
+               "Requires uniform: {}\n\n",
+               lasFile.pointDataCount(),
+               percentage,
+               radius,
+               iterations,
+               uniform);
+    las::wlopOpenCL(lasFile, runner, percentage, radius, iterations, uniform);
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("OpenCL WLOP Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("OpenCL WLOP Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
+  template <int N>
+  void _executeTiledWLOP(const las::LASFile<N> & lasFile,
+                         const double percentage,
+                         const double radius,
+                         const unsigned int iterations,
+                         const bool uniform,
+                         const double tileSize,
+                         const uint64_t memoryBudgetMB,
+                         const double epsilon = 0) {
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("Tiled WLOP Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Percentage to keep: {}%\n"
+               "Radius: {}\n"
+               "Number of iterations: {}\n"
+               "Requires uniform: {}\n"
+               "Tile size: {}\n"
+               "Memory budget: {}MB\n"
+               "Convergence epsilon: {}\n\n",
+               lasFile.pointDataCount(),
+               percentage,
+               radius,
+               iterations,
+               uniform,
+               tileSize,
+               memoryBudgetMB,
+               epsilon);
+    las::wlopTiled(lasFile,
+                   percentage,
+                   radius,
+                   iterations,
+                   uniform,
+                   tileSize,
+                   memoryBudgetMB << 20,
+                   epsilon);
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("Tiled WLOP Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("Tiled WLOP Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
+  template <int N>
+  void _executeRemoveOutliers(const las::LASFile<N> & lasFile,
+                              const unsigned int k,
+                              const double stddevMultiplier) {
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("Outlier Removal Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Number of neighbors: {}\n"
+               "Standard deviation multiplier: {}\n\n",
+               lasFile.pointDataCount(),
+               k,
+               stddevMultiplier);
+    las::removeOutliers(lasFile, k, stddevMultiplier);
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("Outlier Removal Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("Outlier Removal Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
+  template <int N>
+  void _executeEstimateNormals(const las::LASFile<N> & lasFile,
+                               const unsigned int k) {
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("Normal Estimation Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Number of neighbors: {}\n\n",
+               lasFile.pointDataCount(),
+               k);
+    las::estimateNormals(lasFile, k);
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("Normal Estimation Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("Normal Estimation Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
+  template <int N>
+  void _executeDedupe(const las::LASFile<N> & lasFile,
+                      const double epsilon,
+                      const bool useTime) {
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("Dedupe Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Epsilon: {}\n"
+               "Compare GPS time: {}\n\n",
+               lasFile.pointDataCount(),
+               epsilon,
+               useTime);
+    las::dedupe(lasFile, epsilon, useTime);
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("Dedupe Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("Dedupe Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
+  template <int N>
+  void _executeStreamedDedupe(const las::LASFile<N> & lasFile,
+                              const uint64_t memoryBudgetMB,
+                              const bool useTime) {
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("Streamed Dedupe Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Memory budget: {}MB\n"
+               "Compare GPS time: {}\n\n",
+               lasFile.pointDataCount(),
+               memoryBudgetMB,
+               useTime);
+    las::dedupeStreamed(lasFile, memoryBudgetMB << 20, useTime);
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("Streamed Dedupe Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("Streamed Dedupe Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
+  template <int N>
+  void _executeTransform(const las::LASFile<N> & lasFile,
+                         const std::array<double, 16> & matrix,
+                         const std::array<double, 3> & newScale,
+                         const std::array<double, 3> & newOffset) {
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("Transform Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Matrix: [{}, {}, {}, {}]\n"
+               "        [{}, {}, {}, {}]\n"
+               "        [{}, {}, {}, {}]\n"
+               "Scale: [{}, {}, {}]\n"
+               "Offset: [{}, {}, {}]\n\n",
+               lasFile.pointDataCount(),
+               matrix[0], matrix[1], matrix[2], matrix[3],
+               matrix[4], matrix[5], matrix[6], matrix[7],
+               matrix[8], matrix[9], matrix[10], matrix[11],
+               newScale[0], newScale[1], newScale[2],
+               newOffset[0], newOffset[1], newOffset[2]);
+    las::transform(lasFile, matrix, newScale, newOffset);
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("Transform Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("Transform Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
+  template <int N>
+  void _executeCluster(const las::LASFile<N> & lasFile,
+                       const double radius,
+                       const uint64_t minSize) {
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("Clustering Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Radius: {}\n"
+               "Minimum cluster size: {}\n\n",
+               lasFile.pointDataCount(),
+               radius,
+               minSize);
+    las::cluster(lasFile, radius, minSize);
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("Clustering Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("Clustering Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
+  template <int N>
+  void _executeSegmentPlanes(const las::LASFile<N> & lasFile,
+                             const double threshold,
+                             const double cellSize,
+                             const uint64_t minPoints,
+                             const unsigned int iterations) {
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("Plane Segmentation Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Threshold: {}\n"
+               "Cell size: {}\n"
+               "Minimum plane size: {}\n"
+               "Number of iterations: {}\n\n",
+               lasFile.pointDataCount(),
+               threshold,
+               cellSize,
+               minPoints,
+               iterations);
+    las::segmentPlanes(lasFile, threshold, cellSize, minPoints, iterations);
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("Plane Segmentation Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("Plane Segmentation Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
+  template <int N>
+  void _executeRegister(const las::LASFile<N> & lasFile,
+                        const std::string & targetPath,
+                        const double maxDistance,
+                        const unsigned int iterations) {
+    las::LASFile<N> target(targetPath);
+    target.loadHeaders();
+    if (target.publicHeader.pointDataRecordFormat
+        != lasFile.publicHeader.pointDataRecordFormat) {
+      throw clest::Exception::build(
+        "The target {} does not have the point format of {}",
+        targetPath, lasFile.filePath);
+    }
+
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("Registration Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Target: {}\n"
+               "Number of target points: {}\n"
+               "Max distance: {}\n"
+               "Number of iterations: {}\n\n",
+               lasFile.pointDataCount(),
+               targetPath,
+               target.pointDataCount(),
+               maxDistance,
+               iterations);
+    las::registerICP(lasFile, target, maxDistance, iterations);
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("Registration Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("Registration Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
+  template <int N>
+  void _executeDiff(const las::LASFile<N> & lasFile,
+                    const std::string & afterPath,
+                    const double voxelSize) {
+    las::LASFile<N> after(afterPath);
+    after.loadHeaders();
+    if (after.publicHeader.pointDataRecordFormat
+        != lasFile.publicHeader.pointDataRecordFormat) {
+      throw clest::Exception::build(
+        "The epoch {} does not have the point format of {}",
+        afterPath, lasFile.filePath);
+    }
+
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("Change Detection Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Later epoch: {}\n"
+               "Number of later points: {}\n"
+               "Voxel size: {}\n\n",
+               lasFile.pointDataCount(),
+               afterPath,
+               after.pointDataCount(),
+               voxelSize);
+    las::diff(lasFile, after, voxelSize);
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("Change Detection Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("Change Detection Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
+  template <int N>
+  void _executeRasterize(const las::LASFile<N> & lasFile,
+                         const double cellSize,
+                         const las::RasterFile::Filter filter) {
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("Rasterization Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Cell size: {}\n"
+               "Filter: {}\n\n",
+               lasFile.pointDataCount(),
+               cellSize,
+               static_cast<int>(filter));
+
+    las::RasterFile raster;
+    raster.rasterize(lasFile, cellSize, filter);
+    raster.save(
+      lasFile.filePath.substr(0, lasFile.filePath.rfind(".las")) + ".raster");
+
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("Rasterization Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("Rasterization Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
+  /// Reads only the reached nodes of the octree at `octreePath`, if given,
+  /// and streams the whole file otherwise
+  template <int N>
+  void _executeCorridor(const las::LASFile<N> & lasFile,
+                        const std::vector<std::array<double, 2>> & polyline,
+                        const double distance,
+                        const std::string & octreePath = "") {
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("Corridor Extraction Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Polyline vertices: {}\n"
+               "Distance: {}\n"
+               "Octree: {}\n\n",
+               lasFile.pointDataCount(),
+               polyline.size(),
+               distance,
+               octreePath.empty() ? "none" : octreePath);
+
+    if (octreePath.empty()) {
+      las::extractCorridor(lasFile, polyline, distance);
+    } else {
+      las::extractCorridor(lasFile,
+                           las::OctreeIndex(octreePath),
+                           polyline,
+                           distance);
+    }
+
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("Corridor Extraction Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("Corridor Extraction Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
+  template <int N>
+  void _executeBuildOctree(const las::LASFile<N> & lasFile,
+                           const double spacing,
+                           const uint32_t maxNodePoints,
+                           const uint64_t memoryBudgetMB) {
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("Octree Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Spacing: {}\n"
+               "Max node points: {}\n"
+               "Memory budget: {}MB\n\n",
+               lasFile.pointDataCount(),
+               spacing,
+               maxNodePoints,
+               memoryBudgetMB);
+    las::buildOctree(lasFile, spacing, maxNodePoints, memoryBudgetMB << 20);
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("Octree Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("Octree Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
+  /// Keeps the ground points, thins them to one per voxel and then
+  /// writes them, grids them and gathers their statistics in one pass
+  template <int N>
+  void _executePipeline(const las::LASFile<N> & lasFile,
+                        const double voxelSize,
+                        const uint16_t gridSize) {
+    boost::posix_time::ptime start =
+      boost::posix_time::second_clock::local_time();
+    fmt::print("Pipeline Starting [{}]\n",
+               boost::posix_time::to_simple_string(start));
+    fmt::print("Parameters:\n"
+               "Number of points: {}\n"
+               "Voxel size: {}\n"
+               "Grid size: {}\n\n",
+               lasFile.pointDataCount(),
+               voxelSize,
+               gridSize);
+
+    const std::string base =
+      lasFile.filePath.substr(0, lasFile.filePath.rfind(".las"));
+    las::pipeline::StatsSink<N> stats(lasFile.publicHeader);
+    las::pipeline::GridSink<N> grid(lasFile.publicHeader,
+                                    gridSize,
+                                    gridSize,
+                                    gridSize);
+    las::pipeline::LASSink<N> output(lasFile, base + ".pipeline.las");
+
+    las::pipeline::Pipeline<N> pipeline;
+    pipeline.add(las::pipeline::classification<N>(2))
+      .add(std::make_unique<las::pipeline::VoxelThinning<N>>(
+        lasFile.publicHeader, voxelSize))
+      .sink(stats)
+      .sink(grid)
+      .sink(output);
+    pipeline.run(lasFile);
+
+    stats.print();
+    grid.grid().save(base + ".pipeline.grid");
+
+    boost::posix_time::ptime end =
+      boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration duration = end - start;
+    fmt::print("Pipeline Finished [{}]\n",
+               boost::posix_time::to_simple_string(end));
+    fmt::print("Pipeline Duration [{}]\n\n",
+               boost::posix_time::to_simple_string(duration));
+  }
+
   template <int N>
   int _mainExecuteBlock(las::LASFile<N> & lasFile) {
     int returnValue = 0;
@@ -173,6 +697,25 @@ namespace {
     //_executeSimplify(lasFile, 25);
     //_executeColorize(lasFile);
     //_executeCGALWLOP(lasFile, 1, -1, 1, false);
+    //_executeFloatWLOP(lasFile, 1, -1, 35, false, 0.001);
+    //_executeTiledWLOP(lasFile, 1, -1, 1, false, 500, 4096);
+    //_executeOpenCLWLOP(lasFile, 1, -1, 35, false);
+    //_executeRemoveOutliers(lasFile, 8, 1.0);
+    //_executeEstimateNormals(lasFile, 16);
+    //_executePipeline(lasFile, 0.5, 256);
+    //_executeDedupe(lasFile, 0, false);
+    //_executeStreamedDedupe(lasFile, 500, false);
+    //_executeTransform(lasFile,
+    //                  { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 },
+    //                  { 0.001, 0.001, 0.001 },
+    //                  { 0, 0, 0 });
+    //_executeBuildOctree(lasFile, 0, 20000, 500);
+    //_executeCluster(lasFile, 0.5, 100);
+    //_executeSegmentPlanes(lasFile, 0.05, 2, 1000, 256);
+    //_executeRegister(lasFile, "target.las", 1.0, 30);
+    //_executeDiff(lasFile, "after.las", 0.5);
+    //_executeRasterize(lasFile, 1, las::RasterFile::Filter::GROUND);
+    //_executeCorridor(lasFile, { { 0, 0 }, { 100, 100 } }, 5);
     //returnValue = _executeCL();  
 
     return returnValue;
@@ -0,0 +1,79 @@
+#include <array>
+#include <cstdio>
+#include <vector>
+
+#include <clest/ostream.hpp>
+
+#include "../las/las_file.hpp"
+#include "../las/las_operations.hpp"
+#include "../las/las_stream.hpp"
+
+/// Writes `points`, given in hundredths, to a format 0 file at `path`
+void writeCloud(const std::string & path,
+                const std::vector<std::array<int32_t, 3>> & points) {
+  las::PublicHeader header{};
+  header.fileSignature = { { 'L', 'A', 'S', 'F' } };
+  header.versionMajor = 1;
+  header.versionMinor = 2;
+  header.headerSize = 227;
+  header.xScaleFactor = 0.01;
+  header.yScaleFactor = 0.01;
+  header.zScaleFactor = 0.01;
+
+  std::vector<las::PointData<0>> data(points.size());
+  for (size_t i = 0; i < points.size(); ++i) {
+    data[i].x = points[i][0];
+    data[i].y = points[i][1];
+    data[i].z = points[i][2];
+  }
+
+  las::LASWriter<0> writer(path, header, {});
+  writer.write(data);
+}
+
+/// A chain of points 0.6 apart, deduplicated within 1, keeps every other
+/// point, since each dropped point is closer than 1 to a kept one but the
+/// next point is not. The exact duplicates keep their first point
+int main() {
+  const std::string input = "dedupe_chain.las";
+  const std::string output = "dedupe_chain.dedupe.las";
+  std::remove(input.c_str());
+  std::remove(output.c_str());
+
+  writeCloud(input, {
+    { { 0, 0, 0 } },
+    { { 60, 0, 0 } },
+    { { 120, 0, 0 } },
+    { { 180, 0, 0 } },
+    { { 240, 0, 0 } },
+    { { 1000, 0, 0 } },
+    { { 1000, 0, 0 } }
+  });
+
+  las::LASFile<0> lasFile(input);
+  lasFile.loadHeaders();
+  lasFile.loadData();
+  las::dedupe(lasFile, 1.0, false);
+
+  las::LASFile<0> result(output);
+  result.loadHeaders();
+  result.loadData();
+
+  const std::vector<int32_t> expected = { 0, 120, 240, 1000 };
+  bool passed = result.pointDataCount() == expected.size();
+  for (size_t i = 0; passed && i < expected.size(); ++i) {
+    passed = result.pointData[i].x == expected[i];
+  }
+
+  std::remove(input.c_str());
+  std::remove(output.c_str());
+
+  if (!passed) {
+    clest::println(stderr, "The chain kept {} points instead of {}",
+                   result.pointDataCount(), expected.size());
+    return 1;
+  }
+
+  clest::println("Chain deduplication passed");
+  return 0;
+}
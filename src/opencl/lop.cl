@@ -1,8 +1,229 @@
-//Block cell
-__kernel void lop(__global unsigned char * input,
-                  __global unsigned char * output,
-                  const unsigned int width
-) {
-  unsigned int index = get_global_id(0);
+// Weighted locally optimal projection
+//
+// Mirrors `las::wlop::simplifyAndRegularize`. The points are binned into a
+// uniform grid whose cell size is the WLOP radius, with the cells hashed
+// into a power of two table of buckets. The binning is a counting sort:
+// `lopBin` builds the histogram, the host turns it into offsets and
+// `lopScatter` places the points, so the points of a bucket are contiguous.
+// A query then visits the buckets of its 27 neighboring cells
+//
+// Only single precision and the core 32 bit atomics are used, so the
+// kernels run on CPU runtimes as well as on GPUs
 
+inline int3 cellOf(float3 point, float3 minimum, float inverseCellSize) {
+  return convert_int3(floor((point - minimum) * inverseCellSize));
+}
+
+// Same hash as the host grid index
+inline uint bucketOf(int3 cell, uint mask) {
+  return (((uint)cell.x * 73856093u)
+          ^ ((uint)cell.y * 19349663u)
+          ^ ((uint)cell.z * 83492791u)) & mask;
+}
+
+// Collects the buckets of the 27 cells around `point`
+// Neighboring cells may collide into the same bucket; each is kept once
+inline int neighborBuckets(float3 point,
+                           float3 minimum,
+                           float inverseCellSize,
+                           uint mask,
+                           uint * buckets) {
+  const int3 center = cellOf(point, minimum, inverseCellSize);
+  int count = 0;
+
+  for (int i = -1; i <= 1; ++i) {
+    for (int j = -1; j <= 1; ++j) {
+      for (int k = -1; k <= 1; ++k) {
+        uint bucket = bucketOf(center + (int3)(i, j, k), mask);
+        bool seen = false;
+        for (int b = 0; b < count; ++b) {
+          seen |= buckets[b] == bucket;
+        }
+        if (!seen) {
+          buckets[count++] = bucket;
+        }
+      }
+    }
+  }
+
+  return count;
+}
+
+kernel
+void lopBin(global const float * x,
+            global const float * y,
+            global const float * z,
+            global uint * buckets,
+            global volatile uint * histogram,
+            float3 minimum,
+            float inverseCellSize,
+            uint mask,
+            uint count) {
+  const uint index = get_global_id(0);
+  if (index >= count) return;
+
+  const float3 point = (float3)(x[index], y[index], z[index]);
+  const uint bucket = bucketOf(cellOf(point, minimum, inverseCellSize), mask);
+
+  buckets[index] = bucket;
+  atomic_inc(&histogram[bucket]);
+}
+
+// `cursor` starts as the exclusive prefix sum of the histogram
+kernel
+void lopScatter(global const float * x,
+                global const float * y,
+                global const float * z,
+                global const uint * buckets,
+                global volatile uint * cursor,
+                global float * sortedX,
+                global float * sortedY,
+                global float * sortedZ,
+                uint count) {
+  const uint index = get_global_id(0);
+  if (index >= count) return;
+
+  const uint position = atomic_inc(&cursor[buckets[index]]);
+  sortedX[position] = x[index];
+  sortedY[position] = y[index];
+  sortedZ[position] = z[index];
+}
+
+// Sum of `exp(-4 * d^2 / r^2)` over the neighbors, skipping the ones
+// closer than `sqrt(minimum2)`. The originals store the inverse of the
+// sum and the samples the sum itself
+kernel
+void lopDensity(global const float * x,
+                global const float * y,
+                global const float * z,
+                global const uint * offsets,
+                global float * density,
+                float3 minimum,
+                float inverseCellSize,
+                uint mask,
+                float radius2,
+                float exponent,
+                float minimum2,
+                int invert,
+                uint count) {
+  const uint index = get_global_id(0);
+  if (index >= count) return;
+
+  const float3 point = (float3)(x[index], y[index], z[index]);
+
+  uint buckets[27];
+  const int bucketCount =
+    neighborBuckets(point, minimum, inverseCellSize, mask, buckets);
+
+  float sum = 1.0f;
+  for (int b = 0; b < bucketCount; ++b) {
+    const uint end = offsets[buckets[b] + 1];
+    for (uint j = offsets[buckets[b]]; j < end; ++j) {
+      const float3 delta = (float3)(x[j], y[j], z[j]) - point;
+      const float d2 = dot(delta, delta);
+      if (d2 <= radius2 && d2 >= minimum2) {
+        sum += exp(d2 * exponent);
+      }
+    }
+  }
+
+  density[index] = invert ? 1.0f / sum : sum;
+}
+
+// Moves each sorted sample by the average term towards the originals and
+// the repulsion term away from the other samples. The result is written
+// to `outX/Y/Z` at the sorted position, so the input is never aliased
+kernel
+void lopUpdate(global const float * sampleX,
+               global const float * sampleY,
+               global const float * sampleZ,
+               global const uint * sampleOffsets,
+               global const float * sampleDensity,
+               global const float * originalX,
+               global const float * originalY,
+               global const float * originalZ,
+               global const uint * originalOffsets,
+               global const float * originalDensity,
+               global float * outX,
+               global float * outY,
+               global float * outZ,
+               float3 minimum,
+               float inverseCellSize,
+               uint sampleMask,
+               uint originalMask,
+               float radius2,
+               float exponent,
+               int uniform,
+               uint count) {
+  const uint index = get_global_id(0);
+  if (index >= count) return;
+
+  const float3 point =
+    (float3)(sampleX[index], sampleY[index], sampleZ[index]);
+
+  uint buckets[27];
+  int bucketCount;
+
+  // Average term
+  float averageWeight = 0.0f;
+  float3 average = (float3)(0.0f);
+  uint averageCount = 0;
+
+  bucketCount =
+    neighborBuckets(point, minimum, inverseCellSize, originalMask, buckets);
+  for (int b = 0; b < bucketCount; ++b) {
+    const uint end = originalOffsets[buckets[b] + 1];
+    for (uint j = originalOffsets[buckets[b]]; j < end; ++j) {
+      const float3 delta =
+        (float3)(originalX[j], originalY[j], originalZ[j]) - point;
+      const float d2 = dot(delta, delta);
+      if (d2 > radius2) continue;
+      averageCount++;
+      if (d2 < 1e-10f) continue;
+
+      float weight = exp(d2 * exponent);
+      if (uniform) {
+        weight *= originalDensity[j];
+      }
+      averageWeight += weight;
+      average += weight * delta;
+    }
+  }
+
+  // Repulsion term
+  float repulsionWeight = 0.0f;
+  float3 repulsion = (float3)(0.0f);
+  uint repulsionCount = 0;
+
+  bucketCount =
+    neighborBuckets(point, minimum, inverseCellSize, sampleMask, buckets);
+  for (int b = 0; b < bucketCount; ++b) {
+    const uint end = sampleOffsets[buckets[b] + 1];
+    for (uint j = sampleOffsets[buckets[b]]; j < end; ++j) {
+      const float3 delta =
+        point - (float3)(sampleX[j], sampleY[j], sampleZ[j]);
+      const float d2 = dot(delta, delta);
+      if (d2 > radius2) continue;
+      repulsionCount++;
+      if (d2 < 1e-10f) continue;
+
+      const float weight = exp(d2 * exponent) / d2 * sampleDensity[j];
+      repulsionWeight += weight;
+      repulsion += weight * delta;
+    }
+  }
+
+  float3 result = point;
+
+  if (averageCount > 0 && averageWeight >= 1e-10f) {
+    result += average / averageWeight;
+  }
+
+  if (repulsionCount >= 3 && repulsionWeight >= 1e-10f) {
+    result += 0.45f * repulsion / repulsionWeight;
+  }
+
+  outX[index] = result.x;
+  outY[index] = result.y;
+  outZ[index] = result.z;
 }
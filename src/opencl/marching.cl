@@ -1,20 +1,57 @@
+// Voxelization of quantized points
+//
+// Mirrors `grid::GridFile::convert`. The points are packed `uint3` in the
+// quantized coordinates of the LAS file. Rather than dequantizing them in
+// floating point, the voxel along each axis is the number of thresholds
+// of that axis not above the coordinate. The host derives the thresholds
+// from its own mapping, so the voxels match the host grid exactly
+//
+// Only integer arithmetic and the core 32 bit atomics are used, so the
+// kernel runs on CPU runtimes as well as on GPUs
+
+// Binary search of the `size - 1` sorted thresholds of an axis
+inline uint voxelAlong(uint value, global const ulong * thresholds, uint size) {
+  uint low = 0;
+  uint high = size - 1;
+  while (low < high) {
+    uint middle = (low + high) / 2;
+    if (thresholds[middle] <= value) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+// The thresholds of X, Y and Z follow one another
+// If `bricked` is set, the output has the bricked layout of `GridFile`
 kernel
-__attribute__((vec_type_hint(float3)))
-void createGrid(constant uint * points,
+void createGrid(global const uint * points,
+                global const ulong * thresholds,
                 global volatile uint * output,
-                float3 step,
-                float3 offset,
-                ushort3 size) {
-  const ulong index = get_global_id(0);
-  float3 point = points[index];
-
-  ushort3 grid = convert_ushort3((point - offset) / step);
+                uint sizeX,
+                uint sizeY,
+                uint sizeZ,
+                uint count,
+                uint bricked) {
+  const uint index = get_global_id(0);
+  if (index >= count) {
+    return;
+  }
 
-  if (grid.x == size.x) grid.x--;
-  if (grid.y == size.y) grid.y--;
-  if (grid.z == size.z) grid.z--;
+  const uint3 point = vload3(index, points);
+  const uint x = voxelAlong(point.x, thresholds, sizeX);
+  const uint y = voxelAlong(point.y, thresholds + sizeX - 1, sizeY);
+  const uint z = voxelAlong(point.z, thresholds + sizeX + sizeY - 2, sizeZ);
 
-  atomic_inc(&output[grid.z + grid.y * size.z + grid.x * size.y * size.z]);
+  if (bricked) {
+    const ulong brick = ((ulong)(x >> 3) * ((sizeY + 7) >> 3) + (y >> 3))
+      * ((sizeZ + 7) >> 3) + (z >> 3);
+    atomic_inc(&output[(brick << 9) | ((x & 7) << 6) | ((y & 7) << 3) | (z & 7)]);
+  } else {
+    atomic_inc(&output[z + y * sizeZ + (ulong)x * sizeY * sizeZ]);
+  }
 }
 
 //kernel